@@ -23,36 +23,21 @@ namespace ExpressionParserV2 {
 	Uuid uuid;
 	std::vector<ExpressionParserV2::Token> tokens;
 
+	// an evaluation that stopped partway, to call a knot function or wait on an external one: the tokens with everything
+	// worked out so far in place, and where the call it stopped on is
+	// NOTE: kept in the story's state rather than here, since expressions belong to story data that many stories can share
 	struct StackEntry {
 		std::vector<ExpressionParserV2::Token> function_prepared_tokens;
 		std::size_t function_eval_index = SIZE_MAX;
 		std::size_t argument_count = 0;
-		bool preparation_finished = false;
 	};
 
-	std::vector<StackEntry> preparation_stack;
+	ShuntedExpression() : tokens{}, uuid{0} {}
+	explicit ShuntedExpression(const std::vector<ExpressionParserV2::Token>& tokens) : tokens{tokens}, uuid{0} {}
+	explicit ShuntedExpression(std::vector<ExpressionParserV2::Token>&& tokens) : tokens{tokens}, uuid{0} {}
 
-	ShuntedExpression() : tokens{}, preparation_stack{}, uuid{0} {}
-	explicit ShuntedExpression(const std::vector<ExpressionParserV2::Token>& tokens) : tokens{tokens}, preparation_stack{}, uuid{0} {}
-	explicit ShuntedExpression(std::vector<ExpressionParserV2::Token>&& tokens) : tokens{tokens}, preparation_stack{}, uuid{0} {}
-
-	void push_entry() {
-		StackEntry new_entry;
-		new_entry.function_prepared_tokens = tokens;
-		preparation_stack.push_back(new_entry);
-	}
-
-	void pop_entry() {
-		preparation_stack.pop_back();
-	}
-
-	StackEntry& stack_back() {
-		return preparation_stack.back();
-	}
-
-	bool stack_empty() const { 
-		return preparation_stack.empty();
-	}
+	// adds every name in this expression that could refer to a knot (diverts, function calls, read counts)
+	void collect_referenced_names(std::unordered_set<std::string>& names) const;
 };
 
 std::vector<ExpressionParserV2::Token> tokenize_expression(const std::string& expression, ExpressionParserV2::StoryVariableInfo& story_variable_info);
@@ -63,22 +48,38 @@ struct NulloptResult {
 	enum class Reason {
 		NoReturnValue,
 		FoundKnotFunction,
+		WaitingOnExternal,
 		Failed,
 	} reason;
 
 	ExpressionParserV2::Token function;
 	std::size_t function_index;
 	std::vector<ExpressionParserV2::Token> arguments;
+	std::shared_ptr<ExpressionParserV2::PendingValue> pending_value;
 
 	NulloptResult(Reason reason) : reason{reason}, function{}, function_index{0}, arguments{} {}
 	NulloptResult(Reason reason, const ExpressionParserV2::Token& function, std::size_t function_index, const std::vector<ExpressionParserV2::Token>& arguments) : reason{reason}, function{function}, function_index{function_index}, arguments{arguments} {}
+
+	// whether the expression stopped partway, to call a knot function or to wait on an external one, and will be picked up from there again
+	bool interrupted() const { return reason == Reason::FoundKnotFunction || reason == Reason::WaitingOnExternal; }
 };
 
 
 typedef std::expected<Variant, NulloptResult> ExecuteResult;
 
-ExpressionParserV2::ExecuteResult execute_expression_tokens(std::vector<ExpressionParserV2::Token>& tokens, ExpressionParserV2::StoryVariableInfo& story_variable_info);
+// NOTE: leaves the tokens as they were, so the same ones can be run by any number of stories at once
+ExpressionParserV2::ExecuteResult execute_expression_tokens(const std::vector<ExpressionParserV2::Token>& tokens, ExpressionParserV2::StoryVariableInfo& story_variable_info);
 ExpressionParserV2::ExecuteResult execute_expression(const std::string& expression, ExpressionParserV2::StoryVariableInfo& story_variable_info);
 ShuntedExpression tokenize_and_shunt_expression(const std::string& expression, ExpressionParserV2::StoryVariableInfo& story_variable_info);
 
 }
+
+template <>
+struct Serializer<ExpressionParserV2::ShuntedExpression> {
+	ByteVec operator()(const ExpressionParserV2::ShuntedExpression& expression);
+};
+
+template <>
+struct Deserializer<ExpressionParserV2::ShuntedExpression> {
+	ExpressionParserV2::ShuntedExpression operator()(const ByteVec& bytes, std::size_t& index);
+};
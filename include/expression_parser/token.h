@@ -12,6 +12,8 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <functional>
+#include <memory>
+#include <mutex>
 
 #if INK_DOUBLE_PRECISION_FLOATS
 using ink_float = double;
@@ -63,6 +65,10 @@ public:
 	inline bool has_value() const { return _has_value; }
 	inline std::size_t index() const { return value.index(); }
 	std::string to_printable_string() const;
+	// the same for equal values in every process and on every machine, unlike std::hash
+	std::uint64_t stable_hash() const;
+	// roughly how much memory a string or list value holds on to beyond the variant itself
+	std::size_t heap_bytes() const;
 
 	Variant operator+(const Variant& rhs) const;
 	Variant operator-(const Variant& rhs) const;
@@ -106,7 +112,32 @@ public:
 };
 
 using InkFunction = std::function<Variant(const std::vector<Variant>&)>;
+
+// what an external function can hand back when it doesn't have its value yet; whoever works the value out resolves it, from any thread,
+// and the story stops where the function was called until it has been
+class PendingValue {
+private:
+	mutable std::mutex mutex;
+	Variant value;
+	bool resolved = false;
+	std::vector<std::function<void()>> callbacks;
+
+public:
+	// an empty variant is a function that doesn't return anything
+	void resolve(const Variant& result = Variant());
+	bool is_resolved() const;
+	Variant get() const;
+
+	// runs the callback once the value has been resolved, straight away (on this thread) if it already has been
+	void on_resolved(std::function<void()>&& callback);
+};
+
+using ExternalResult = std::variant<Variant, std::shared_ptr<PendingValue>>;
+using ExternalFunction = std::function<ExternalResult(const std::vector<Variant>&)>;
+
 typedef void (*VariableObserverFunc)(const std::string&, const Variant&);
+// hears about a variable once per line at most, with the value it had before the line and the one it ended up with
+using VariableChangeObserver = std::function<void(const std::string&, const Variant&, const Variant&)>;
 
 struct StoryVariableInfo {
 	std::unordered_map<std::string, Variant> variables;
@@ -116,17 +147,35 @@ struct StoryVariableInfo {
 
 	// HACK: find some better way to store these+argument counts
 	std::unordered_map<std::string, std::pair<InkFunction, std::uint8_t>> builtin_functions;
-	std::unordered_map<std::string, InkFunction> external_functions;
+	// NOTE: every EXTERNAL the story declares has an entry, which is left empty until the host binds something to it
+	std::unordered_map<std::string, ExternalFunction> external_functions;
 
 	std::unordered_map<std::string, std::vector<VariableObserverFunc>> observers;
 
+	struct ChangeWatch {
+		std::vector<VariableChangeObserver> observers;
+		bool changed = false;
+	};
+
+	// NOTE: only variables someone watches are recorded, in the order they first changed, and each only once until they're delivered
+	std::unordered_map<std::string, ChangeWatch> change_watches;
+	std::vector<std::pair<std::string, Variant>> changed_variables;
+
 	InkListDefinitionMap defined_lists;
 
 	Uuid current_weave_uuid;
 
+	// every global variable's name and value combined in a way that doesn't care about order, kept up to date as they're stored
+	std::uint64_t variables_hash = 0;
+
 	std::optional<Variant> get_variable_value(const std::string& variable) const;
 	void set_variable_value(const std::string& variable, const Variant& value, bool ignore_redirects = false);
 
+	// sets a global variable, creating it if it doesn't exist yet, without going through redirects or observers
+	void store_global_variable(const std::string& variable, const Variant& value);
+	void rehash_variables();
+	static std::uint64_t variable_hash(const std::string& variable, const Variant& value);
+
 	void observe_variable(const std::string& variable_name, VariableObserverFunc callback);
 
 	void unobserve_variable(const std::string& variable_name);
@@ -135,8 +184,32 @@ struct StoryVariableInfo {
 
 	void unobserve_variable(const std::string& variable_name, VariableObserverFunc observer);
 
+	void watch_variable_changes(const std::string& variable_name, VariableChangeObserver observer);
+	void unwatch_variable_changes(const std::string& variable_name);
+
+	// calls the watchers of every variable that changed since the last delivery, skipping those that ended up back where they started
+	void deliver_variable_changes();
+	void discard_variable_changes();
+
 	inline void flag_variable_changed(const std::string& variable) {
-		execute_variable_observers(variable, variables[variable]);
+		if (observers.empty()) {
+			return;
+		}
+
+		if (auto value = variables.find(variable); value != variables.end()) {
+			execute_variable_observers(variable, value->second);
+		}
+	}
+
+	inline void record_variable_change(const std::string& variable, const Variant& old_value) {
+		if (change_watches.empty()) {
+			return;
+		}
+
+		if (auto watch = change_watches.find(variable); watch != change_watches.end() && !watch->second.changed) {
+			watch->second.changed = true;
+			changed_variables.emplace_back(variable, old_value);
+		}
 	}
 
 	Uuid add_list_definition(const std::string& name, const std::vector<InkListDefinition::Entry>& values) { return defined_lists.add_list_definition(name, values); }
@@ -353,7 +426,6 @@ struct Token {
 
 	void fetch_variable_value(const StoryVariableInfo& story_vars);
 	void store_variable_value(StoryVariableInfo& story_vars);
-	void fetch_function_value(const StoryVariableInfo& story_vars);
 
 	void increment(bool post, StoryVariableInfo& story_vars);
 	void decrement(bool post, StoryVariableInfo& story_vars);
@@ -366,7 +438,8 @@ struct Token {
 
 	void assign_variable(const Token& other, StoryVariableInfo& story_vars);
 
-	Variant call_function(const std::vector<Variant>& arguments, const StoryVariableInfo& story_variable_info);
+	Variant call_function(const std::vector<Variant>& arguments, const StoryVariableInfo& story_variable_info) const;
+	ExternalResult call_external_function(const std::vector<Variant>& arguments, const StoryVariableInfo& story_variable_info) const;
 };
 
 }
@@ -391,4 +464,14 @@ struct Deserializer<ExpressionParserV2::Token> {
 	ExpressionParserV2::Token operator()(const ByteVec& bytes, std::size_t& index);
 };
 
+template <>
+struct Serializer<ExpressionParserV2::StoryVariableInfo> {
+	ByteVec operator()(const ExpressionParserV2::StoryVariableInfo& variable_info);
+};
+
+template <>
+struct Deserializer<ExpressionParserV2::StoryVariableInfo> {
+	ExpressionParserV2::StoryVariableInfo operator()(const ByteVec& bytes, std::size_t& index);
+};
+
 #undef i64
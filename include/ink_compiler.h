@@ -9,24 +9,30 @@
 #include <string>
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
 #include <list>
+#include <deque>
+#include <string_view>
 #include <format>
+#include <future>
+#include <memory>
+#include <semaphore>
 
 class InkLexer {
 public:
 	struct Token {
 		InkToken token;
-		std::string text_contents;
+		std::string_view text_contents;
 		std::uint8_t count;
 		bool escaped;
 
 		Token() : token{InkToken::INVALID}, text_contents{}, count{1}, escaped{false} {}
-		Token(InkToken token, const std::string& text) : token{token}, text_contents{text}, count{1}, escaped{false} {}
-		Token(InkToken token, const std::string& text, std::uint8_t count) : token{token}, text_contents{text}, count{count}, escaped{false} {}
+		Token(InkToken token, std::string_view text) : token{token}, text_contents{text}, count{1}, escaped{false} {}
+		Token(InkToken token, std::string_view text, std::uint8_t count) : token{token}, text_contents{text}, count{count}, escaped{false} {}
 
 		std::string to_string() const {
 			if (token == InkToken::Text) {
-				return text_contents;
+				return std::string(text_contents);
 			} else {
 				return std::format("{}({})", static_cast<int>(token), count);
 			}
@@ -34,7 +40,7 @@ public:
 
 		std::string get_text_contents() const {
 			if (token == InkToken::Text) {
-				return text_contents;
+				return std::string(text_contents);
 			} else {
 				std::string result;
 				result.reserve(text_contents.length() * count);
@@ -47,10 +53,53 @@ public:
 		}
 	};
 
+private:
+	// text that had escape sequences removed, and so can't point into the script
+	std::deque<std::string> escaped_texts;
+
+public:
 	InkLexer() = default;
 	~InkLexer() = default;
 
-	std::vector<Token> lex_script(const std::string& script_text);
+	// NOTE: tokens point into script_text and this lexer, so both must outlive them; comments are not included
+	std::vector<Token> lex_script(std::string_view script_text);
+};
+
+// Compiled knots from previous builds, keyed by a hash of each knot's tokens and the declarations it was compiled against
+class InkKnotCache {
+public:
+	struct Entry {
+		UuidValue uuid_base = 0;
+		UuidValue uuid_count = 0;
+		bool has_content = false;
+		// NOTE: empty for sections that always have to be recompiled (ones with INCLUDE, or that didn't compile into a single knot), which only keep their uuid range
+		ByteVec knot_bytes;
+		// the story's list definitions after this section, if it declared any
+		ByteVec list_bytes;
+		// the names of the story's EXTERNAL functions after this section, if it declared any
+		std::vector<std::string> external_names;
+	};
+
+private:
+	std::unordered_map<std::uint64_t, Entry> entries;
+	std::unordered_map<std::uint64_t, Entry> used_entries;
+	UuidValue next_uuid = 1;
+
+	std::size_t reused_count = 0;
+	std::size_t compiled_count = 0;
+
+public:
+	// NOTE: a missing or outdated cache file just means starting from an empty cache
+	void load(const std::string& path);
+	void save(const std::string& path) const;
+
+	const Entry* find(std::uint64_t key) const;
+	void store(std::uint64_t key, const Entry& entry, bool reused);
+
+	UuidValue get_next_uuid() const { return next_uuid; }
+
+	std::size_t get_reused_count() const { return reused_count; }
+	std::size_t get_compiled_count() const { return compiled_count; }
 };
 
 class InkCompiler {
@@ -76,8 +125,74 @@ private:
 	UuidValue current_uuid = 0;
 
 	ExpressionParserV2::StoryVariableInfo story_variable_info;
+
+	struct IncludeResult {
+		InkStoryData* story_data = nullptr;
+		UuidValue uuid_count = 0;
+	};
+
+	struct PendingInclude {
+		std::string path;
+		std::future<IncludeResult> result;
+	};
+
+	// NOTE: included files are compiled ahead of time starting from uuid 0, and have their uuids shifted into place when the INCLUDE line is reached
+	std::deque<PendingInclude> pending_includes;
+	std::size_t max_threads = 1;
+	std::shared_ptr<std::counting_semaphore<>> include_workers;
+
+	// NOTE: objects are created in these while compiling, and ownership of them passes to the resulting story data
+	std::vector<std::unique_ptr<InkObjectArena>> compile_arenas;
+
+	struct CacheSection {
+		bool active = false;
+		bool cacheable = false;
+		bool is_knot = false;
+		bool has_lists = false;
+		bool has_externals = false;
+		std::uint64_t key = 0;
+		UuidValue uuid_base = 0;
+		std::size_t knot_count = 0;
+	};
+
+	std::string knot_cache_path;
+	InkKnotCache knot_cache;
+	CacheSection cache_section;
+	std::uint64_t cache_context_hash = 0;
+
+	bool strip_unreachable = false;
+	std::vector<std::string> entry_points;
+	std::vector<std::string> stripped_knots;
+
+public:
+	struct ObjectCounts {
+		std::size_t before = 0;
+		std::size_t after = 0;
+	};
+
+private:
+	// NOTE: included files are merged once they've been linked into the including story, so they aren't walked twice
+	bool merge_adjacent = true;
+	ObjectCounts merged_object_counts;
+
+public:
+	// milliseconds spent in each phase of the last compile; time spent compiling included files counts towards compiling
+	struct PhaseTimings {
+		double lex = 0.0;
+		double compile = 0.0;
+		double serialize = 0.0;
+	};
+
+private:
+	PhaseTimings phase_timings;
 	
 public:
+	InkCompiler() = default;
+	~InkCompiler();
+
+	InkCompiler(const InkCompiler&) = delete;
+	InkCompiler& operator=(const InkCompiler&) = delete;
+
 	InkStory compile_script(const std::string& script);
 	InkStory compile_file(const std::string& file_path);
 
@@ -88,13 +203,40 @@ public:
 	UuidValue get_current_uuid() const { return current_uuid; }
 	void set_current_uuid(UuidValue value) { current_uuid = value; }
 
+	// the number of threads INCLUDE'd files may be compiled on, shared with any files they include in turn
+	std::size_t get_max_threads() const { return max_threads; }
+	void set_max_threads(std::size_t count) { max_threads = count > 0 ? count : 1; }
+
+	// with a cache file set, knots that haven't changed since the last compile are reused from it rather than recompiled, and keep their uuids
+	void set_knot_cache_file(const std::string& path) { knot_cache_path = path; }
+	const InkKnotCache& get_knot_cache() const { return knot_cache; }
+
+	// with stripping on, knots and functions that can't be reached from the start of the story or an entry point are left out of the result
+	void set_strip_unreachable(bool strip) { strip_unreachable = strip; }
+	void add_entry_point(const std::string& knot_name) { entry_points.push_back(knot_name); }
+	const std::vector<std::string>& get_stripped_knots() const { return stripped_knots; }
+
+	// the number of objects in the story before and after adjacent text, line breaks and glue were merged together
+	const ObjectCounts& get_merged_object_counts() const { return merged_object_counts; }
+
+	const PhaseTimings& get_phase_timings() const { return phase_timings; }
+
 private:
 	void init_compiler();
 
 	InkStoryData* compile(const std::string& script);
+	void merge_objects(InkStoryData* story_data);
+	void start_includes(const std::vector<InkLexer::Token>& tokens);
+	IncludeResult take_include(const std::string& path);
+	void discard_pending_includes();
+	static IncludeResult compile_include(const std::string& path, std::shared_ptr<std::counting_semaphore<>> workers);
+
+	bool begin_cache_section(const std::vector<InkLexer::Token>& tokens, std::size_t section_end, bool aligned, std::vector<Knot>& story_knots);
+	void finish_cache_section(std::vector<Knot>& story_knots);
+	static std::vector<std::size_t> find_knot_sections(const std::vector<InkLexer::Token>& tokens);
+
 	InkObject* compile_token(std::vector<InkLexer::Token>& all_tokens, const InkLexer::Token& token, std::vector<Knot>& story_knots);
 
-	static std::vector<InkLexer::Token> remove_comments(const std::vector<InkLexer::Token>& tokens);
 	static InkLexer::Token next_token(const std::vector<InkLexer::Token>& tokens, std::size_t index);
 	static bool next_token_is(const std::vector<InkLexer::Token>& tokens, std::size_t index, InkToken what);
 	static bool next_token_is_sequence(const std::vector<InkLexer::Token>& tokens, std::size_t index, std::vector<InkToken>&& what);
@@ -94,3 +94,19 @@ enum class InkObjectType : char {
 	Logic,
 	GlobalVariable,
 };
+
+enum class ObjectId {
+	Text,
+	Choice,
+	LineBreak,
+	Glue,
+	Divert,
+	Interpolation,
+	Conditional,
+	Sequence,
+	ChoiceTextMix,
+	Tag,
+	GlobalVariable,
+	Logic,
+	List,
+};
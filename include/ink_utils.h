@@ -1,11 +1,56 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <random>
+#include <cstdint>
 
-std::string strip_string_edges(const std::string& string, bool left = true, bool right = true, bool include_spaces = false) noexcept;
+std::string strip_string_edges(std::string_view string, bool left = true, bool right = true, bool include_spaces = false) noexcept;
+bool has_visible_characters(std::string_view string) noexcept;
 std::string remove_duplicate_spaces(const std::string& string) noexcept;
 std::string join_string_vector(const std::vector<std::string>& vector, std::string&& delimiter) noexcept;
 std::vector<std::string> split_string(const std::string& string, char delimiter, bool ignore_delim_spaces, bool paren_arguments = false) noexcept;
-std::int64_t randi_range(std::int64_t from, std::int64_t to, std::mt19937& generator) noexcept;
+
+// PCG32 (XSH RR): 16 bytes of state that copy and store as they are, where std::mt19937 carries about 5 KB
+// NOTE: generators on different streams never overlap, so forks of one seed can each carry on differently from the same place
+class Pcg32 {
+private:
+	static constexpr std::uint64_t Multiplier = 6364136223846793005ull;
+
+	std::uint64_t state = 0;
+	std::uint64_t increment = 1;
+
+public:
+	using result_type = std::uint32_t;
+
+	Pcg32() { seed(0); }
+	explicit Pcg32(std::uint64_t seed_value, std::uint64_t stream = 0) { seed(seed_value, stream); }
+
+	void seed(std::uint64_t seed_value, std::uint64_t stream = 0) noexcept;
+
+	// skips ahead as if `count` numbers had been drawn, in time that only grows with the number of bits in `count`
+	void discard(std::uint64_t count) noexcept;
+
+	// a new generator on another stream, seeded from where this one is, without moving this one on
+	Pcg32 split(std::uint64_t stream) const noexcept;
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return UINT32_MAX; }
+
+	result_type operator()() noexcept {
+		std::uint64_t old_state = state;
+		state = old_state * Multiplier + increment;
+		std::uint32_t xorshifted = static_cast<std::uint32_t>(((old_state >> 18) ^ old_state) >> 27);
+		std::uint32_t rotation = static_cast<std::uint32_t>(old_state >> 59);
+		return (xorshifted >> rotation) | (xorshifted << ((0u - rotation) & 31));
+	}
+
+	bool operator==(const Pcg32& other) const = default;
+};
+
+std::int64_t randi_range(std::int64_t from, std::int64_t to, Pcg32& generator) noexcept;
+
+// NOTE: unlike std::hash these give the same answer in every process and on every machine, so they're safe to store or compare across runs
+std::uint64_t stable_hash(std::string_view string) noexcept;
+std::uint64_t mix_hash(std::uint64_t value) noexcept;
@@ -2,55 +2,88 @@
 
 #include <string>
 #include <vector>
+#include <unordered_set>
 #include <utility>
+#include <new>
+#include <memory>
+#include <memory_resource>
 
+#include "ink_enums.h"
 #include "serialization.h"
 #include "runtime/ink_story_state.h"
 #include "expression_parser/expression_parser.h"
 
-enum class ObjectId {
-	Text,
-	Choice,
-	LineBreak,
-	Glue,
-	Divert,
-	Interpolation,
-	Conditional,
-	Sequence,
-	ChoiceTextMix,
-	Tag,
-	GlobalVariable,
-	Logic,
-	List,
-};
+using InkObjectArena = std::pmr::monotonic_buffer_resource;
 
 class InkObject {
 public:
 	typedef std::vector<struct ExpressionParserV2::ShuntedExpression*> ExpressionsVec;
 
+	// While one of these is alive, objects created on this thread are placed in the given arena
+	class ArenaScope {
+	private:
+		InkObjectArena* previous_arena;
+
+	public:
+		explicit ArenaScope(InkObjectArena* arena);
+		~ArenaScope();
+
+		ArenaScope(const ArenaScope&) = delete;
+		ArenaScope& operator=(const ArenaScope&) = delete;
+	};
+
+private:
+	static thread_local InkObjectArena* current_arena;
+
 public:
 	virtual ~InkObject();
 
+	// NOTE: objects in an arena only have their destructor run when deleted, and their memory is released along with the arena
+	static void* operator new(std::size_t size);
+	void operator delete(InkObject* object, std::destroying_delete_t);
+	static void operator delete(void* memory);
+
 	virtual std::string to_string() const;
 	virtual std::vector<std::uint8_t> to_bytes() const;
 	virtual InkObject* populate_from_bytes(const std::vector<std::uint8_t>& bytes, std::size_t& index);
 	virtual ObjectId get_id() const = 0;
 	virtual bool has_any_contents(bool strip) const { return true; }
 	virtual bool contributes_content_to_knot() const { return false; }
+	virtual bool ends_line() const { return false; }
 
-	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) = 0;
+	// NOTE: objects belong to story data that any number of stories can be running at once, so anything that changes as a story runs
+	// is kept in its state instead
+	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const = 0;
 
 	virtual bool stop_before_this(const InkStoryState& story_state) const { return false; }
 
 	virtual ExpressionsVec get_all_expressions() { return {}; }
+
+	// shifts every uuid this object (and any knots it contains) was compiled with, used when linking in separately compiled content
+	virtual void offset_uuids(UuidValue amount) {}
+
+	// adds every name this object (and any knots it contains) could refer to, used to find which knots can be reached
+	virtual void collect_referenced_names(std::unordered_set<std::string>& names) const {}
+
+	// the anonymous knots this object runs (choice results, conditional branches, sequence items), for passes over the whole story
+	virtual std::vector<Knot*> get_nested_knots() { return {}; }
+
+	// for objects that remember something between visits (like where a sequence is up to), a stable hash of what they remember,
+	// which is kept in the story's object_states
+	virtual bool has_runtime_state() const { return false; }
+	virtual std::uint64_t runtime_state_hash(const InkStoryState& story_state) const { return 0; }
+	// where the object comes among the story's stateful objects, which is where its state is kept, and makes two of them remembering
+	// the same thing still hash differently
+	virtual void set_state_ordinal(std::uint32_t ordinal) {}
+	virtual void reset_runtime_state(InkStoryState& story_state) const {}
 	
 	ByteVec get_serialized_bytes() const;
 
 	static InkObject* create_from_id(ObjectId id);
 
 protected:
-	ExpressionParserV2::ExecuteResult prepare_next_function_call(struct ExpressionParserV2::ShuntedExpression& expression, InkStoryState& story_state, InkStoryEvalResult& eval_result,
-									ExpressionParserV2::StoryVariableInfo& story_variable_info);
+	ExpressionParserV2::ExecuteResult prepare_next_function_call(const struct ExpressionParserV2::ShuntedExpression& expression, InkStoryState& story_state, InkStoryEvalResult& eval_result,
+									ExpressionParserV2::StoryVariableInfo& story_variable_info) const;
 };
 
 template <>
@@ -19,6 +19,9 @@ struct InkChoiceEntry {
 
 	GatherPoint label;
 
+	// NOTE: this option's bit in the story's taken choices, handed out when the story is loaded
+	std::uint32_t ordinal = 0;
+
 	InkChoiceEntry() { result.is_choice_result = true; }
 	InkChoiceEntry(std::size_t index, bool sticky) : index(index), sticky(sticky) {
 		result.is_choice_result = true;
@@ -29,7 +32,7 @@ class InkObjectChoice : public InkObject {
 public:
 	struct ChoiceComponents {
 		std::string text;
-		InkChoiceEntry* entry;
+		const InkChoiceEntry* entry;
 		std::size_t index = 0;
 	};
 
@@ -42,10 +45,6 @@ public:
 private:
 	std::vector<InkChoiceEntry> choices;
 
-	std::unordered_map<Uuid, bool> conditions_fully_prepared;
-	std::unordered_set<InkObject*> text_objects_being_prepared;
-	std::unordered_map<InkObject*, std::string> text_objects_fully_prepared;
-
 public:
 	InkObjectChoice(const std::vector<InkChoiceEntry>& choices) : choices{choices} {}
 	virtual ~InkObjectChoice() override;
@@ -55,21 +54,30 @@ public:
 
 	virtual bool contributes_content_to_knot() const override { return true; }
 
-	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) override;
+	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const override;
 
 	virtual ByteVec to_bytes() const override;
 	virtual InkObject* populate_from_bytes(const ByteVec& bytes, std::size_t& index) override;
 
-	GetChoicesResult get_choices(InkStoryState& story_state, InkStoryEvalResult& eval_result);
+	GetChoicesResult get_choices(InkStoryState& story_state, InkStoryEvalResult& eval_result) const;
 	std::vector<GatherPoint*> get_choice_labels();
 	std::vector<Knot*> get_choice_result_knots();
+	void assign_ordinals(std::uint32_t& next_ordinal);
+
+	// writes what each option says, as written, to its ordinal's place in descriptions, prefixed with where it is
+	void describe_options(const std::string& location, std::vector<std::string>& descriptions) const;
+	std::vector<InkObject*> get_text_objects() const;
+	const std::vector<InkChoiceEntry>& get_entries() const { return choices; }
 
 	virtual bool stop_before_this(const InkStoryState& story_state) const override { return story_state.choice_divert_index.has_value(); }
 
 	virtual ExpressionsVec get_all_expressions() override;
+	virtual void offset_uuids(UuidValue amount) override;
+	virtual void collect_referenced_names(std::unordered_set<std::string>& names) const override;
+	virtual std::vector<Knot*> get_nested_knots() override;
 
 private:
-	bool try_cache_prepared_text(InkObject* object, InkStoryState& story_state, InkStoryEvalResult& story_eval_result, InkStoryEvalResult& choice_eval_result, GetChoicesResult* choices_result, bool result_mode);
+	bool try_cache_prepared_text(const InkObject* object, InkStoryState& story_state, InkStoryEvalResult& story_eval_result, InkStoryEvalResult& choice_eval_result, GetChoicesResult* choices_result, bool result_mode) const;
 };
 
 template <>
@@ -13,7 +13,7 @@ public:
 
 	virtual ObjectId get_id() const override { return ObjectId::ChoiceTextMix; }
 
-	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) override;
+	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const override;
 
 	virtual ByteVec to_bytes() const override;
 	virtual InkObject* populate_from_bytes(const ByteVec& bytes, std::size_t& index) override;
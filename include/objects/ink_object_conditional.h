@@ -16,8 +16,6 @@ private:
 
 	ExpressionParserV2::ShuntedExpression switch_expression;
 
-	std::unordered_set<Uuid> conditions_fully_prepared;
-
 public:
 	InkObjectConditional(const std::vector<std::pair<struct ExpressionParserV2::ShuntedExpression, Knot>>& branches, const Knot& objects_else)
 		: branches{branches}, branch_else{objects_else}, is_switch{false} {}
@@ -29,11 +27,14 @@ public:
 
 	virtual ObjectId get_id() const override { return ObjectId::Conditional; }
 
-	virtual void execute(InkStoryState& stopstory_state, InkStoryEvalResult& eval_result) override;
+	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const override;
 
 	virtual bool contributes_content_to_knot() const override;
 
 	virtual ExpressionsVec get_all_expressions() override;
+	virtual void offset_uuids(UuidValue amount) override;
+	virtual void collect_referenced_names(std::unordered_set<std::string>& names) const override;
+	virtual std::vector<Knot*> get_nested_knots() override;
 
 	virtual ByteVec to_bytes() const override;
 	InkObject* populate_from_bytes(const ByteVec& bytes, std::size_t& index);
@@ -23,9 +23,16 @@ public:
 	virtual InkObject* populate_from_bytes(const ByteVec& bytes, std::size_t& index) override;
 	virtual bool has_any_contents(bool strip) const override { return !target_knot.tokens.empty() || type == DivertType::FromTunnel; }
 
-	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) override;
+	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const override;
 
-	std::string get_target(InkStoryState& story_state, const ExpressionParserV2::StoryVariableInfo& story_var_info);
+	std::string get_target(InkStoryState& story_state, const ExpressionParserV2::StoryVariableInfo& story_var_info) const;
+
+	DivertType get_type() const { return type; }
+	const ExpressionParserV2::ShuntedExpression& get_target_expression() const { return target_knot; }
+	const std::vector<ExpressionParserV2::ShuntedExpression>& get_arguments() const { return arguments; }
 
 	virtual std::string to_string() const override;
+
+	virtual void offset_uuids(UuidValue amount) override;
+	virtual void collect_referenced_names(std::unordered_set<std::string>& names) const override;
 };
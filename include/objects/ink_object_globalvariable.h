@@ -20,5 +20,10 @@ public:
 	virtual ByteVec to_bytes() const override;
 	virtual InkObject* populate_from_bytes(const ByteVec& bytes, std::size_t& index) override;
 
-	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) override;
+	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const override;
+
+	const ExpressionParserV2::ShuntedExpression& get_value_expression() const { return value_shunted_tokens; }
+
+	virtual void offset_uuids(UuidValue amount) override { value_shunted_tokens.uuid.offset(amount); }
+	virtual void collect_referenced_names(std::unordered_set<std::string>& names) const override { value_shunted_tokens.collect_referenced_names(names); }
 };
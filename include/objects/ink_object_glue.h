@@ -12,5 +12,5 @@ public:
 	virtual ObjectId get_id() const override { return ObjectId::Glue; }
 	virtual std::string to_string() const override { return "Glue"; }
 
-	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) override;
+	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const override;
 };
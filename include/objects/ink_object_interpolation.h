@@ -17,12 +17,14 @@ public:
 
 	virtual bool contributes_content_to_knot() const override { return true; }
 
-	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) override;
+	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const override;
 
 	virtual ByteVec to_bytes() const override;
 	virtual InkObject* populate_from_bytes(const ByteVec& bytes, std::size_t& index) override;
 
-	virtual bool stop_before_this(const InkStoryState& story_state) const override { return what_to_interpolate.stack_empty() || what_to_interpolate.preparation_stack.back().function_eval_index == SIZE_MAX; }
+	virtual bool stop_before_this(const InkStoryState& story_state) const override { return !story_state.is_preparing(what_to_interpolate); }
 
 	virtual ExpressionsVec get_all_expressions() { return {&what_to_interpolate}; }
+	virtual void offset_uuids(UuidValue amount) override { what_to_interpolate.uuid.offset(amount); }
+	virtual void collect_referenced_names(std::unordered_set<std::string>& names) const override { what_to_interpolate.collect_referenced_names(names); }
 };
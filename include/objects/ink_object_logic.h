@@ -20,7 +20,9 @@ public:
 	virtual ByteVec to_bytes() const override;
 	virtual InkObject* populate_from_bytes(const ByteVec& bytes, std::size_t& index) override;
 
-	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) override;
+	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const override;
 
 	virtual ExpressionsVec get_all_expressions() override { return {&contents_shunted_tokens}; }
+	virtual void offset_uuids(UuidValue amount) override { contents_shunted_tokens.uuid.offset(amount); }
+	virtual void collect_referenced_names(std::unordered_set<std::string>& names) const override { contents_shunted_tokens.collect_referenced_names(names); }
 };
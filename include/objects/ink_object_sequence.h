@@ -18,22 +18,17 @@ private:
 	InkSequenceType sequence_type;
 	bool multiline;
 	std::vector<Knot> items;
-	std::size_t current_index;
-	std::vector<std::size_t> available_shuffle_indices;
-
-	void fill_shuffle_indices();
+	std::uint32_t state_ordinal = 0;
 
 public:
 	InkObjectSequence(InkSequenceType type, bool multiline, const std::vector<Knot>& items)
-		: sequence_type{type}, multiline{multiline}, items{items}, current_index{0}, available_shuffle_indices{} {
-			fill_shuffle_indices();
-		}
+		: sequence_type{type}, multiline{multiline}, items{items} {}
 
 	virtual ~InkObjectSequence() override;
 
 	virtual ObjectId get_id() const override { return ObjectId::Sequence; }
 
-	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) override;
+	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const override;
 
 	virtual bool contributes_content_to_knot() const override;
 
@@ -41,4 +36,13 @@ public:
 	virtual InkObject* populate_from_bytes(const ByteVec& bytes, std::size_t& index) override;
 
 	virtual bool stop_before_this(const InkStoryState& story_state) const override { return multiline; }
+
+	virtual void offset_uuids(UuidValue amount) override;
+	virtual void collect_referenced_names(std::unordered_set<std::string>& names) const override;
+	virtual std::vector<Knot*> get_nested_knots() override;
+
+	virtual bool has_runtime_state() const override { return true; }
+	virtual std::uint64_t runtime_state_hash(const InkStoryState& story_state) const override;
+	virtual void set_state_ordinal(std::uint32_t ordinal) override { state_ordinal = ordinal; }
+	virtual void reset_runtime_state(InkStoryState& story_state) const override;
 };
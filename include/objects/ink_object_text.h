@@ -9,6 +9,9 @@ class InkObjectText : public InkObject {
 private:
 	std::string text_contents;
 
+	// NOTE: set when a line break directly after this text has been folded into it
+	bool ends_with_line_break = false;
+
 public:
 	InkObjectText() : text_contents{std::string()} {}
 	InkObjectText(const std::string& text) : text_contents{text} {}
@@ -20,12 +23,14 @@ public:
 	virtual std::string to_string() const override { return text_contents; }
 	virtual bool has_any_contents(bool strip) const override;
 	virtual bool contributes_content_to_knot() const override { return true; }
+	virtual bool ends_line() const override { return ends_with_line_break; }
 
-	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) override;
+	virtual void execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const override;
 
-	virtual bool stop_before_this(const InkStoryState& story_state) const override { return !strip_string_edges(text_contents, true, true, true).empty(); }
+	virtual bool stop_before_this(const InkStoryState& story_state) const override { return has_visible_characters(text_contents); }
 
 	void append_text(const std::string& text);
 	const std::string& get_text_contents() const { return text_contents; }
 	void set_text_contents(std::string&& new_contents) { text_contents = new_contents; }
+	void set_ends_line(bool ends_line) { ends_with_line_break = ends_line; }
 };
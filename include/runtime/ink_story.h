@@ -12,13 +12,56 @@
 #include <unordered_map>
 #include <vector>
 #include <string_view>
+#include <span>
 #include <functional>
+#include <memory>
+#include <atomic>
+#include <optional>
+
+// the story's global variables as they were at the end of one continue_story, which never changes once it's been published
+struct VariableSnapshot {
+	// counts up by one for each snapshot a story publishes
+	std::uint64_t epoch = 0;
+	std::uint64_t variables_hash = 0;
+	std::unordered_map<std::string, ExpressionParserV2::Variant> variables;
+
+	std::optional<ExpressionParserV2::Variant> get_variable(const std::string& name) const {
+		if (auto value = variables.find(name); value != variables.end()) {
+			return value->second;
+		}
+
+		return std::nullopt;
+	}
+};
+
+// limits a host can put on one story, so that one which runs away fails with an error rather than taking the whole process down with it
+// NOTE: 0 means no limit
+struct StoryBudget {
+	// what StoryMemoryUsage::total() may grow to
+	std::size_t max_bytes = 0;
+	// how many knot, function, tunnel and thread frames deep the story may get
+	std::size_t max_stack_depth = 0;
+};
 
 class InkStory {
 private:
-	InkStoryData* story_data;
+	// NOTE: only ever read once the story has started, so stories loaded from the same data can share it
+	std::shared_ptr<InkStoryData> story_data;
 	InkStoryState story_state;
 
+	std::string line_buffer;
+
+	// what the story is stopped on partway through a line, and the line so far, which carries on once the value has been resolved
+	std::shared_ptr<ExpressionParserV2::PendingValue> awaited_value;
+	InkStoryEvalResult suspended_line;
+
+	StoryBudget budget;
+	std::size_t steps_until_memory_check = 0;
+
+	bool publish_variable_snapshots = false;
+	std::uint64_t snapshot_epoch = 0;
+	std::atomic<std::shared_ptr<const VariableSnapshot>> variable_snapshot;
+
 	friend class InkCompiler;
 
 private:
@@ -27,33 +70,39 @@ private:
 
 	void try_remove_upper_knots(const GetContentResult& target);
 	void apply_knot_args(const InkWeaveContent* target, InkStoryEvalResult& eval_result);
-	void update_visit_count_variables(std::vector<ExpressionParserV2::ShuntedExpression*>&& expressions);
+	void update_visit_count_variables(std::span<ExpressionParserV2::ShuntedExpression* const> expressions);
+	void publish_variable_snapshot();
+	void check_budget(const InkStoryEvalResult& eval_result);
+	std::uint64_t combine_state_hash(std::uint64_t variables_hash, std::uint64_t visits_hash, std::uint64_t turns_hash, std::uint64_t choices_taken_hash, std::uint64_t objects_hash) const;
 
 public:
 	explicit InkStory() : story_data{nullptr} {}
 	explicit InkStory(InkStoryData* data) : story_data{data} { init_story(); }
-	explicit InkStory(const std::string& inkb_file);
-	~InkStory() { delete story_data; }
+	explicit InkStory(std::shared_ptr<InkStoryData> data) : story_data{std::move(data)} { init_story(); }
+	explicit InkStory(const std::string& inkb_file, std::size_t load_threads = 0);
+	explicit InkStory(const std::vector<std::uint8_t>& inkb_bytes, std::size_t load_threads = 0);
 
 	InkStory(const InkStory& from) = delete;
 	InkStory& operator=(const InkStory& other) = delete;
 
-	InkStory(InkStory&& from) : story_data{from.story_data} {
-		from.story_data = nullptr;
+	InkStory(InkStory&& from) : story_data{std::move(from.story_data)} {
 		init_story();
 	}
 
 	InkStory& operator=(InkStory&& other) {
 		if (this != &other) {
-			story_data = other.story_data;
-			other.story_data = nullptr;
+			story_data = std::move(other.story_data);
 			init_story();
 		}
 
 		return *this;
 	}
 
-	InkStoryData* get_story_data() const { return story_data; }
+	// loads a compiled story's data without starting a story on it, for hosts that run many stories from one copy of it
+	static std::shared_ptr<InkStoryData> load_story_data(const std::vector<std::uint8_t>& inkb_bytes, std::size_t load_threads = 0);
+
+	InkStoryData* get_story_data() const { return story_data.get(); }
+	const std::shared_ptr<InkStoryData>& get_shared_story_data() const { return story_data; }
 	const InkStoryState& get_story_state() const { return story_state; }
 	void print_info() const;
 
@@ -61,11 +110,54 @@ public:
 	std::string continue_story();
 	std::string continue_story_maximally();
 
+	// binds a function to one of the story's EXTERNAL declarations
+	void bind_external_function(const std::string& name, ExpressionParserV2::InkFunction function);
+	// binds a function that can hand back a PendingValue instead of its value; the story stops where it's called, and continue_story
+	// returns nothing and can_continue() is false, until the value has been resolved, after which the line carries on where it stopped
+	// NOTE: expressions are evaluated again from the start when they carry on, the same as after calling a knot function from one
+	void bind_async_external_function(const std::string& name, ExpressionParserV2::ExternalFunction function);
+
+	// whether the story is stopped on an external function's value that hasn't been resolved yet
+	bool is_waiting() const { return awaited_value && !awaited_value->is_resolved(); }
+	// the value the story is stopped on, if it is
+	const std::shared_ptr<ExpressionParserV2::PendingValue>& get_awaited_value() const { return awaited_value; }
+
 	std::vector<std::string> get_current_choices() const;
 	const std::vector<std::string>& get_current_tags() const;
 
 	void choose_choice_index(std::size_t index);
 
+	// puts the story back how it was when it was loaded, keeping bound external functions and variable observers and watchers, so a session can
+	// play through again without loading the program again; the random numbers are left to be seeded again too
+	void reset();
+
+	// a new story on the same data that carries on from just where this one is, bound functions, observers and watchers included; the two go
+	// their own ways from then on, so a playthrough can branch without replaying it from the start
+	// NOTE: a story waiting on an external function's value can't be forked until the value has arrived
+	std::unique_ptr<InkStory> fork() const;
+
+	// a story that goes over its budget throws from continue_story, and should be reset() before it's used again
+	void set_budget(const StoryBudget& new_budget) { budget = new_budget; }
+	const StoryBudget& get_budget() const { return budget; }
+	// what the story's state holds on to right now, including the line it's partway through
+	StoryMemoryUsage get_memory_usage() const;
+
+	// the same as calling SEED_RANDOM from ink, for hosts that need shuffles and RANDOM() to be repeatable; sessions given the same seed
+	// on different streams draw numbers that don't overlap, for forks of one playthrough that should carry on differently
+	void seed_random(std::uint32_t seed, std::uint64_t stream = 0) { story_state.seed_random(seed, stream); }
+
+	// a fingerprint of everything that decides how the story carries on from here: where it is, variables, the visit and turn counts it reads, choices taken,
+	// sequence positions and where the random numbers are up to; the same for the same state of the same program on any machine
+	// NOTE: everything but the stacks is kept up to date as the story runs, so this only costs as much as the story is deep
+	std::uint64_t state_hash() const;
+	// the same as state_hash(), but worked out from scratch, for checking the one kept up to date
+	std::uint64_t recompute_state_hash() const;
+	// like state_hash(), but only of what can still change how the story plays out: visit counts, turn counts, choices taken and sequences
+	// that nothing the story can still get to looks at are left out, and counts past the highest number they're compared with all hash the
+	// same, so two playthroughs that can only carry on alike hash the same even when state_hash() tells them apart
+	// NOTE: works out where the story can still get to every time, so it costs about as much as the story is big
+	std::uint64_t behaviour_hash() const;
+
 	std::optional<ExpressionParserV2::Variant> get_variable(const std::string& name) const;
 	void set_variable(const std::string& name, ExpressionParserV2::Variant&& value);
 
@@ -74,5 +166,18 @@ public:
 	void unobserve_variable(ExpressionParserV2::VariableObserverFunc observer);
 	void unobserve_variable(const std::string& variable_name, ExpressionParserV2::VariableObserverFunc observer);
 
+	// unlike observers, which are called on every write, a variable's watchers hear about it once at the end of the continue_story call
+	// it changed in, with the value it had before and the one it has now, and not at all if it ended up back where it started
+	// NOTE: nothing is recorded for variables that aren't watched
+	void watch_variable_changes(const std::string& variable_name, ExpressionParserV2::VariableChangeObserver observer);
+	void unwatch_variable_changes(const std::string& variable_name);
+
+	// once enabled, a snapshot of the global variables is published at the end of every continue_story that changed any, which other threads
+	// can read from while the story carries on, without locking anything the story uses
+	// NOTE: list values still refer to the story's list definitions, which stay the same for as long as the story is loaded
+	void set_variable_snapshots(bool enabled);
+	// safe to call from any thread; empty if snapshots aren't enabled
+	std::shared_ptr<const VariableSnapshot> get_variable_snapshot() const { return variable_snapshot.load(std::memory_order_acquire); }
+
 	const std::unordered_map<Uuid, InkListDefinition>& get_list_definitions() const { return story_state.variable_info.defined_lists.defined_lists; }
 };
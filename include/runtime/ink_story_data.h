@@ -7,17 +7,20 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
 
 struct GetContentResult {
 	WeaveContentType result_type = WeaveContentType::Knot;
-	Knot* knot = nullptr;
-	Stitch* stitch = nullptr;
-	GatherPoint* gather_point = nullptr;
+	const Knot* knot = nullptr;
+	const Stitch* stitch = nullptr;
+	const GatherPoint* gather_point = nullptr;
 	bool found_any = false;
 	bool is_choice_label = false;
 	ChoiceLabelData choice_label;
 
-	InkWeaveContent* get_target() {
+	const InkWeaveContent* get_target() const {
 		switch (result_type) {
 			case WeaveContentType::Knot:
 				return knot;
@@ -32,20 +35,56 @@ struct GetContentResult {
 
 class InkStoryData {
 private:
+	// NOTE: the memory the story's objects were created in, released all at once after they've been destroyed; declared first so it outlives everything pointing into it
+	std::vector<std::unique_ptr<InkObjectArena>> object_arenas;
+
 	std::unordered_map<std::string, Knot> knots;
 	std::vector<std::string> knot_order;
 	ExpressionParserV2::StoryVariableInfo variable_info;
 
+	// every object that remembers something between visits, in the order assign_knot_ordinals found them
+	std::vector<InkObject*> stateful_objects;
+
+	// whose visit counts and turn counts the story reads, filled in by assign_knot_ordinals
+	StoryReads reads;
+
+	// how every knot leads to the others, and what each one reads, filled in by link_knots
+	StoryLinks links;
+
+	std::once_flag prepared;
+	std::uint32_t choice_count = 0;
+
 	friend class InkStory;
 	friend class InkCompiler;
 
 public:
 	InkStoryData(const std::vector<Knot>& story_knots, ExpressionParserV2::StoryVariableInfo&& variable_info);
+	InkStoryData(std::vector<Knot>&& story_knots, ExpressionParserV2::StoryVariableInfo&& variable_info);
 	~InkStoryData();
 
 	std::vector<std::uint8_t> get_serialized_bytes() const;
 
 	void print_info() const;
 
-	GetContentResult get_content(const std::string& path, Knot* topmost_knot, std::vector<KnotStatus>& knots_stack, Stitch* current_stitch, bool update_stack);
+	// works out everything the runtime looks up as it goes (each knot's side tables, and the choice and knot ordinals) the first time
+	// a story is started on this data; after that the data is only ever read, so any number of stories can share it
+	// NOTE: safe to call from several threads at once
+	void prepare();
+
+	// removes every knot and function that can't be reached from the start of the story or one of the given entry points, and returns their names
+	std::vector<std::string> remove_unreachable_knots(const std::vector<std::string>& entry_points);
+
+	// numbers every choice option in the story densely, in knot order, and returns how many there are
+	std::uint32_t assign_choice_ordinals();
+
+	// numbers every knot in the story the same way, nested ones included, collecting stateful_objects and reads along the way; returns how many there are
+	std::uint32_t assign_knot_ordinals();
+
+	// works out links from the knots as they've been numbered; knot_count is what assign_knot_ordinals returned
+	void link_knots(std::uint32_t knot_count);
+
+	// what every choice option in the story says and which knot it's in, indexed by ordinal, for tools that report on coverage
+	std::vector<std::string> describe_choices() const;
+
+	GetContentResult get_content(const std::string& path, const Knot* topmost_knot, KnotStatusStack& knots_stack, const Stitch* current_stitch, bool update_stack) const;
 };
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "runtime/ink_story.h"
+#include "serialization.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <functional>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <exception>
+#include <cstdint>
+
+// runs many story sessions on a pool of worker threads; requests to one session run one at a time and in the order they were made,
+// while different sessions run in parallel, with idle workers stealing sessions queued on busy ones
+class StoryHost {
+public:
+	using ProgramId = std::size_t;
+	using Request = std::move_only_function<void(InkStory&)>;
+
+	class Session {
+	private:
+		std::unique_ptr<InkStory> story;
+
+		// NOTE: only ever held for a moment by whoever is queueing or taking a request for this session, never while one runs
+		std::mutex mutex;
+		std::condition_variable idle;
+		std::deque<Request> pending;
+		bool scheduled = false;
+
+		// the first exception thrown out of a request made with post(), which would otherwise take its worker down with it
+		std::exception_ptr error;
+
+		friend class StoryHost;
+
+	public:
+		explicit Session(std::unique_ptr<InkStory>&& story) : story{std::move(story)} {}
+
+		// hands back, and clears, the first exception a posted request let escape since the last call
+		std::exception_ptr take_error();
+	};
+
+private:
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<Session*> sessions;
+	};
+
+	// loaded once and shared read-only by every session of the program; everything a session changes lives in its own story state
+	std::vector<std::shared_ptr<InkStoryData>> programs;
+	std::mutex programs_mutex;
+
+	std::list<Session> sessions;
+	std::mutex sessions_mutex;
+
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+	std::vector<std::jthread> workers;
+	std::atomic<std::size_t> queued_sessions = 0;
+	std::atomic<std::size_t> waiting_sessions = 0;
+	std::atomic<std::size_t> next_queue = 0;
+	std::atomic<bool> stopping = false;
+
+	void schedule(Session& session);
+	Session* take_session(std::size_t worker_index);
+	void run_session(Session& session);
+	void worker_loop(std::size_t worker_index);
+
+public:
+	// 0 threads means one per hardware thread
+	explicit StoryHost(std::size_t threads = 0);
+	~StoryHost();
+
+	StoryHost(const StoryHost& from) = delete;
+	StoryHost& operator=(const StoryHost& other) = delete;
+
+	ProgramId add_program(ByteVec&& inkb_bytes);
+	ProgramId add_program_file(const std::string& inkb_file);
+
+	// a seed makes the session's shuffles and RANDOM() repeatable, and a budget stops a runaway session before it takes everyone else's memory
+	Session& create_session(ProgramId program, std::optional<std::uint32_t> seed = std::nullopt, const StoryBudget& budget = {});
+
+	// waits for any requests already made to the session to finish first
+	void destroy_session(Session& session);
+
+	// queues a request without waiting on it; the request may post more requests to its own session
+	// an exception thrown out of the request is kept on the session (see Session::take_error) and the session carries on with its next request
+	// a request that leaves the story waiting on an external function's value gives up its worker, and is run again, before anything else
+	// queued for the session, by whichever worker is free once the value has been resolved
+	void post(Session& session, Request&& request);
+
+	template <typename F>
+	std::future<std::invoke_result_t<F, InkStory&>> submit(Session& session, F&& request) {
+		using Result = std::invoke_result_t<F, InkStory&>;
+		std::promise<Result> promise;
+		std::future<Result> result = promise.get_future();
+		post(session, [request = std::forward<F>(request), promise = std::move(promise)](InkStory& story) mutable {
+			// NOTE: a run that leaves the story waiting is run again once the value arrives, and only the run that gets through gives the result
+			try {
+				if constexpr (std::is_void_v<Result>) {
+					request(story);
+					if (!story.is_waiting()) {
+						promise.set_value();
+					}
+				} else {
+					Result value = request(story);
+					if (!story.is_waiting()) {
+						promise.set_value(std::move(value));
+					}
+				}
+			} catch (...) {
+				promise.set_exception(std::current_exception());
+			}
+		});
+
+		return result;
+	}
+
+	std::future<std::string> continue_story(Session& session);
+	std::future<void> choose_choice_index(Session& session, std::size_t index);
+
+	std::size_t get_thread_count() const { return workers.size(); }
+};
+
+// advances many stories by one step together, for bulk simulation: a story waiting on a choice first takes choices[i], then every story
+// that can continue produces its next line (left empty for stories that couldn't); stories stopped at the same point in the same
+// program are stepped one after another, and the batch is split across up to `threads` threads (0 means one per hardware thread)
+// NOTE: stories only line up with each other if they share their story data (see InkStory::load_story_data), and none of them may be
+// used by anything else until this returns
+std::vector<std::string> advance_batch(std::span<InkStory* const> stories, std::span<const std::size_t> choices, std::size_t threads = 0);
@@ -7,14 +7,30 @@
 #include <cstdint>
 #include <random>
 #include <optional>
+#include <memory>
 
 #include "runtime/ink_story_structs.h"
 #include "runtime/ink_story_tracking.h"
 
 #include "types/ink_list.h"
+#include "ink_utils.h"
 
 #include "expression_parser/expression_parser.h"
 
+// roughly how many bytes a story's state holds on to, by what it's used for; it counts what containers store, plus a little for each node
+struct StoryMemoryUsage {
+	// knot frames, function calls, threads, tunnels and the argument scopes that go with them
+	std::size_t stacks = 0;
+	// global variables, arguments and visit counts, apart from the strings and lists in them
+	std::size_t variables = 0;
+	// string values, the line being built, choices and tags
+	std::size_t strings = 0;
+	// list values
+	std::size_t lists = 0;
+
+	std::size_t total() const { return stacks + variables + strings + lists; }
+};
+
 struct InkStoryState {
 	enum class ChoiceMixPosition {
 		Before,
@@ -34,10 +50,10 @@ struct InkStoryState {
 
 	struct ThreadChoiceEntry {
 		std::string choice_text;
-		struct InkChoiceEntry* choice_entry = nullptr;
+		const struct InkChoiceEntry* choice_entry = nullptr;
 		std::size_t choice_index = 0;
-		Knot* containing_knot = nullptr;
-		Stitch* containing_stitch = nullptr;
+		const Knot* containing_knot = nullptr;
+		const Stitch* containing_stitch = nullptr;
 		std::size_t index_in_knot = 0;
 		std::vector<std::pair<std::string, ExpressionParserV2::Variant>> arguments;
 
@@ -46,9 +62,13 @@ struct InkStoryState {
 		bool applied = false;
 	};
 
-	std::mt19937 rng{std::random_device()()};
+	// NOTE: the seed, stream and how many numbers have been drawn since pin down where the generator is, without having to look at its state
+	std::uint32_t rng_seed = std::random_device()();
+	std::uint64_t rng_stream = 0;
+	std::uint64_t rng_draws = 0;
+	Pcg32 rng{rng_seed};
 
-	std::vector<KnotStatus> current_knots_stack;
+	KnotStatusStack current_knots_stack;
 
 	bool should_end_story = false;
 
@@ -60,20 +80,48 @@ struct InkStoryState {
 	};
 
 	std::vector<StoryChoice> current_choices;
-	std::vector<struct InkChoiceEntry*> current_choice_structs;
+	std::vector<const struct InkChoiceEntry*> current_choice_structs;
 	std::optional<std::size_t> selected_choice = std::nullopt;
 	ChoiceMixPosition choice_mix_position = ChoiceMixPosition::Before;
-	std::unordered_map<Knot*, std::unordered_map<class InkObject*, std::unordered_set<std::size_t>>> choices_taken;
+	std::vector<std::uint64_t> choices_taken;
 	std::size_t total_choices_taken = 0;
 
-	std::vector<Knot*> function_call_stack;
+	// NOTE: kept up to date as choices are taken and objects change, so InkStory::state_hash() doesn't have to go over everything again
+	std::uint64_t choices_taken_hash = 0;
+	std::uint64_t objects_hash = 0;
+
+	// what each object that remembers something between visits has remembered, by its state ordinal; only sequences do, so it's
+	// where each one is up to and, for shuffles, which items it hasn't picked yet
+	struct ObjectState {
+		std::size_t current_index = 0;
+		std::vector<std::size_t> available_indices;
+	};
+
+	std::vector<ObjectState> object_states;
+
+	// what a choice or conditional had already worked out before it stopped to call a knot function, so it isn't worked out again
+	// when it carries on; dropped once it's run from the start again
+	struct ObjectPreparation {
+		std::unordered_map<Uuid, bool> conditions;
+		std::unordered_set<const class InkObject*> text_being_prepared;
+		std::unordered_map<const class InkObject*, std::string> prepared_text;
+	};
+
+	std::unordered_map<const class InkObject*, ObjectPreparation> object_preparations;
+
+	// expressions that stopped partway to call a knot function or wait on an external one, with the innermost call last
+	std::unordered_map<const ExpressionParserV2::ShuntedExpression*, std::vector<ExpressionParserV2::ShuntedExpression::StackEntry>> expression_preparations;
+
+	std::vector<const Knot*> function_call_stack;
 
 	//std::size_t current_thread_depth = 0;
-	std::vector<Knot*> threads_stack;
+	std::vector<const Knot*> threads_stack;
 	std::vector<ThreadChoiceEntry> current_thread_entries;
 	std::vector<KnotStatus> thread_tunnels_stack;
 	bool thread_entries_applied = false;
 	std::vector<std::vector<std::pair<std::string, ExpressionParserV2::Variant>>> thread_arguments_stack;
+	// how deep the argument and redirect scopes were when each running thread started, so it can drop the ones it added when it wraps up
+	std::vector<std::pair<std::size_t, std::size_t>> thread_scope_depths;
 	bool should_wrap_up_thread = false;
 
 	InkStoryTracking story_tracking;
@@ -88,8 +136,10 @@ struct InkStoryState {
 	ExpressionParserV2::StoryVariableInfo variable_info;
 
 	class InkObject* get_current_object(std::int64_t index_offset);
-	bool has_choice_been_taken(class InkObject* choice_object, std::size_t index);
-	void add_choice_taken(class InkObject* choice_object, std::size_t index);
+	void seed_random(std::uint32_t seed, std::uint64_t stream = 0);
+	std::int64_t random_range(std::int64_t from, std::int64_t to);
+	bool has_choice_been_taken(std::uint32_t ordinal) const;
+	void add_choice_taken(std::uint32_t ordinal);
 	inline std::size_t index_in_knot() const { return current_knots_stack.back().index; }
 	inline KnotStatus& current_knot() { return current_knots_stack.back(); }
 	KnotStatus& previous_nonfunction_knot(bool offset_by_one = false);
@@ -97,11 +147,19 @@ struct InkStoryState {
 	KnotStatus& current_nonchoice_knot();
 	void update_weave_uuid();
 	void setup_next_stitch();
-	Stitch* current_stitch() { return current_nonchoice_knot().current_stitch; }
-	Stitch* next_stitch() { return current_nonchoice_knot().next_stitch; }
+	const Stitch* current_stitch() { return current_nonchoice_knot().current_stitch; }
+	const Stitch* next_stitch() { return current_nonchoice_knot().next_stitch; }
+
+	// whether the expression stopped partway and is waiting to be picked up again
+	bool is_preparing(const ExpressionParserV2::ShuntedExpression& expression) const {
+		return !expression_preparations.empty() && expression_preparations.contains(&expression);
+	}
 
 	void apply_thread_choices();
 	std::size_t current_thread_depth() const { return threads_stack.size(); }
+
+	// NOTE: goes over every variable, so it costs about as much as the story has of them
+	StoryMemoryUsage memory_usage() const;
 };
 
 struct InkStoryEvalResult {
@@ -119,5 +177,8 @@ struct InkStoryEvalResult {
 	bool reached_function_return = false;
 	std::optional<ExpressionParserV2::Variant> return_value;
 
+	// set when an object stopped on an external function's value that isn't there yet
+	std::shared_ptr<ExpressionParserV2::PendingValue> awaited_value;
+
 	bool has_any_contents(bool strip);
 };
@@ -2,11 +2,19 @@
 
 #include <string>
 #include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <initializer_list>
 #include <cstdint>
 
+#include "ink_enums.h"
 #include "serialization.h"
 #include "uuid.h"
 
+namespace ExpressionParserV2 {
+	struct ShuntedExpression;
+}
+
 enum class WeaveContentType {
 	Knot,
 	Stitch,
@@ -62,35 +70,164 @@ struct Stitch : public InkWeaveContent {
 	std::vector<GatherPoint> gather_points;
 };
 
+// what the runtime asks of each of a knot's objects on every step, worked out once when the story is loaded
+struct KnotStep {
+	bool ends_line = false;
+	// NOTE: text only stops a line when it has visible contents, which never changes; anything else is asked at runtime
+	bool is_text = false;
+	bool stops_line = false;
+
+	// this step's expressions, as a range of the knot's step_expressions
+	std::uint32_t expressions_begin = 0;
+	std::uint32_t expressions_end = 0;
+};
+
+// what a story can find out about the route it took, collected by InkStoryData::assign_knot_ordinals; the rest of what's counted
+// along the way can't change how the story carries on, so a hash of its state can leave it out
+// NOTE: only the last part of a path is kept, so a count is treated as read if anything with its name is
+struct StoryReads {
+	// everything whose visit count is read somewhere, and every divert target, which could end up in READ_COUNT through a variable
+	std::unordered_set<std::string> count_names;
+	// everything TURNS_SINCE is asked about by name
+	std::unordered_set<std::string> turns_since_names;
+	// whether TURNS_SINCE is ever handed a variable, which could hold any divert target
+	bool turns_since_any = false;
+	// whether TURNS() is called anywhere
+	bool turns = false;
+
+	bool reads_turns_since(const std::string& name) const { return turns_since_any ? count_names.contains(name) : turns_since_names.contains(name); }
+};
+
+// where a knot can go on to and what it looks at on the way, not counting the knots nested in it, which have their own
+struct KnotLinks {
+	// the knots it can always go on to: those nested in it, those it diverts, tunnels, threads or calls to, and the one it's nested in
+	std::vector<std::uint32_t> next;
+	// the results of its once-only options, as (choice ordinal, knot ordinal), which can only be gone on to until the option's been taken
+	std::vector<std::pair<std::uint32_t, std::uint32_t>> once_only_next;
+	// whether it diverts through a variable, which could be holding any divert target in the story
+	bool diverts_anywhere = false;
+
+	// the once-only options it offers, and the objects in it that remember something between visits
+	std::vector<std::uint32_t> once_only_choices;
+	std::vector<const class InkObject*> stateful_objects;
+	// the names whose visit counts and turn counts it reads, as indices into StoryLinks::count_limits and turns_limits
+	std::vector<std::uint32_t> count_reads;
+	std::vector<std::uint32_t> turns_reads;
+};
+
+// every knot's links, by knot ordinal, worked out by InkStoryData::link_knots so a hash of where a story could still go can leave
+// out anything nothing still reachable looks at
+// NOTE: like StoryReads, counts are named by the last part of their path
+struct StoryLinks {
+	std::vector<KnotLinks> knots;
+	// every knot a divert target held in a variable could send the story to
+	std::vector<std::uint32_t> divert_targets;
+
+	std::unordered_map<std::string, std::uint32_t> name_indices;
+	// for each name, the count it's never told apart from anything higher than, since it's only ever compared with smaller numbers;
+	// INT64_MAX when it's used some other way
+	std::vector<std::int64_t> count_limits;
+	std::vector<std::int64_t> turns_limits;
+};
+
 struct Knot : public InkWeaveContent {
 	std::vector<class InkObject*> objects;
+
+	// side tables built by build_steps, so stepping through the knot never has to scan or allocate
+	std::vector<KnotStep> steps;
+	std::vector<ExpressionParserV2::ShuntedExpression*> step_expressions;
+	std::vector<GatherPoint*> gather_at_index;
+	std::vector<GatherPoint*> weave_gather_points;
+
+	// names looked up while the story runs: stitches by name, and every label reachable in this knot (its gathers, its stitches'
+	// gathers, and choice labels however deeply nested in choice results) mapped to the indices of the choices it's found under
+	std::unordered_map<std::string, std::size_t> stitch_index;
+	std::unordered_map<std::string, std::vector<std::size_t>> label_index;
+
 	std::vector<Stitch> stitches;
 	std::vector<GatherPoint> gather_points;
 	bool is_function = false;
 	bool is_choice_result = false;
-	FunctionPrepType function_prep_type = FunctionPrepType::None;
 	bool has_content = false;
 
+	// NOTE: this knot's place in a walk over every knot in the story, nested ones included, handed out when the story is loaded;
+	// unlike a pointer or an anonymous knot's name, it's the same in every copy of the same program
+	std::uint32_t ordinal = 0;
+
 	Knot() : objects{}, stitches{}, gather_points{} {}
 	Knot(const std::vector<class InkObject*>& objects) : objects{objects}, stitches{}, gather_points{} {}
 
 	std::string divert_target_to_global(const std::string& target) const;
 	std::vector<GatherPoint*> get_all_gather_points();
+	const Stitch* find_stitch(const std::string& stitch_name) const;
 
 	void append_knot(const Knot& other);
+	void offset_uuids(UuidValue amount);
+	void collect_referenced_names(std::unordered_set<std::string>& names) const;
+	void assign_choice_ordinals(std::uint32_t& next_ordinal);
+	void assign_knot_ordinals(std::uint32_t& next_ordinal, std::vector<class InkObject*>& stateful_objects, StoryReads& reads);
+	void describe_choices(const std::string& location, std::vector<std::string>& descriptions) const;
+
+	// builds the side tables for this knot and every knot nested in it; the runtime relies on them, so it has to be redone if the objects change
+	void build_steps();
 };
 
+// NOTE: the knots a story points at belong to story data that other stories can be running too, so they're never changed from here
 struct KnotStatus {
-	Knot* knot;
+	const Knot* knot;
 	std::size_t index = 0;
 
-	Stitch* current_stitch = nullptr;
-	Stitch* next_stitch = nullptr;
+	const Stitch* current_stitch = nullptr;
+	const Stitch* next_stitch = nullptr;
 
 	bool returning_from_function = false;
 	Uuid current_function_prep_expression = UINT32_MAX;
 	bool any_new_content = false;
 	bool reached_newline = false;
+	// what a function call made from this frame is preparing, which decides whether its content is output or handed back
+	FunctionPrepType function_prep_type = FunctionPrepType::None;
+};
+
+// the knots being run, innermost last; alongside each frame it keeps the closest frame at or below it that's a named knot,
+// and that's a named knot that isn't a function, so the story never has to walk back down the stack to find them
+// NOTE: a frame's knot must only be changed through replace_back, or those answers go stale
+class KnotStatusStack {
+private:
+	std::vector<KnotStatus> frames;
+	std::vector<std::uint32_t> nearest_named;
+	std::vector<std::uint32_t> nearest_named_nonfunction;
+
+	void index_back();
+
+public:
+	static constexpr std::uint32_t npos = UINT32_MAX;
+
+	KnotStatusStack() = default;
+	KnotStatusStack(std::initializer_list<KnotStatus> initial_frames);
+
+	bool empty() const { return frames.empty(); }
+	std::size_t size() const { return frames.size(); }
+
+	KnotStatus& back() { return frames.back(); }
+	const KnotStatus& back() const { return frames.back(); }
+	KnotStatus& front() { return frames.front(); }
+	const KnotStatus& front() const { return frames.front(); }
+	KnotStatus& operator[](std::size_t index) { return frames[index]; }
+	const KnotStatus& operator[](std::size_t index) const { return frames[index]; }
+
+	std::vector<KnotStatus>::iterator begin() { return frames.begin(); }
+	std::vector<KnotStatus>::iterator end() { return frames.end(); }
+	std::vector<KnotStatus>::const_iterator begin() const { return frames.begin(); }
+	std::vector<KnotStatus>::const_iterator end() const { return frames.end(); }
+
+	void push_back(const KnotStatus& frame);
+	void pop_back();
+	void replace_back(const KnotStatus& frame);
+	void clear();
+
+	// the index of the closest frame at or below the given one, or npos if there isn't one
+	std::uint32_t named_at_or_below(std::size_t index) const { return nearest_named[index]; }
+	std::uint32_t named_nonfunction_at_or_below(std::size_t index) const { return nearest_named_nonfunction[index]; }
 };
 
 template <>
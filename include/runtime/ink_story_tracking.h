@@ -16,6 +16,10 @@ struct InkStoryTracking {
 		std::string name;
 		std::size_t times_visited = 0;
 		std::int64_t turns_since_visited = -1;
+		// whether anything in the story reads this visit count, and so whether it counts towards visits_hash
+		bool count_is_read = false;
+		// the same for turns_since_visited and turns_hash
+		bool turns_are_read = false;
 
 		SubKnotStats() : name{std::string()}, times_visited{0}, turns_since_visited{-1} {}
 		SubKnotStats(const std::string& name) : name{name}, times_visited{0}, turns_since_visited{-1} {}
@@ -34,7 +38,14 @@ struct InkStoryTracking {
 	std::unordered_map<Uuid, StitchStats> stitch_stats;
 	std::unordered_map<Uuid, SubKnotStats> gather_point_stats;
 
-	void increment_visit_count(Knot* knot, Stitch* stitch = nullptr, GatherPoint* gather_point = nullptr);
+	// the visit counts and turn counts that are read, each combined in a way that doesn't care about order and kept up to date as they change
+	std::uint64_t visits_hash = 0;
+	std::uint64_t turns_hash = 0;
+
+	void increment_visit_count(const Knot* knot, const Stitch* stitch = nullptr, const GatherPoint* gather_point = nullptr);
+	void rehash_visits();
+	static std::uint64_t visit_hash(Uuid uuid, std::size_t times_visited);
+	static std::uint64_t turns_hash_entry(Uuid uuid, std::int64_t turns_since_visited);
 	void increment_turns_since();
-	bool get_content_stats(InkWeaveContent* content, InkStoryTracking::SubKnotStats& result);
+	bool get_content_stats(const InkWeaveContent* content, InkStoryTracking::SubKnotStats& result);
 };
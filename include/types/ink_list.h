@@ -25,6 +25,7 @@ private:
 	Uuid uuid;
 
 	friend class InkList;
+	friend struct Serializer<InkListDefinition>;
 
 public:
 	InkListDefinition(const std::string& name, std::initializer_list<std::string> entries, Uuid uuid) : name(name), uuid(uuid) {
@@ -118,6 +119,9 @@ public:
 
 	void add_origin(Uuid origin) { all_origins.insert(origin); }
 
+	const InkListDefinitionMap* get_definition_map() const { return owning_definition_map; }
+	void set_definition_map(const InkListDefinitionMap* definition_map) { owning_definition_map = definition_map; }
+
 	InkList union_with(const InkList& other) const;
 	InkList intersect_with(const InkList& other) const;
 	InkList without(const InkList& other) const;
@@ -127,6 +131,8 @@ public:
 	std::int64_t value() const;
 
 	std::size_t count() const { return current_values.size(); }
+	// roughly how much memory the list holds on to beyond the object itself
+	std::size_t heap_bytes() const;
 	std::size_t size() const { return current_values.size(); }
 	bool empty() const { return current_values.empty(); }
 	InkListItem single_item() const;
@@ -201,3 +207,23 @@ template <>
 struct Deserializer<InkListDefinition::Entry> {
 	InkListDefinition::Entry operator()(const ByteVec& bytes, std::size_t& index);
 };
+
+template <>
+struct Serializer<InkListDefinition> {
+	ByteVec operator()(const InkListDefinition& definition);
+};
+
+template <>
+struct Deserializer<InkListDefinition> {
+	InkListDefinition operator()(const ByteVec& bytes, std::size_t& index);
+};
+
+template <>
+struct Serializer<InkListDefinitionMap> {
+	ByteVec operator()(const InkListDefinitionMap& definition_map);
+};
+
+template <>
+struct Deserializer<InkListDefinitionMap> {
+	InkListDefinitionMap operator()(const ByteVec& bytes, std::size_t& index);
+};
@@ -16,6 +16,13 @@ public:
 
 	UuidValue get() const { return uuid; }
 
+	// NOTE: 0 is left alone, since it's the default for content that was never assigned a uuid
+	void offset(UuidValue amount) {
+		if (uuid != 0) {
+			uuid += amount;
+		}
+	}
+
 	bool operator==(const Uuid& other) const {
 		return uuid == other.uuid;
 	}
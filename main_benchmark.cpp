@@ -0,0 +1,477 @@
+#include "runtime/ink_story.h"
+#include "runtime/ink_story_host.h"
+#include "ink_compiler.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+#include <format>
+#include <latch>
+#include <vector>
+#include <memory>
+
+#if __has_include(<print>)
+#include <print>
+using std::print;
+#else
+#include <format>
+#define print(fmt, ...) std::cout << std::format(fmt __VA_OPT__(,) __VA_ARGS__)
+#endif
+
+using BenchClock = std::chrono::steady_clock;
+
+namespace {
+	double elapsed_ms(BenchClock::time_point start) {
+		return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+	}
+
+	int benchmark_startup(const std::string& infile, std::size_t iterations) {
+		std::string inkb_file = (std::filesystem::temp_directory_path() / "ink_benchmark_startup.inkb").string();
+		{
+			InkCompiler compiler;
+			compiler.compile_file_to_file(infile, inkb_file);
+		}
+
+		BenchClock::time_point start = BenchClock::now();
+		for (std::size_t i = 0; i < iterations; ++i) {
+			InkCompiler compiler;
+			InkStory story = compiler.compile_file(infile);
+			story.continue_story();
+		}
+
+		double compile_time = elapsed_ms(start) / iterations;
+
+		start = BenchClock::now();
+		for (std::size_t i = 0; i < iterations; ++i) {
+			InkStory story{inkb_file};
+			story.continue_story();
+		}
+
+		double load_time = elapsed_ms(start) / iterations;
+
+		print("startup: {} ({} iterations, {} byte inkb)\n", infile, iterations, std::filesystem::file_size(inkb_file));
+		print("  compile from source: {:.3f} ms\n", compile_time);
+		print("  load from inkb:      {:.3f} ms\n", load_time);
+		print("  speedup:             {:.2f}x\n", compile_time / load_time);
+
+		std::filesystem::remove(inkb_file);
+		return 0;
+	}
+
+	int benchmark_load(const std::string& infile, std::size_t iterations) {
+		std::string inkb_file = infile;
+		if (!infile.ends_with(".inkb")) {
+			inkb_file = (std::filesystem::temp_directory_path() / "ink_benchmark_load.inkb").string();
+			InkCompiler compiler;
+			compiler.compile_file_to_file(infile, inkb_file);
+		}
+
+		std::size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+		print("load: {} ({} iterations, {} byte inkb)\n", infile, iterations, std::filesystem::file_size(inkb_file));
+
+		double single_thread_time = 0.0;
+		for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+			BenchClock::time_point start = BenchClock::now();
+			for (std::size_t i = 0; i < iterations; ++i) {
+				InkStory story{inkb_file, threads};
+			}
+
+			double load_time = elapsed_ms(start) / iterations;
+			if (threads == 1) {
+				single_thread_time = load_time;
+			}
+
+			print("  {:>3} threads: {:.3f} ms ({:.2f}x)\n", threads, load_time, single_thread_time / load_time);
+		}
+
+		if (inkb_file != infile) {
+			std::filesystem::remove(inkb_file);
+		}
+
+		return 0;
+	}
+
+	int benchmark_edit(const std::string& infile, std::size_t iterations) {
+		std::ifstream file{infile};
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		std::string script = buffer.str();
+
+		std::string cache_file = (std::filesystem::temp_directory_path() / "ink_benchmark_edit.inkc").string();
+		std::string inkb_file = (std::filesystem::temp_directory_path() / "ink_benchmark_edit.inkb").string();
+		std::filesystem::remove(cache_file);
+
+		// each iteration stands in for a writer changing one line at the end of the story's last knot
+		auto edited_script = [&script](std::size_t i) { return std::format("{}\nEdited line {}.\n", script, i); };
+
+		BenchClock::time_point start = BenchClock::now();
+		for (std::size_t i = 0; i < iterations; ++i) {
+			InkCompiler compiler;
+			compiler.compile_script_to_file(edited_script(i), inkb_file);
+		}
+
+		double full_time = elapsed_ms(start) / iterations;
+
+		InkCompiler cold_compiler;
+		cold_compiler.set_knot_cache_file(cache_file);
+		cold_compiler.compile_script_to_file(script, inkb_file);
+
+		std::size_t reused = 0;
+		std::size_t compiled = 0;
+		start = BenchClock::now();
+		for (std::size_t i = 0; i < iterations; ++i) {
+			InkCompiler compiler;
+			compiler.set_knot_cache_file(cache_file);
+			compiler.compile_script_to_file(edited_script(i), inkb_file);
+			reused = compiler.get_knot_cache().get_reused_count();
+			compiled = compiler.get_knot_cache().get_compiled_count();
+		}
+
+		double incremental_time = elapsed_ms(start) / iterations;
+
+		print("edit: {} ({} iterations)\n", infile, iterations);
+		print("  full compile:        {:.3f} ms\n", full_time);
+		print("  incremental compile: {:.3f} ms ({} knots reused, {} recompiled)\n", incremental_time, reused, compiled);
+		print("  speedup:             {:.2f}x\n", full_time / incremental_time);
+
+		std::filesystem::remove(cache_file);
+		std::filesystem::remove(inkb_file);
+		return 0;
+	}
+
+	struct PlaythroughResult {
+		double elapsed = 0.0;
+		std::size_t lines = 0;
+		std::string transcript;
+	};
+
+	// plays the story through with a fixed seed, always taking the first choice, so every run takes the same path
+	PlaythroughResult play_story(const std::string& inkb_file, std::size_t max_lines) {
+		InkStory story{inkb_file};
+		story.seed_random(12345);
+
+		PlaythroughResult result;
+		BenchClock::time_point start = BenchClock::now();
+		while (result.lines < max_lines) {
+			while (story.can_continue() && result.lines < max_lines) {
+				result.transcript += story.continue_story();
+				result.transcript += '\n';
+				++result.lines;
+			}
+
+			std::size_t choice_count = story.get_current_choices().size();
+			if (choice_count == 0 || result.lines >= max_lines) {
+				break;
+			}
+
+			story.choose_choice_index(0);
+		}
+
+		result.elapsed = elapsed_ms(start);
+		return result;
+	}
+
+	int benchmark_play(const std::string& infile, std::size_t iterations) {
+		std::string inkb_file = (std::filesystem::temp_directory_path() / "ink_benchmark_play.inkb").string();
+		{
+			InkCompiler compiler;
+			compiler.compile_file_to_file(infile, inkb_file);
+		}
+
+		constexpr std::size_t MaxLines = 2000;
+		double total_time = 0.0;
+		std::size_t lines = 0;
+		bool transcripts_match = true;
+		std::string first_transcript;
+		for (std::size_t i = 0; i < iterations; ++i) {
+			PlaythroughResult playthrough = play_story(inkb_file, MaxLines);
+			total_time += playthrough.elapsed;
+			lines += playthrough.lines;
+			if (i == 0) {
+				first_transcript = std::move(playthrough.transcript);
+			} else {
+				transcripts_match = transcripts_match && playthrough.transcript == first_transcript;
+			}
+		}
+
+		double lines_per_run = static_cast<double>(lines) / iterations;
+		print("play: {} ({} iterations, {:.0f} lines per playthrough)\n", infile, iterations, lines_per_run);
+		print("  {:.3f} us per line\n", total_time * 1000.0 / lines);
+		print("  transcripts {}\n", transcripts_match ? "match" : "DIFFER");
+
+		std::filesystem::remove(inkb_file);
+		return transcripts_match ? 0 : 1;
+	}
+
+	struct SimulatedPlayer {
+		std::size_t lines = 0;
+		// how long each continue took to run, and how long it took counting the time it spent queued behind other sessions
+		std::vector<double> run_times;
+		std::vector<double> response_times;
+	};
+
+	// one request of a simulated player, which queues the player's next request when it's done, until the story ends or the player has read enough
+	struct PlayerStep {
+		StoryHost* host;
+		StoryHost::Session* session;
+		SimulatedPlayer* player;
+		std::latch* finished;
+		std::size_t max_lines;
+		BenchClock::time_point queued = BenchClock::now();
+
+		void operator()(InkStory& story) {
+			if (story.can_continue() && player->lines < max_lines) {
+				BenchClock::time_point started = BenchClock::now();
+				story.continue_story();
+				BenchClock::time_point done = BenchClock::now();
+				player->run_times.push_back(std::chrono::duration<double, std::micro>(done - started).count());
+				player->response_times.push_back(std::chrono::duration<double, std::micro>(done - queued).count());
+				++player->lines;
+			} else if (!story.get_current_choices().empty() && player->lines < max_lines) {
+				story.choose_choice_index(0);
+			} else {
+				finished->count_down();
+				return;
+			}
+
+			PlayerStep next = *this;
+			next.queued = BenchClock::now();
+			host->post(*session, next);
+		}
+	};
+
+	int benchmark_host(const std::string& infile, std::size_t session_count) {
+		ByteVec inkb_bytes;
+		{
+			InkCompiler compiler;
+			InkStory story = compiler.compile_file(infile);
+			inkb_bytes = story.get_story_data()->get_serialized_bytes();
+		}
+
+		// NOTE: sessions share the one loaded program and only hold their own story state, so all of them are in flight at once
+		constexpr std::size_t MaxLines = 50;
+
+		std::size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+		std::vector<std::size_t> thread_counts = {1};
+		if (max_threads > 1) {
+			thread_counts.push_back(max_threads);
+		}
+
+		print("host: {} ({} sessions, up to {} lines each)\n", infile, session_count, MaxLines);
+
+		double single_thread_rate = 0.0;
+		for (std::size_t threads : thread_counts) {
+			StoryHost host{threads};
+			StoryHost::ProgramId program = host.add_program(ByteVec(inkb_bytes));
+
+			std::vector<StoryHost::Session*> sessions;
+			std::vector<SimulatedPlayer> players(session_count);
+			sessions.reserve(session_count);
+			for (std::size_t i = 0; i < session_count; ++i) {
+				sessions.push_back(&host.create_session(program, static_cast<std::uint32_t>(i)));
+			}
+
+			std::latch finished{static_cast<std::ptrdiff_t>(session_count)};
+			BenchClock::time_point start = BenchClock::now();
+			for (std::size_t i = 0; i < session_count; ++i) {
+				host.post(*sessions[i], PlayerStep{&host, sessions[i], &players[i], &finished, MaxLines});
+			}
+
+			finished.wait();
+			double running_time = elapsed_ms(start);
+
+			std::vector<double> run_times;
+			std::vector<double> response_times;
+			for (std::size_t i = 0; i < session_count; ++i) {
+				run_times.insert(run_times.end(), players[i].run_times.begin(), players[i].run_times.end());
+				response_times.insert(response_times.end(), players[i].response_times.begin(), players[i].response_times.end());
+				host.destroy_session(*sessions[i]);
+			}
+
+			if (run_times.empty()) {
+				print("  {:>3} threads: no lines were read\n", threads);
+				continue;
+			}
+
+			auto percentile = [](std::vector<double>& times, double fraction) {
+				auto nth = times.begin() + static_cast<std::ptrdiff_t>(fraction * (times.size() - 1));
+				std::nth_element(times.begin(), nth, times.end());
+				return *nth;
+			};
+
+			double rate = run_times.size() / (running_time / 1000.0);
+			if (threads == 1) {
+				single_thread_rate = rate;
+			}
+
+			print("  {:>3} threads: {:.0f} continues/s ({:.2f}x)\n", threads, rate, rate / single_thread_rate);
+			print("        running:    p50 {:.1f} us, p99 {:.1f} us per continue\n", percentile(run_times, 0.5), percentile(run_times, 0.99));
+			print("        with queue: p50 {:.1f} us, p99 {:.1f} us per continue ({} sessions in flight)\n",
+				percentile(response_times, 0.5), percentile(response_times, 0.99), session_count);
+		}
+
+		return 0;
+	}
+
+	int benchmark_batch(const std::string& infile, std::size_t session_count) {
+		ByteVec inkb_bytes;
+		{
+			InkCompiler compiler;
+			InkStory story = compiler.compile_file(infile);
+			inkb_bytes = story.get_story_data()->get_serialized_bytes();
+		}
+
+		constexpr std::size_t Steps = 50;
+		std::shared_ptr<InkStoryData> story_data = InkStory::load_story_data(inkb_bytes);
+		auto load_stories = [&]() {
+			std::vector<std::unique_ptr<InkStory>> stories;
+			for (std::size_t i = 0; i < session_count; ++i) {
+				stories.push_back(std::make_unique<InkStory>(story_data));
+				stories.back()->seed_random(static_cast<std::uint32_t>(i));
+			}
+
+			return stories;
+		};
+
+		print("batch: {} ({} sessions, {} steps each)\n", infile, session_count, Steps);
+
+		// every session on its own, one after another, the way a loop over continue_story would run them
+		std::vector<std::vector<std::string>> separate_lines(session_count);
+		double separate_time = 0.0;
+		{
+			std::vector<std::unique_ptr<InkStory>> stories = load_stories();
+			BenchClock::time_point start = BenchClock::now();
+			for (std::size_t i = 0; i < session_count; ++i) {
+				InkStory& story = *stories[i];
+				for (std::size_t step = 0; step < Steps; ++step) {
+					if (!story.can_continue() && !story.get_current_choices().empty()) {
+						story.choose_choice_index(0);
+					}
+
+					separate_lines[i].push_back(story.can_continue() ? story.continue_story() : "");
+				}
+			}
+
+			separate_time = elapsed_ms(start);
+		}
+
+		print("  separately:          {:.3f} ms\n", separate_time);
+
+		// the same steps in lockstep, but in session order rather than grouped by where each session is
+		double lockstep_time = 0.0;
+		{
+			std::vector<std::unique_ptr<InkStory>> stories = load_stories();
+			BenchClock::time_point start = BenchClock::now();
+			for (std::size_t step = 0; step < Steps; ++step) {
+				for (std::size_t i = 0; i < session_count; ++i) {
+					InkStory& story = *stories[i];
+					if (!story.can_continue() && !story.get_current_choices().empty()) {
+						story.choose_choice_index(0);
+					}
+
+					if (story.can_continue()) {
+						story.continue_story();
+					}
+				}
+			}
+
+			lockstep_time = elapsed_ms(start);
+		}
+
+		print("  lockstep, in order:  {:.3f} ms\n", lockstep_time);
+
+		std::size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+		std::vector<std::size_t> thread_counts = {1};
+		if (max_threads > 1) {
+			thread_counts.push_back(max_threads);
+		}
+
+		bool transcripts_match = true;
+		for (std::size_t threads : thread_counts) {
+			std::vector<std::unique_ptr<InkStory>> stories = load_stories();
+			std::vector<InkStory*> batch;
+			for (const std::unique_ptr<InkStory>& story : stories) {
+				batch.push_back(story.get());
+			}
+
+			std::vector<std::size_t> choices(session_count, 0);
+			std::vector<std::vector<std::string>> batch_lines(session_count);
+			BenchClock::time_point start = BenchClock::now();
+			for (std::size_t step = 0; step < Steps; ++step) {
+				std::vector<std::string> lines = advance_batch(batch, choices, threads);
+				for (std::size_t i = 0; i < session_count; ++i) {
+					batch_lines[i].push_back(std::move(lines[i]));
+				}
+			}
+
+			double batch_time = elapsed_ms(start);
+			transcripts_match = transcripts_match && batch_lines == separate_lines;
+			print("  batched, {:>3} threads: {:.3f} ms ({:.2f}x lockstep)\n", threads, batch_time, lockstep_time / batch_time);
+		}
+
+		print("  transcripts {}\n", transcripts_match ? "match" : "DIFFER");
+		return transcripts_match ? 0 : 1;
+	}
+
+	int benchmark_lex(const std::string& infile, std::size_t iterations) {
+		std::ifstream file{infile};
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		std::string script = buffer.str();
+
+		std::size_t token_count = 0;
+		BenchClock::time_point start = BenchClock::now();
+		for (std::size_t i = 0; i < iterations; ++i) {
+			InkLexer lexer;
+			token_count = lexer.lex_script(script).size();
+		}
+
+		double lex_time = elapsed_ms(start) / iterations;
+		double megabytes = static_cast<double>(script.size()) / (1024.0 * 1024.0);
+
+		print("lex: {} ({} iterations, {} bytes, {} tokens)\n", infile, iterations, script.size(), token_count);
+		print("  {:.4f} ms per pass, {:.2f} MB/s\n", lex_time, megabytes / (lex_time / 1000.0));
+		return 0;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 3) {
+		print("Usage: ink_benchmark <benchmark> <ink file> [iterations]\n");
+		print("Benchmarks: startup, load, lex, edit, play, host, batch\n");
+		return 1;
+	}
+
+	std::string benchmark = argv[1];
+	std::string infile = argv[2];
+	std::size_t iterations = argc > 3 ? static_cast<std::size_t>(std::strtoull(argv[3], nullptr, 10)) : 100;
+	if (iterations == 0) {
+		iterations = 1;
+	}
+
+	if (benchmark == "startup") {
+		return benchmark_startup(infile, iterations);
+	} else if (benchmark == "load") {
+		return benchmark_load(infile, iterations);
+	} else if (benchmark == "lex") {
+		return benchmark_lex(infile, iterations);
+	} else if (benchmark == "edit") {
+		return benchmark_edit(infile, iterations);
+	} else if (benchmark == "play") {
+		return benchmark_play(infile, iterations);
+	} else if (benchmark == "host") {
+		// NOTE: for this one the count is how many players to simulate
+		return benchmark_host(infile, argc > 3 ? iterations : 10000);
+	} else if (benchmark == "batch") {
+		return benchmark_batch(infile, argc > 3 ? iterations : 256);
+	}
+
+	print("Error: Unknown benchmark '{}'\n", benchmark);
+	return 1;
+}
@@ -1,5 +1,16 @@
 #include "ink_compiler.h"
 
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+
 #if __has_include(<print>)
 #include <print>
 using std::print;
@@ -9,14 +20,207 @@ using std::print;
 #define print(fmt, ...) std::cout << std::format(fmt __VA_OPT__(,) __VA_ARGS__)
 #endif
 
+namespace {
+	struct CompileOptions {
+		std::size_t threads = 1;
+		std::string cache_file;
+		bool strip = false;
+		bool report = false;
+		std::vector<std::string> entry_points;
+	};
+
+	struct BatchEntry {
+		std::string in_file;
+		std::string out_file;
+
+		bool succeeded = false;
+		std::string error;
+		InkCompiler::PhaseTimings timings;
+		InkCompiler::ObjectCounts object_counts;
+		std::size_t stripped_count = 0;
+	};
+
+	void configure_compiler(InkCompiler& compiler, const CompileOptions& options) {
+		compiler.set_knot_cache_file(options.cache_file);
+		compiler.set_strip_unreachable(options.strip);
+		for (const std::string& entry_point : options.entry_points) {
+			compiler.add_entry_point(entry_point);
+		}
+	}
+
+	// each line of a manifest is an ink file, optionally followed by where to write its .inkb; relative paths are relative to the manifest
+	std::vector<BatchEntry> read_manifest(const std::string& manifest_path) {
+		std::ifstream manifest{manifest_path};
+		if (!manifest.is_open()) {
+			throw std::runtime_error(std::format("Could not open manifest '{}'", manifest_path));
+		}
+
+		std::filesystem::path base_dir = std::filesystem::path(manifest_path).parent_path();
+		auto resolve = [&base_dir](const std::string& path) {
+			std::filesystem::path result{path};
+			return (result.is_relative() ? base_dir / result : result).string();
+		};
+
+		std::vector<BatchEntry> result;
+		std::string line;
+		while (std::getline(manifest, line)) {
+			std::istringstream fields{line};
+			std::string in_file;
+			std::string out_file;
+			if (!(fields >> in_file) || in_file.starts_with('#')) {
+				continue;
+			}
+
+			BatchEntry entry;
+			entry.in_file = resolve(in_file);
+			entry.out_file = fields >> out_file ? resolve(out_file) : std::filesystem::path(entry.in_file).replace_extension(".inkb").string();
+			result.push_back(std::move(entry));
+		}
+
+		return result;
+	}
+
+	void compile_batch_entry(BatchEntry& entry, const CompileOptions& options) {
+		try {
+			if (!std::filesystem::is_regular_file(entry.in_file)) {
+				throw std::runtime_error("File not found");
+			}
+
+			InkCompiler compiler;
+			configure_compiler(compiler, options);
+			compiler.compile_file_to_file(entry.in_file, entry.out_file);
+
+			entry.timings = compiler.get_phase_timings();
+			entry.object_counts = compiler.get_merged_object_counts();
+			entry.stripped_count = compiler.get_stripped_knots().size();
+			entry.succeeded = true;
+		} catch (const std::exception& e) {
+			entry.error = e.what();
+		}
+	}
+
+	int compile_batch(const std::string& manifest_path, const CompileOptions& options) {
+		std::vector<BatchEntry> entries;
+		try {
+			entries = read_manifest(manifest_path);
+		} catch (const std::exception& e) {
+			print("Error: {}\n", e.what());
+			return 1;
+		}
+
+		// NOTE: stories are independent, so they're spread across the threads and each is compiled single-threaded, rather than splitting each story's includes up
+		std::atomic<std::size_t> next_entry = 0;
+		auto worker = [&]() {
+			for (std::size_t i = next_entry++; i < entries.size(); i = next_entry++) {
+				compile_batch_entry(entries[i], options);
+			}
+		};
+
+		std::size_t worker_count = std::max<std::size_t>(std::min(options.threads, entries.size()), 1);
+		{
+			std::vector<std::jthread> workers;
+			workers.reserve(worker_count - 1);
+			for (std::size_t i = 1; i < worker_count; ++i) {
+				workers.emplace_back(worker);
+			}
+
+			worker();
+		}
+
+		// a tab separated summary, one line per file in manifest order
+		bool any_failed = false;
+		print("file\tstatus\tlex_ms\tcompile_ms\tserialize_ms\tobjects_before\tobjects_after\tstripped_knots\n");
+		for (const BatchEntry& entry : entries) {
+			print("{}\t{}\t{:.3f}\t{:.3f}\t{:.3f}\t{}\t{}\t{}\n", entry.in_file, entry.succeeded ? "ok" : "error",
+				entry.timings.lex, entry.timings.compile, entry.timings.serialize,
+				entry.object_counts.before, entry.object_counts.after, entry.stripped_count);
+
+			if (!entry.succeeded) {
+				std::cerr << std::format("Error: {}: {}\n", entry.in_file, entry.error);
+				any_failed = true;
+			}
+		}
+
+		return any_failed ? 1 : 0;
+	}
+}
+
 int main(int argc, char* argv[]) {
-	if (argc < 2 || argc > 3) {
+	CompileOptions options;
+	std::string manifest_file;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg.starts_with("-j")) {
+			std::string count = arg.length() > 2 ? arg.substr(2) : i + 1 < argc ? argv[++i] : "";
+			options.threads = static_cast<std::size_t>(std::strtoull(count.c_str(), nullptr, 10));
+			if (options.threads == 0) {
+				print("Error: -j expects a thread count\n");
+				return 1;
+			}
+		} else if (arg == "--cache") {
+			if (i + 1 >= argc) {
+				print("Error: --cache expects a file path\n");
+				return 1;
+			}
+
+			options.cache_file = argv[++i];
+		} else if (arg == "--batch") {
+			if (i + 1 >= argc) {
+				print("Error: --batch expects a manifest file\n");
+				return 1;
+			}
+
+			manifest_file = argv[++i];
+		} else if (arg == "--report") {
+			options.report = true;
+		} else if (arg == "--strip") {
+			options.strip = true;
+		} else if (arg == "--entry") {
+			if (i + 1 >= argc) {
+				print("Error: --entry expects a knot name\n");
+				return 1;
+			}
+
+			options.entry_points.push_back(argv[++i]);
+		} else {
+			files.push_back(arg);
+		}
+	}
+
+	if (!manifest_file.empty()) {
+		if (!files.empty() || !options.cache_file.empty()) {
+			print("Error: --batch can't be combined with an ink file or --cache\n");
+			return 1;
+		}
+
+		return compile_batch(manifest_file, options);
+	}
+
+	if (files.empty() || files.size() > 2) {
 		print("Error: No ink file specified\n");
+		print("Usage: inkc [-j threads] [--cache cache file] [--strip [--entry knot]...] [--report] <ink file> [output file]\n");
+		print("       inkc [-j threads] [--strip [--entry knot]...] --batch <manifest file>\n");
 		return 1;
 	}
 
-	std::string infile = argv[1];
+	std::string infile = files[0];
 	std::string noext = infile.substr(infile.find('.'));
 	InkCompiler compiler;
-	compiler.compile_file_to_file(infile, argc == 3 ? argv[2] : noext + ".inkb");
+	compiler.set_max_threads(options.threads);
+	configure_compiler(compiler, options);
+	compiler.compile_file_to_file(infile, files.size() == 2 ? files[1] : noext + ".inkb");
+
+	if (options.strip) {
+		const std::vector<std::string>& stripped = compiler.get_stripped_knots();
+		print("Removed {} unreachable knot(s)\n", stripped.size());
+		for (const std::string& knot : stripped) {
+			print("  {}\n", knot);
+		}
+	}
+
+	if (options.report) {
+		const InkCompiler::ObjectCounts& counts = compiler.get_merged_object_counts();
+		print("Objects: {} -> {} after merging\n", counts.before, counts.after);
+	}
 }
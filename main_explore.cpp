@@ -0,0 +1,402 @@
+#include "runtime/ink_story.h"
+#include "ink_compiler.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <span>
+#include <unordered_set>
+#include <memory>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+
+#if __has_include(<print>)
+#include <print>
+using std::print;
+#else
+#include <format>
+#include <iostream>
+#define print(fmt, ...) std::cout << std::format(fmt __VA_OPT__(,) __VA_ARGS__)
+#endif
+
+namespace {
+	struct ExploreOptions {
+		std::size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+		std::size_t max_depth = 64;
+		std::size_t max_states = 1000000;
+		std::uint32_t seed = 0;
+	};
+
+	// a state is named by the choices taken to reach it
+	using ChoicePath = std::vector<std::uint32_t>;
+
+	// a state still to be looked at: the one it comes from, stopped at its choices, and which of them to take
+	struct PendingNode {
+		std::shared_ptr<const InkStory> parent;
+		ChoicePath path;
+		std::size_t parent_lines = 0;
+	};
+
+	struct NodeResult {
+		std::unique_ptr<InkStory> story;
+		std::uint64_t hash = 0;
+		std::size_t choice_count = 0;
+		std::size_t lines = 0;
+		std::string error;
+	};
+
+	// what the states a worker has seen covered, merged together once each level is done
+	struct Coverage {
+		std::unordered_set<UuidValue> visited;
+		std::vector<std::uint64_t> choices_offered;
+		std::vector<std::uint64_t> choices_taken;
+
+		void add(const InkStory& story) {
+			const InkStoryState& state = story.get_story_state();
+			auto add_visited = [this](const auto& stats) {
+				for (const auto& entry : stats) {
+					if (entry.second.times_visited > 0) {
+						visited.insert(entry.first.get());
+					}
+				}
+			};
+
+			add_visited(state.story_tracking.knot_stats);
+			add_visited(state.story_tracking.stitch_stats);
+			add_visited(state.story_tracking.gather_point_stats);
+
+			// NOTE: the story starts inside its root knot without ever visiting it
+			for (const KnotStatus& frame : state.current_knots_stack) {
+				visited.insert(frame.knot->uuid.get());
+			}
+
+			for (const InkChoiceEntry* choice : state.current_choice_structs) {
+				if (choice) {
+					set_bit(choices_offered, choice->ordinal);
+				}
+			}
+
+			choices_taken.resize(std::max(choices_taken.size(), state.choices_taken.size()));
+			for (std::size_t i = 0; i < state.choices_taken.size(); ++i) {
+				choices_taken[i] |= state.choices_taken[i];
+			}
+		}
+
+		void merge(const Coverage& other) {
+			visited.insert(other.visited.begin(), other.visited.end());
+			for (auto [into, from] : {std::pair{&choices_offered, &other.choices_offered}, std::pair{&choices_taken, &other.choices_taken}}) {
+				into->resize(std::max(into->size(), from->size()));
+				for (std::size_t i = 0; i < from->size(); ++i) {
+					(*into)[i] |= (*from)[i];
+				}
+			}
+		}
+
+		static void set_bit(std::vector<std::uint64_t>& bits, std::uint32_t index) {
+			if (index / 64 >= bits.size()) {
+				bits.resize(index / 64 + 1);
+			}
+
+			bits[index / 64] |= std::uint64_t{1} << (index % 64);
+		}
+
+		static bool has_bit(const std::vector<std::uint64_t>& bits, std::uint32_t index) {
+			return index / 64 < bits.size() && (bits[index / 64] & (std::uint64_t{1} << (index % 64))) != 0;
+		}
+	};
+
+	struct FinishedPath {
+		ChoicePath path;
+		std::size_t lines = 0;
+	};
+
+	// takes each choice on the path in turn, and returns how many lines were read on the way
+	std::size_t play_path(InkStory& story, std::span<const std::uint32_t> path, std::vector<std::string>* transcript = nullptr) {
+		std::size_t lines = 0;
+		auto read_lines = [&]() {
+			while (story.can_continue()) {
+				std::string line = story.continue_story();
+				if (transcript && !line.empty()) {
+					transcript->push_back(std::move(line));
+				}
+
+				++lines;
+			}
+		};
+
+		for (std::uint32_t choice : path) {
+			read_lines();
+			if (transcript) {
+				transcript->push_back("> " + story.get_current_choices().at(choice));
+			}
+
+			story.choose_choice_index(choice);
+		}
+
+		read_lines();
+		return lines;
+	}
+
+	ByteVec load_program(const std::string& infile) {
+		if (infile.ends_with(".inkb")) {
+			std::ifstream file{infile, std::ios::binary};
+			if (!file.is_open()) {
+				throw std::runtime_error(std::format("Could not open inkb file '{}'", infile));
+			}
+
+			ByteVec bytes(static_cast<std::size_t>(std::filesystem::file_size(infile)));
+			file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+			return bytes;
+		}
+
+		InkCompiler compiler;
+		InkStory story = compiler.compile_file(infile);
+		return story.get_story_data()->get_serialized_bytes();
+	}
+
+	void report_unreached(const InkStory& story, const Coverage& coverage) {
+		const InkStoryTracking& tracking = story.get_story_state().story_tracking;
+		std::vector<std::string> unreached;
+		std::size_t total = 0;
+		auto check = [&](Uuid uuid, const std::string& description) {
+			++total;
+			if (!coverage.visited.contains(uuid.get())) {
+				unreached.push_back(description);
+			}
+		};
+
+		auto gather_name = [&tracking](Uuid uuid, const std::string& location) {
+			const std::string& name = tracking.gather_point_stats.at(uuid).name;
+			return name.empty() ? std::format("gather (unlabelled) in {}", location) : std::format("gather {}.{}", location, name);
+		};
+
+		for (const auto& [uuid, knot] : tracking.knot_stats) {
+			check(uuid, std::format("knot {}", knot.name));
+			for (Uuid stitch_uuid : knot.stitches) {
+				std::string stitch_location = std::format("{}.{}", knot.name, tracking.stitch_stats.at(stitch_uuid).name);
+				check(stitch_uuid, std::format("stitch {}", stitch_location));
+				for (Uuid gather_uuid : tracking.stitch_stats.at(stitch_uuid).gather_points) {
+					check(gather_uuid, gather_name(gather_uuid, stitch_location));
+				}
+			}
+
+			for (Uuid gather_uuid : knot.gather_points) {
+				check(gather_uuid, gather_name(gather_uuid, knot.name));
+			}
+		}
+
+		std::vector<std::string> choices = story.get_story_data()->describe_choices();
+		std::size_t offered = 0;
+		std::size_t taken = 0;
+		for (std::uint32_t ordinal = 0; ordinal < choices.size(); ++ordinal) {
+			offered += Coverage::has_bit(coverage.choices_offered, ordinal);
+			taken += story.get_story_state().has_choice_been_taken(ordinal) || Coverage::has_bit(coverage.choices_taken, ordinal);
+			if (!Coverage::has_bit(coverage.choices_offered, ordinal)) {
+				unreached.push_back(std::format("choice {}", choices[ordinal]));
+			}
+		}
+
+		print("  content:  {}/{} knots, stitches and gathers reached\n", total - (unreached.size() - (choices.size() - offered)), total);
+		print("  choices:  {}/{} offered, {}/{} taken\n", offered, choices.size(), taken, choices.size());
+
+		if (unreached.empty()) {
+			return;
+		}
+
+		std::sort(unreached.begin(), unreached.end());
+		print("never reached ({}):\n", unreached.size());
+		for (const std::string& description : unreached) {
+			print("  {}\n", description);
+		}
+	}
+
+	int explore(const std::string& infile, const ExploreOptions& options) {
+		std::shared_ptr<InkStoryData> program = InkStory::load_story_data(load_program(infile));
+		print("explore: {} ({} threads, depth limit {}, state limit {})\n", infile, options.threads, options.max_depth, options.max_states);
+
+		std::unordered_set<std::uint64_t> seen;
+		std::vector<PendingNode> level{{}};
+		Coverage coverage;
+
+		std::size_t duplicates = 0;
+		std::size_t depth_limited = 0;
+		std::size_t state_limited = 0;
+		std::size_t failures = 0;
+		std::string first_error;
+		std::vector<FinishedPath> endings;
+
+		for (std::size_t depth = 0; !level.empty(); ++depth) {
+			// NOTE: every state in a level is forked from its parent in parallel, then deduplicated in path order, so the result doesn't depend on the thread count
+			std::vector<NodeResult> results(level.size());
+			std::vector<Coverage> worker_coverage(std::max<std::size_t>(std::min(options.threads, level.size()), 1));
+			std::atomic<std::size_t> next_node = 0;
+			auto worker = [&](std::size_t worker_index) {
+				for (std::size_t i = next_node++; i < level.size(); i = next_node++) {
+					NodeResult& result = results[i];
+					const PendingNode& node = level[i];
+					try {
+						std::unique_ptr<InkStory> story;
+						if (node.parent) {
+							story = node.parent->fork();
+							result.lines = node.parent_lines + play_path(*story, std::span(node.path).last(1));
+						} else {
+							story = std::make_unique<InkStory>(program);
+							story->seed_random(options.seed);
+							result.lines = play_path(*story, {});
+						}
+
+						result.choice_count = story->get_current_choices().size();
+						result.hash = story->behaviour_hash();
+						worker_coverage[worker_index].add(*story);
+						result.story = std::move(story);
+					} catch (const std::exception& e) {
+						result.error = e.what();
+					}
+				}
+			};
+
+			{
+				std::vector<std::jthread> workers;
+				for (std::size_t i = 1; i < worker_coverage.size(); ++i) {
+					workers.emplace_back(worker, i);
+				}
+
+				worker(0);
+			}
+
+			for (const Coverage& worker_result : worker_coverage) {
+				coverage.merge(worker_result);
+			}
+
+			std::vector<PendingNode> next_level;
+			for (std::size_t i = 0; i < level.size(); ++i) {
+				NodeResult& result = results[i];
+				if (!result.error.empty()) {
+					if (failures++ == 0) {
+						first_error = result.error;
+					}
+
+					continue;
+				}
+
+				if (!seen.insert(result.hash).second) {
+					++duplicates;
+					continue;
+				}
+
+				if (result.choice_count == 0) {
+					endings.push_back({std::move(level[i].path), result.lines});
+				} else if (depth >= options.max_depth) {
+					++depth_limited;
+				} else if (seen.size() + next_level.size() >= options.max_states) {
+					++state_limited;
+				} else {
+					// NOTE: the children share their parent, which is let go of once they've all been forked from it
+					std::shared_ptr<const InkStory> parent = std::move(result.story);
+					for (std::uint32_t choice = 0; choice < result.choice_count; ++choice) {
+						ChoicePath child = level[i].path;
+						child.push_back(choice);
+						next_level.push_back({parent, std::move(child), result.lines});
+					}
+				}
+			}
+
+			results.clear();
+			std::cerr << "depth " << depth << " level " << level.size() << " next " << next_level.size() << " seen " << seen.size() << std::endl;
+			level = std::move(next_level);
+		}
+
+		print("  states:   {} unique, {} duplicates merged, {} endings\n", seen.size(), duplicates, endings.size());
+		if (depth_limited > 0 || state_limited > 0) {
+			print("  stopped:  {} states at the depth limit, {} past the state limit; coverage below is a lower bound\n", depth_limited, state_limited);
+		}
+
+		if (failures > 0) {
+			print("  failed:   {} states, first with: {}\n", failures, first_error);
+		}
+
+		InkStory reference{program};
+		report_unreached(reference, coverage);
+
+		// the longest playthroughs that reach an ending, by choices made and then by lines read
+		std::sort(endings.begin(), endings.end(), [](const FinishedPath& lhs, const FinishedPath& rhs) {
+			return lhs.path.size() != rhs.path.size() ? lhs.path.size() > rhs.path.size() : lhs.lines > rhs.lines;
+		});
+
+		constexpr std::size_t LongestPathCount = 3;
+		print("longest paths:\n");
+		for (std::size_t i = 0; i < std::min(LongestPathCount, endings.size()); ++i) {
+			InkStory story{program};
+			story.seed_random(options.seed);
+			std::vector<std::string> transcript;
+			play_path(story, endings[i].path, &transcript);
+
+			print("  {} choices, {} lines:\n", endings[i].path.size(), endings[i].lines);
+			for (const std::string& line : transcript) {
+				if (line.starts_with("> ")) {
+					print("    {}\n", line);
+				}
+			}
+		}
+
+		return failures > 0 ? 1 : 0;
+	}
+
+	bool parse_count(int argc, char* argv[], int& i, const char* option, std::size_t& result) {
+		if (i + 1 >= argc || (result = static_cast<std::size_t>(std::strtoull(argv[i + 1], nullptr, 10))) == 0) {
+			print("Error: {} expects a number\n", option);
+			return false;
+		}
+
+		++i;
+		return true;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	ExploreOptions options;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "-j") {
+			if (!parse_count(argc, argv, i, "-j", options.threads)) {
+				return 1;
+			}
+		} else if (arg == "--max-depth") {
+			if (!parse_count(argc, argv, i, "--max-depth", options.max_depth)) {
+				return 1;
+			}
+		} else if (arg == "--max-states") {
+			if (!parse_count(argc, argv, i, "--max-states", options.max_states)) {
+				return 1;
+			}
+		} else if (arg == "--seed") {
+			if (i + 1 >= argc) {
+				print("Error: --seed expects a number\n");
+				return 1;
+			}
+
+			options.seed = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		} else {
+			files.push_back(arg);
+		}
+	}
+
+	if (files.size() != 1) {
+		print("Error: No ink file specified\n");
+		print("Usage: ink_explore [-j threads] [--max-depth choices] [--max-states states] [--seed seed] <ink or inkb file>\n");
+		return 1;
+	}
+
+	try {
+		return explore(files[0], options);
+	} catch (const std::exception& e) {
+		print("Error: {}\n", e.what());
+		return 1;
+	}
+}
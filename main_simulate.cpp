@@ -0,0 +1,324 @@
+#include "runtime/ink_story.h"
+#include "ink_compiler.h"
+#include "ink_utils.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <bit>
+#include <map>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+
+#if __has_include(<print>)
+#include <print>
+using std::print;
+#else
+#include <format>
+#include <iostream>
+#define print(fmt, ...) std::cout << std::format(fmt __VA_OPT__(,) __VA_ARGS__)
+#endif
+
+namespace {
+	struct SimulateOptions {
+		std::size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+		std::size_t playthroughs = 10000;
+		std::size_t max_turns = 1000;
+		std::uint32_t seed = 0;
+		std::vector<std::string> variables;
+	};
+
+	// NOTE: ordered, so printing a histogram never depends on which worker saw what first
+	using Histogram = std::map<std::string, std::size_t>;
+
+	// what one worker's playthroughs added up to; each worker keeps its own, and they're only merged once every worker is done
+	struct Tally {
+		std::size_t finished = 0;
+		std::size_t cut_off = 0;
+		std::size_t failures = 0;
+		std::size_t first_failure = SIZE_MAX;
+		std::string first_error;
+
+		std::size_t total_turns = 0;
+		std::size_t total_lines = 0;
+		std::size_t most_turns = 0;
+
+		Histogram endings;
+		Histogram turns;
+		std::vector<Histogram> variables;
+
+		void merge(const Tally& other) {
+			finished += other.finished;
+			cut_off += other.cut_off;
+			failures += other.failures;
+			if (other.first_failure < first_failure) {
+				first_failure = other.first_failure;
+				first_error = other.first_error;
+			}
+
+			total_turns += other.total_turns;
+			total_lines += other.total_lines;
+			most_turns = std::max(most_turns, other.most_turns);
+
+			for (const auto& [ending, count] : other.endings) {
+				endings[ending] += count;
+			}
+
+			for (const auto& [turn_count, count] : other.turns) {
+				turns[turn_count] += count;
+			}
+
+			variables.resize(std::max(variables.size(), other.variables.size()));
+			for (std::size_t i = 0; i < other.variables.size(); ++i) {
+				for (const auto& [value, count] : other.variables[i]) {
+					variables[i][value] += count;
+				}
+			}
+		}
+	};
+
+	// every playthrough gets its own random stream from the master seed and its number, so it plays out the same on any worker
+	std::uint64_t playthrough_seed(std::uint32_t master_seed, std::size_t playthrough) {
+		return mix_hash(mix_hash(master_seed) ^ playthrough);
+	}
+
+	// where a finished story stopped: the innermost knot (and stitch) it was reading
+	std::string get_ending(const InkStory& story) {
+		const KnotStatusStack& knots = story.get_story_state().current_knots_stack;
+		for (std::size_t i = knots.size(); i > 0; --i) {
+			const KnotStatus& frame = knots[i - 1];
+			if (!frame.knot->name.empty()) {
+				return frame.current_stitch ? std::format("{}.{}", frame.knot->name, frame.current_stitch->name) : frame.knot->name;
+			}
+		}
+
+		return "(top level)";
+	}
+
+	// groups turn counts into buckets that double in size, so a histogram of them stays short
+	std::string get_turn_bucket(std::size_t turns) {
+		if (turns < 4) {
+			return std::format("{:>5}", turns);
+		}
+
+		std::size_t low = std::bit_floor(turns);
+		return std::format("{:>5}-{}", low, low * 2 - 1);
+	}
+
+	void play_through(InkStory& story, std::mt19937_64& rng, const SimulateOptions& options, Tally& tally) {
+		std::size_t turns = 0;
+		std::size_t lines = 0;
+		while (true) {
+			while (story.can_continue()) {
+				story.continue_story();
+				++lines;
+			}
+
+			const std::vector<std::string>& choices = story.get_current_choices();
+			if (choices.empty()) {
+				break;
+			}
+
+			if (turns == options.max_turns) {
+				++tally.cut_off;
+				return;
+			}
+
+			// NOTE: not std::uniform_int_distribution, whose results differ between standard libraries
+			story.choose_choice_index(static_cast<std::size_t>(rng() % choices.size()));
+			++turns;
+		}
+
+		++tally.finished;
+		tally.total_turns += turns;
+		tally.total_lines += lines;
+		tally.most_turns = std::max(tally.most_turns, turns);
+		++tally.endings[get_ending(story)];
+		++tally.turns[get_turn_bucket(turns)];
+
+		for (std::size_t i = 0; i < options.variables.size(); ++i) {
+			std::optional<ExpressionParserV2::Variant> value = story.get_variable(options.variables[i]);
+			++tally.variables[i][value.has_value() ? value->to_printable_string() : "(not set)"];
+		}
+	}
+
+	ByteVec load_program(const std::string& infile) {
+		if (infile.ends_with(".inkb")) {
+			std::ifstream file{infile, std::ios::binary};
+			if (!file.is_open()) {
+				throw std::runtime_error(std::format("Could not open inkb file '{}'", infile));
+			}
+
+			ByteVec bytes(static_cast<std::size_t>(std::filesystem::file_size(infile)));
+			file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+			return bytes;
+		}
+
+		InkCompiler compiler;
+		InkStory story = compiler.compile_file(infile);
+		return story.get_story_data()->get_serialized_bytes();
+	}
+
+	void print_histogram(const Histogram& histogram, std::size_t total, bool by_count) {
+		std::vector<std::pair<std::string, std::size_t>> entries{histogram.begin(), histogram.end()};
+		if (by_count) {
+			std::stable_sort(entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) { return lhs.second > rhs.second; });
+		}
+
+		for (const auto& [key, count] : entries) {
+			print("  {:>10} {:>6.2f}%  {}\n", count, 100.0 * static_cast<double>(count) / static_cast<double>(std::max<std::size_t>(total, 1)), key);
+		}
+	}
+
+	int simulate(const std::string& infile, const SimulateOptions& options) {
+		ByteVec program = load_program(infile);
+		std::size_t thread_count = std::max<std::size_t>(std::min(options.threads, options.playthroughs), 1);
+		print("simulate: {} ({} playthroughs, {} threads, seed {}, turn limit {})\n", infile, options.playthroughs, thread_count, options.seed, options.max_turns);
+
+		// NOTE: playthroughs are handed out a chunk at a time, which only decides who runs them, never how they play out
+		constexpr std::size_t ChunkSize = 64;
+		std::atomic<std::size_t> next_chunk = 0;
+		std::vector<Tally> tallies(thread_count);
+		auto worker = [&](std::size_t worker_index) {
+			Tally& tally = tallies[worker_index];
+			tally.variables.resize(options.variables.size());
+
+			// each worker loads the program once, and resets its session between playthroughs
+			InkStory story{program, 1};
+			bool needs_reset = false;
+			for (std::size_t chunk = next_chunk++; chunk * ChunkSize < options.playthroughs; chunk = next_chunk++) {
+				std::size_t end = std::min(options.playthroughs, (chunk + 1) * ChunkSize);
+				for (std::size_t playthrough = chunk * ChunkSize; playthrough < end; ++playthrough) {
+					if (needs_reset) {
+						story.reset();
+					}
+
+					needs_reset = true;
+					std::uint64_t seed = playthrough_seed(options.seed, playthrough);
+					std::mt19937_64 rng{seed};
+					story.seed_random(static_cast<std::uint32_t>(seed >> 32));
+					try {
+						play_through(story, rng, options, tally);
+					} catch (const std::exception& e) {
+						if (tally.failures++ == 0) {
+							tally.first_failure = playthrough;
+							tally.first_error = e.what();
+						}
+					}
+				}
+			}
+		};
+
+		auto start_time = std::chrono::steady_clock::now();
+		{
+			std::vector<std::jthread> workers;
+			for (std::size_t i = 1; i < thread_count; ++i) {
+				workers.emplace_back(worker, i);
+			}
+
+			worker(0);
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+		Tally total;
+		total.variables.resize(options.variables.size());
+		for (const Tally& tally : tallies) {
+			total.merge(tally);
+		}
+
+		print("  finished:  {}\n", total.finished);
+		if (total.cut_off > 0) {
+			print("  cut off:   {} still going after {} turns\n", total.cut_off, options.max_turns);
+		}
+
+		if (total.failures > 0) {
+			print("  failed:    {}, first (playthrough {}) with: {}\n", total.failures, total.first_failure, total.first_error);
+		}
+
+		double finished = static_cast<double>(std::max<std::size_t>(total.finished, 1));
+		print("  turns:     {:.2f} on average, {} at most\n", static_cast<double>(total.total_turns) / finished, total.most_turns);
+		print("  lines:     {:.2f} on average\n", static_cast<double>(total.total_lines) / finished);
+
+		print("endings:\n");
+		print_histogram(total.endings, total.finished, true);
+
+		print("turns taken:\n");
+		print_histogram(total.turns, total.finished, false);
+
+		for (std::size_t i = 0; i < options.variables.size(); ++i) {
+			print("variable {}:\n", options.variables[i]);
+			print_histogram(total.variables[i], total.finished, true);
+		}
+
+		// NOTE: on stderr, so everything on stdout stays the same from run to run
+		std::cerr << std::format("{:.2f}s, {:.0f} playthroughs/s\n", seconds, static_cast<double>(options.playthroughs) / seconds);
+		return total.failures > 0 ? 1 : 0;
+	}
+
+	bool parse_count(int argc, char* argv[], int& i, const char* option, std::size_t& result) {
+		if (i + 1 >= argc || (result = static_cast<std::size_t>(std::strtoull(argv[i + 1], nullptr, 10))) == 0) {
+			print("Error: {} expects a number\n", option);
+			return false;
+		}
+
+		++i;
+		return true;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	SimulateOptions options;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "-j") {
+			if (!parse_count(argc, argv, i, "-j", options.threads)) {
+				return 1;
+			}
+		} else if (arg == "-n") {
+			if (!parse_count(argc, argv, i, "-n", options.playthroughs)) {
+				return 1;
+			}
+		} else if (arg == "--max-turns") {
+			if (!parse_count(argc, argv, i, "--max-turns", options.max_turns)) {
+				return 1;
+			}
+		} else if (arg == "--seed") {
+			if (i + 1 >= argc) {
+				print("Error: --seed expects a number\n");
+				return 1;
+			}
+
+			options.seed = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--var") {
+			if (i + 1 >= argc) {
+				print("Error: --var expects a variable name\n");
+				return 1;
+			}
+
+			options.variables.push_back(argv[++i]);
+		} else {
+			files.push_back(arg);
+		}
+	}
+
+	if (files.size() != 1) {
+		print("Error: No ink file specified\n");
+		print("Usage: ink_simulate [-j threads] [-n playthroughs] [--max-turns turns] [--seed seed] [--var variable]... <ink or inkb file>\n");
+		return 1;
+	}
+
+	try {
+		return simulate(files[0], options);
+	} catch (const std::exception& e) {
+		print("Error: {}\n", e.what());
+		return 1;
+	}
+}
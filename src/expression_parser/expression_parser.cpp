@@ -707,24 +707,34 @@ std::vector<Token> ExpressionParserV2::shunt(const std::vector<Token>& infix) {
 	stack.pop_back();\
 } break;
 
-ExpressionParserV2::ExecuteResult ExpressionParserV2::execute_expression_tokens(std::vector<Token>& expression_tokens, StoryVariableInfo& story_variable_info) {
+ExpressionParserV2::ExecuteResult ExpressionParserV2::execute_expression_tokens(const std::vector<Token>& expression_tokens, StoryVariableInfo& story_variable_info) {
 	std::vector<Token> stack;
 	std::size_t index = 0;
 	while (index < expression_tokens.size()) {
-		Token& this_token = expression_tokens[index];
+		const Token& this_token = expression_tokens[index];
 
 		switch (this_token.type) {
 			case TokenType::Variable: {
-				this_token.fetch_variable_value(story_variable_info);
-				[[fallthrough]];
-			}
+				stack.push_back(this_token);
+				stack.back().fetch_variable_value(story_variable_info);
+			} break;
+
 			case TokenType::LiteralBool:
 			case TokenType::LiteralNumberInt:
 			case TokenType::LiteralNumberFloat:
 			case TokenType::LiteralString:
-			case TokenType::LiteralKnotName:
+			case TokenType::LiteralKnotName: {
+				stack.push_back(this_token);
+			} break;
+
 			case TokenType::LiteralList: {
+				// NOTE: list literals loaded from an inkb file don't know their definitions until they're used
 				stack.push_back(this_token);
+				if (!static_cast<InkList>(this_token.value).get_definition_map()) {
+					InkList list = this_token.value;
+					list.set_definition_map(&story_variable_info.defined_lists);
+					stack.back().value = list;
+				}
 			} break;
 
 			case TokenType::Operator: {
@@ -797,8 +807,6 @@ ExpressionParserV2::ExecuteResult ExpressionParserV2::execute_expression_tokens(
 			} break;
 
 			case TokenType::Function: {
-				this_token.fetch_function_value(story_variable_info);
-
 				std::vector<Token> func_args;
 				for (std::uint8_t i = 0; i < this_token.function_argument_count; ++i) {
 					func_args.push_back(stack[stack.size() - (this_token.function_argument_count - i)]);
@@ -808,6 +816,34 @@ ExpressionParserV2::ExecuteResult ExpressionParserV2::execute_expression_tokens(
 					return std::unexpected(NulloptResult(NulloptResult::Reason::FoundKnotFunction, this_token, index, func_args));
 				}
 
+				if (this_token.function_fetch_type == FunctionFetchType::External) {
+					std::vector<Variant> arg_values;
+					for (const Token& token : func_args) {
+						arg_values.push_back(token.value);
+					}
+
+					ExternalResult result = this_token.call_external_function(arg_values, story_variable_info);
+					Variant value;
+					if (std::shared_ptr<PendingValue>* pending = std::get_if<std::shared_ptr<PendingValue>>(&result)) {
+						if (!(*pending)->is_resolved()) {
+							NulloptResult waiting{NulloptResult::Reason::WaitingOnExternal, this_token, index, func_args};
+							waiting.pending_value = std::move(*pending);
+							return std::unexpected(std::move(waiting));
+						}
+
+						value = (*pending)->get();
+					} else {
+						value = std::get<Variant>(result);
+					}
+
+					stack.resize(stack.size() - this_token.function_argument_count);
+					if (value.has_value()) {
+						stack.push_back(Token::from_variant(value));
+					}
+
+					break;
+				}
+
 				std::vector<Variant> arg_values;
 				if (this_token.function_argument_count > 0) {
 					for (const Token& token : func_args) {
@@ -860,3 +896,45 @@ ShuntedExpression ExpressionParserV2::tokenize_and_shunt_expression(const std::s
 
 	return ShuntedExpression(shunted);
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ByteVec Serializer<ShuntedExpression>::operator()(const ShuntedExpression& expression) {
+	Serializer<Uuid> suuid;
+	VectorSerializer<Token> stokens;
+
+	ByteVec result = suuid(expression.uuid);
+	ByteVec result2 = stokens(expression.tokens);
+	result.insert(result.end(), result2.begin(), result2.end());
+	return result;
+}
+
+ShuntedExpression Deserializer<ShuntedExpression>::operator()(const ByteVec& bytes, std::size_t& index) {
+	Deserializer<Uuid> dsuuid;
+	VectorDeserializer<Token> dstokens;
+
+	Uuid uuid = dsuuid(bytes, index);
+	ShuntedExpression result{dstokens(bytes, index)};
+	result.uuid = uuid;
+	return result;
+}
+
+void ShuntedExpression::collect_referenced_names(std::unordered_set<std::string>& names) const {
+	for (const Token& token : tokens) {
+		switch (token.type) {
+			case TokenType::LiteralString:
+			case TokenType::LiteralKnotName:
+			case TokenType::Function: {
+				if (token.value.has_value() && token.value.index() == Variant_String) {
+					names.insert(static_cast<std::string>(token.value));
+				}
+			} break;
+
+			case TokenType::Variable: {
+				names.insert(token.variable_name);
+			} break;
+
+			default: break;
+		}
+	}
+}
@@ -1,7 +1,10 @@
 #include "expression_parser/token.h"
 
+#include "ink_utils.h"
+
 #include <cmath>
 #include <algorithm>
+#include <bit>
 #include <format>
 
 #include <stdexcept>
@@ -73,13 +76,36 @@ void StoryVariableInfo::set_variable_value(const std::string& variable, const Va
 	}
 
 	if (auto variable_value = variables.find(final_var); variable_value != variables.end()) {
+		record_variable_change(variable_value->first, variable_value->second);
+		variables_hash ^= variable_hash(variable_value->first, variable_value->second) ^ variable_hash(variable_value->first, value);
 		variable_value->second = value;
-		flag_variable_changed(variable);
+		flag_variable_changed(final_var);
 	} else {
-		variables.emplace(variable, value);
+		store_global_variable(variable, value);
 	}
 }
 
+void StoryVariableInfo::store_global_variable(const std::string& variable, const Variant& value) {
+	auto [entry, inserted] = variables.try_emplace(variable, value);
+	if (!inserted) {
+		variables_hash ^= variable_hash(variable, entry->second);
+		entry->second = value;
+	}
+
+	variables_hash ^= variable_hash(variable, value);
+}
+
+void StoryVariableInfo::rehash_variables() {
+	variables_hash = 0;
+	for (const auto& [variable, value] : variables) {
+		variables_hash ^= variable_hash(variable, value);
+	}
+}
+
+std::uint64_t StoryVariableInfo::variable_hash(const std::string& variable, const Variant& value) {
+	return mix_hash(stable_hash(variable) ^ value.stable_hash());
+}
+
 void StoryVariableInfo::observe_variable(const std::string& variable_name, VariableObserverFunc callback) {
 	if (auto entry = observers.find(variable_name); entry != observers.end()) {
 		entry->second.push_back(callback);
@@ -110,6 +136,57 @@ void StoryVariableInfo::unobserve_variable(const std::string& variable_name, Var
 	}
 }
 
+void StoryVariableInfo::watch_variable_changes(const std::string& variable_name, VariableChangeObserver observer) {
+	change_watches[variable_name].observers.push_back(std::move(observer));
+}
+
+void StoryVariableInfo::unwatch_variable_changes(const std::string& variable_name) {
+	change_watches.erase(variable_name);
+	std::erase_if(changed_variables, [&variable_name](const auto& change) { return change.first == variable_name; });
+}
+
+void StoryVariableInfo::deliver_variable_changes() {
+	if (changed_variables.empty()) {
+		return;
+	}
+
+	// NOTE: taken out first, so a watcher that sets variables has them delivered next time rather than changing the list under us
+	std::vector<std::pair<std::string, Variant>> changes = std::move(changed_variables);
+	changed_variables.clear();
+	for (const auto& [variable, old_value] : changes) {
+		if (auto watch = change_watches.find(variable); watch != change_watches.end()) {
+			watch->second.changed = false;
+		}
+	}
+
+	for (const auto& [variable, old_value] : changes) {
+		auto watch = change_watches.find(variable);
+		auto value = variables.find(variable);
+		if (watch == change_watches.end() || value == variables.end()) {
+			continue;
+		}
+
+		const Variant& new_value = value->second;
+		if (old_value.index() == new_value.index() && static_cast<bool>(old_value == new_value)) {
+			continue;
+		}
+
+		for (const VariableChangeObserver& observer : watch->second.observers) {
+			observer(variable, old_value, new_value);
+		}
+	}
+}
+
+void StoryVariableInfo::discard_variable_changes() {
+	for (const auto& [variable, old_value] : changed_variables) {
+		if (auto watch = change_watches.find(variable); watch != change_watches.end()) {
+			watch->second.changed = false;
+		}
+	}
+
+	changed_variables.clear();
+}
+
 void StoryVariableInfo::execute_variable_observers(const std::string& variable, const Variant& new_value) {
 	if (auto entry = observers.find(variable); entry != observers.end()) {
 		for (VariableObserverFunc& observer : entry->second) {
@@ -155,16 +232,6 @@ void Token::store_variable_value(StoryVariableInfo& story_vars) {
 	}
 }
 
-void Token::fetch_function_value(const StoryVariableInfo& story_vars) {
-	if (type == TokenType::Function) {
-		if (auto builtin_func = story_vars.builtin_functions.find(value); builtin_func != story_vars.builtin_functions.end()) {
-			function = builtin_func->second.first;
-		} else if (auto external_func = story_vars.external_functions.find(value); external_func != story_vars.external_functions.end()) {
-			function = external_func->second;
-		}
-	}
-}
-
 void Token::increment(bool post, StoryVariableInfo& story_vars) {
 	value++;
 	store_variable_value(story_vars);
@@ -207,20 +274,30 @@ void Token::assign_variable(const Token& other, StoryVariableInfo& story_vars) {
 	}
 }
 
-Variant Token::call_function(const std::vector<Variant>& arguments, const StoryVariableInfo& story_variable_info) {
+Variant Token::call_function(const std::vector<Variant>& arguments, const StoryVariableInfo& story_variable_info) const {
 	if (type == TokenType::Function) {
 		switch (function_fetch_type) {
 			case FunctionFetchType::Builtin: {
+				// NOTE: functions bound by the story are looked up each time rather than stored here, since the token can be shared between stories
+				if (auto builtin_func = story_variable_info.builtin_functions.find(value); builtin_func != story_variable_info.builtin_functions.end()) {
+					return (builtin_func->second.first)(arguments);
+				}
+
 				return (function)(arguments);
 			} break;
 
 			case FunctionFetchType::External: {
-				// TODO: external functions
-				/*if (auto func = story_variable_info.deferred_functions.find(value); func != story_variable_info.deferred_functions.end()) {
-					return (func->second)(arguments);
-				} else {
-					throw std::runtime_error("Tried calling an unknown function");
-				}*/
+				ExternalResult result = call_external_function(arguments, story_variable_info);
+				if (const Variant* result_value = std::get_if<Variant>(&result)) {
+					return *result_value;
+				}
+
+				const std::shared_ptr<PendingValue>& pending = std::get<std::shared_ptr<PendingValue>>(result);
+				if (!pending->is_resolved()) {
+					throw std::runtime_error(std::format("External function '{}' can't be waited on here", static_cast<std::string>(value)));
+				}
+
+				return pending->get();
 			} break;
 
 			case FunctionFetchType::ListSubscript: {
@@ -253,6 +330,62 @@ Variant Token::call_function(const std::vector<Variant>& arguments, const StoryV
 	return Variant();
 }
 
+ExternalResult Token::call_external_function(const std::vector<Variant>& arguments, const StoryVariableInfo& story_variable_info) const {
+	auto function_entry = story_variable_info.external_functions.find(value);
+	if (function_entry == story_variable_info.external_functions.end() || !function_entry->second) {
+		throw std::runtime_error(std::format("External function '{}' was called without being bound", static_cast<std::string>(value)));
+	}
+
+	return (function_entry->second)(arguments);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PendingValue::resolve(const Variant& result) {
+	std::vector<std::function<void()>> to_call;
+	{
+		std::scoped_lock lock{mutex};
+		if (resolved) {
+			throw std::runtime_error("Resolved a pending external function value twice");
+		}
+
+		value = result;
+		resolved = true;
+		to_call = std::move(callbacks);
+	}
+
+	// NOTE: called without the lock held, so a callback can go straight on to read the value
+	for (std::function<void()>& callback : to_call) {
+		callback();
+	}
+}
+
+bool PendingValue::is_resolved() const {
+	std::scoped_lock lock{mutex};
+	return resolved;
+}
+
+Variant PendingValue::get() const {
+	std::scoped_lock lock{mutex};
+	if (!resolved) {
+		throw std::runtime_error("Tried to get a pending external function value before it was resolved");
+	}
+
+	return value;
+}
+
+void PendingValue::on_resolved(std::function<void()>&& callback) {
+	{
+		std::scoped_lock lock{mutex};
+		if (!resolved) {
+			callbacks.push_back(std::move(callback));
+			return;
+		}
+	}
+
+	callback();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 #define VCON(type) Variant::Variant(type val) : value(static_cast<i64>(val)), _has_value(true) {}
@@ -277,7 +410,7 @@ Variant::Variant(const InkList& val) : value(val), _has_value(true) {}
 
 #undef VCON
 
-Variant::Variant(const Variant& from) : value(from.value) {}
+Variant::Variant(const Variant& from) : value(from.value), _has_value(from._has_value) {}
 
 Variant& Variant::operator=(const Variant& from) {
 	if (this != &from) {
@@ -288,6 +421,31 @@ Variant& Variant::operator=(const Variant& from) {
 	return *this;
 }
 
+std::uint64_t Variant::stable_hash() const {
+	if (!_has_value) {
+		return mix_hash(0);
+	}
+
+	std::uint64_t payload = 0;
+	switch (value.index()) {
+		case Variant_Bool: payload = v<bool>(value); break;
+		case Variant_Int: payload = static_cast<std::uint64_t>(v<i64>(value)); break;
+		case Variant_Float: payload = std::bit_cast<std::uint64_t>(static_cast<double>(v<ink_float>(value))); break;
+		case Variant_String: payload = ::stable_hash(v<std::string>(value)); break;
+		default: payload = ::stable_hash(to_printable_string()); break;
+	}
+
+	return mix_hash(mix_hash(payload) ^ (value.index() + 1));
+}
+
+std::size_t Variant::heap_bytes() const {
+	switch (value.index()) {
+		case Variant_String: return v<std::string>(value).capacity();
+		case Variant_List: return v<InkList>(value).heap_bytes();
+		default: return 0;
+	}
+}
+
 std::string Variant::to_printable_string() const {
 	if (_has_value) {
 		switch (value.index()) {
@@ -1993,6 +2151,12 @@ ByteVec Serializer<Variant>::operator()(const Variant& variant) {
 				result.insert(result.end(), result2.begin(), result2.end());
 			} break;
 
+			case Variant_List: {
+				Serializer<InkList> s;
+				ByteVec result2 = s(variant);
+				result.insert(result.end(), result2.begin(), result2.end());
+			} break;
+
 			default: break;
 		}
 
@@ -2026,6 +2190,11 @@ Variant Deserializer<Variant>::operator()(const ByteVec& bytes, std::size_t& ind
 			return Variant(ds(bytes, index));
 		} break;
 
+		case Variant_List: {
+			Deserializer<InkList> ds;
+			return Variant(ds(bytes, index));
+		} break;
+
 		default: return Variant();
 	}
 }
@@ -2060,6 +2229,11 @@ ByteVec Serializer<Token>::operator()(const Token& token) {
 			result2 = s(token.value);
 		} break;
 
+		case TokenType::LiteralList: {
+			Serializer<InkList> s;
+			result2 = s(token.value);
+		} break;
+
 		case TokenType::Operator: {
 			result2.push_back(static_cast<std::uint8_t>(token.operator_type));
 			result2.push_back(static_cast<std::uint8_t>(token.operator_unary_type));
@@ -2127,6 +2301,11 @@ Token Deserializer<Token>::operator()(const ByteVec& bytes, std::size_t& index)
 			return type == TokenType::LiteralString ? Token::literal_string(value) : Token::literal_knotname(value, true);
 		} break;
 
+		case TokenType::LiteralList: {
+			Deserializer<InkList> dslist;
+			return Token::literal_list(dslist(bytes, index));
+		} break;
+
 		case TokenType::Operator: {
 			OperatorType op_type = static_cast<OperatorType>(ds8(bytes, index));
 			OperatorUnaryType unary_type = static_cast<OperatorUnaryType>(ds8(bytes, index));
@@ -2150,6 +2329,8 @@ Token Deserializer<Token>::operator()(const ByteVec& bytes, std::size_t& index)
 					return Token::function_builtin(name, nullptr, args);
 				case FunctionFetchType::External:
 					return Token::function_external(name, args);
+				case FunctionFetchType::ListSubscript:
+					return Token::function_list_subscript(name, args == 0);
 				case FunctionFetchType::StoryKnot:
 				default:
 					return Token::function_story_knot(name, args);
@@ -2167,5 +2348,119 @@ Token Deserializer<Token>::operator()(const ByteVec& bytes, std::size_t& index)
 	}	
 }
 
+namespace {
+	ByteVec serialize_variable_map(const std::unordered_map<std::string, Variant>& map) {
+		std::vector<std::string> names;
+		names.reserve(map.size());
+		for (const auto& entry : map) {
+			if (entry.second.has_value()) {
+				names.push_back(entry.first);
+			}
+		}
+
+		std::sort(names.begin(), names.end());
+
+		Serializer<std::uint16_t> ssize;
+		Serializer<std::string> sname;
+		Serializer<Variant> svalue;
+
+		ByteVec result = ssize(static_cast<std::uint16_t>(names.size()));
+		for (const std::string& name : names) {
+			ByteVec name_bytes = sname(name);
+			ByteVec value_bytes = svalue(map.at(name));
+			result.insert(result.end(), name_bytes.begin(), name_bytes.end());
+			result.insert(result.end(), value_bytes.begin(), value_bytes.end());
+		}
+
+		return result;
+	}
+
+	std::unordered_map<std::string, Variant> deserialize_variable_map(const ByteVec& bytes, std::size_t& index) {
+		Deserializer<std::uint16_t> dssize;
+		Deserializer<std::string> dsname;
+		Deserializer<Variant> dsvalue;
+
+		std::unordered_map<std::string, Variant> result;
+		std::uint16_t size = dssize(bytes, index);
+		result.reserve(size);
+		for (std::uint16_t i = 0; i < size; ++i) {
+			std::string name = dsname(bytes, index);
+			result.emplace(std::move(name), dsvalue(bytes, index));
+		}
+
+		return result;
+	}
+}
+
+ByteVec Serializer<StoryVariableInfo>::operator()(const StoryVariableInfo& variable_info) {
+	ByteVec result = serialize_variable_map(variable_info.variables);
+	ByteVec constants_bytes = serialize_variable_map(variable_info.constants);
+	result.insert(result.end(), constants_bytes.begin(), constants_bytes.end());
+
+	Serializer<InkListDefinitionMap> slists;
+	ByteVec lists_bytes = slists(variable_info.defined_lists);
+	result.insert(result.end(), lists_bytes.begin(), lists_bytes.end());
+
+	// NOTE: only the names and argument counts of functions can be stored; the actual functions get bound at runtime
+	std::vector<std::pair<std::string, std::uint8_t>> builtins;
+	builtins.reserve(variable_info.builtin_functions.size());
+	for (const auto& function : variable_info.builtin_functions) {
+		builtins.push_back({function.first, function.second.second});
+	}
+
+	std::sort(builtins.begin(), builtins.end());
+
+	Serializer<std::uint16_t> ssize;
+	Serializer<std::string> sstring;
+	ByteVec builtins_bytes = ssize(static_cast<std::uint16_t>(builtins.size()));
+	for (const auto& function : builtins) {
+		ByteVec name_bytes = sstring(function.first);
+		builtins_bytes.insert(builtins_bytes.end(), name_bytes.begin(), name_bytes.end());
+		builtins_bytes.push_back(function.second);
+	}
+
+	result.insert(result.end(), builtins_bytes.begin(), builtins_bytes.end());
+
+	std::vector<std::string> externals;
+	externals.reserve(variable_info.external_functions.size());
+	for (const auto& function : variable_info.external_functions) {
+		externals.push_back(function.first);
+	}
+
+	std::sort(externals.begin(), externals.end());
+
+	VectorSerializer<std::string> vsstring;
+	ByteVec externals_bytes = vsstring(externals);
+	result.insert(result.end(), externals_bytes.begin(), externals_bytes.end());
+
+	return result;
+}
+
+StoryVariableInfo Deserializer<StoryVariableInfo>::operator()(const ByteVec& bytes, std::size_t& index) {
+	StoryVariableInfo result;
+	result.variables = deserialize_variable_map(bytes, index);
+	result.constants = deserialize_variable_map(bytes, index);
+
+	Deserializer<InkListDefinitionMap> dslists;
+	result.defined_lists = dslists(bytes, index);
+
+	Deserializer<std::uint16_t> dssize;
+	Deserializer<std::uint8_t> ds8;
+	Deserializer<std::string> dsstring;
+	std::uint16_t builtin_count = dssize(bytes, index);
+	for (std::uint16_t i = 0; i < builtin_count; ++i) {
+		std::string name = dsstring(bytes, index);
+		std::uint8_t argument_count = ds8(bytes, index);
+		result.builtin_functions.emplace(std::move(name), std::make_pair(InkFunction(), argument_count));
+	}
+
+	VectorDeserializer<std::string> vdsstring;
+	for (const std::string& name : vdsstring(bytes, index)) {
+		result.external_functions.emplace(name, ExternalFunction());
+	}
+
+	return result;
+}
+
 #undef i64
 #undef v
@@ -27,13 +27,29 @@
 #include <sstream>
 #include <algorithm>
 #include <list>
+#include <deque>
+#include <iterator>
+#include <string_view>
+#include <array>
+#include <bit>
+#include <chrono>
+
+#ifndef INKB_VERSION
+#define INKB_VERSION 3
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 #include <iostream>
 #include <format>
 #include <stdexcept>
 
 namespace {
-	static const std::unordered_map<char, InkToken> TokenChars = {
+	constexpr std::pair<char, InkToken> TokenChars[] = {
 		{'/', InkToken::Slash},
 		{'\\', InkToken::Backslash},
 
@@ -58,12 +74,21 @@ namespace {
 		{',', InkToken::Comma},
 	};
 
+	constexpr std::array<InkToken, 256> TokenCharTable = []() {
+		std::array<InkToken, 256> table{};
+		for (const auto& token_char : TokenChars) {
+			table[static_cast<std::uint8_t>(token_char.first)] = token_char.second;
+		}
+
+		return table;
+	}();
+
 	struct KeywordEntry {
 		InkToken token;
 		bool must_be_at_line_start;
 	};
 
-	static const std::unordered_map<std::string, KeywordEntry> TokenKeywords = {
+	constexpr std::pair<std::string_view, KeywordEntry> TokenKeywords[] = {
 		{"VAR", {InkToken::KeywordVar, true}},
 		{"CONST", {InkToken::KeywordConst, true}},
 		{"function", {InkToken::KeywordFunction, false}},
@@ -72,7 +97,7 @@ namespace {
 		{"EXTERNAL", {InkToken::KeywordExternal, true}},
 	};
 
-	char next_char(const std::string& script_text, size_t index) {
+	char next_char(std::string_view script_text, size_t index) {
 		if (index + 1 < script_text.length()) {
 			return script_text[index + 1];
 		} else {
@@ -80,50 +105,250 @@ namespace {
 		}
 	}
 
-	const InkLexer::Token last_token(const std::vector<InkLexer::Token>& tokens) {
-		return !tokens.empty() ? tokens.back() : InkLexer::Token();
+	constexpr std::size_t MaxKeywordLength = 8;
+
+	constexpr std::array<bool, 256> KeywordInitialTable = []() {
+		std::array<bool, 256> table{};
+		for (const auto& keyword : TokenKeywords) {
+			table[static_cast<std::uint8_t>(keyword.first[0])] = true;
+		}
+
+		return table;
+	}();
+
+	// Bytes that can end a run of prose; anything else is appended to the current text as-is
+	constexpr char SignificantBytes[] = {
+		'\n', '\\', '*', '+', '-', '=', '{', '}', '[', ']', '#', '/', '~', '<', '>', '|', ':', '(', ')', '&', '!', ',',
+	};
+
+	constexpr std::array<bool, 256> SignificantByteTable = []() {
+		std::array<bool, 256> table{};
+		for (char chr : SignificantBytes) {
+			table[static_cast<std::uint8_t>(chr)] = true;
+		}
+
+		return table;
+	}();
+
+	std::size_t find_significant_byte_scalar(std::string_view text, std::size_t index) {
+		while (index < text.length() && !SignificantByteTable[static_cast<std::uint8_t>(text[index])]) {
+			++index;
+		}
+
+		return index;
 	}
 
-	void try_add_text_token(std::vector<InkLexer::Token>& result, const std::string& text, bool& currently_escaped) {
-		InkLexer::Token text_token{InkToken::Text, text};
-		text_token.escaped = currently_escaped;
-		if (!text_token.text_contents.empty()) {
+#if defined(__AVX2__)
+	std::size_t find_significant_byte(std::string_view text, std::size_t index) {
+		const char* data = text.data();
+		while (index + 32 <= text.length()) {
+			__m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + index));
+			__m256i matches = _mm256_setzero_si256();
+			for (char chr : SignificantBytes) {
+				matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(chr)));
+			}
+
+			if (std::uint32_t mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(matches)); mask != 0) {
+				return index + std::countr_zero(mask);
+			}
+
+			index += 32;
+		}
+
+		return find_significant_byte_scalar(text, index);
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	std::size_t find_significant_byte(std::string_view text, std::size_t index) {
+		const char* data = text.data();
+		while (index + 16 <= text.length()) {
+			__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + index));
+			__m128i matches = _mm_setzero_si128();
+			for (char chr : SignificantBytes) {
+				matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(chr)));
+			}
+
+			if (std::uint32_t mask = static_cast<std::uint32_t>(_mm_movemask_epi8(matches)); mask != 0) {
+				return index + std::countr_zero(mask);
+			}
+
+			index += 16;
+		}
+
+		return find_significant_byte_scalar(text, index);
+	}
+#else
+	std::size_t find_significant_byte(std::string_view text, std::size_t index) {
+		return find_significant_byte_scalar(text, index);
+	}
+#endif
+
+	const KeywordEntry* find_keyword(std::string_view text) {
+		// NOTE: same rules as strip_string_edges(text, true, true, true), without building a new string for every character
+		std::size_t first = 0;
+		while (first < text.length() && text[first] <= ' ') {
+			++first;
+		}
+
+		std::size_t last = text.length();
+		while (last > first && text[last - 1] <= ' ') {
+			--last;
+		}
+
+		std::string_view stripped = text.substr(first, last - first);
+		for (const auto& keyword : TokenKeywords) {
+			if (keyword.first == stripped) {
+				return &keyword.second;
+			}
+		}
+
+		return nullptr;
+	}
+
+	// A run of text in the script; a slice of the source until an escape sequence forces it to be copied
+	class TextRun {
+		std::string_view source;
+		std::size_t start = 0;
+		std::size_t length = 0;
+		std::string escaped_text;
+		bool escaped = false;
+
+	public:
+		explicit TextRun(std::string_view source) : source{source} {}
+
+		bool empty() const { return escaped ? escaped_text.empty() : length == 0; }
+		bool is_escaped() const { return escaped; }
+		std::string_view view() const { return escaped ? std::string_view(escaped_text) : source.substr(start, length); }
+		std::string take_escaped_text() { return std::move(escaped_text); }
+
+		void append(std::size_t index) {
+			if (escaped) {
+				escaped_text += source[index];
+			} else {
+				if (length == 0) {
+					start = index;
+				}
+
+				++length;
+			}
+		}
+
+		void append_range(std::size_t from, std::size_t to) {
+			if (escaped) {
+				escaped_text.append(source.substr(from, to - from));
+			} else {
+				if (length == 0) {
+					start = from;
+				}
+
+				length += to - from;
+			}
+		}
+
+		// whether the trimmed text is already too long to ever turn into a keyword
+		bool past_keywords() const {
+			std::string_view text = view();
+			std::size_t first = 0;
+			while (first < text.length() && text[first] <= ' ') {
+				++first;
+			}
+
+			if (first < text.length() && !KeywordInitialTable[static_cast<std::uint8_t>(text[first])]) {
+				return true;
+			}
+
+			std::size_t last = text.length();
+			while (last > first && text[last - 1] <= ' ') {
+				--last;
+			}
+
+			return last - first > MaxKeywordLength;
+		}
+
+		void append_escaped(char chr) {
+			if (!escaped) {
+				escaped_text.assign(source.substr(start, length));
+				escaped = true;
+			}
+
+			escaped_text += chr;
+		}
+
+		void clear() {
+			length = 0;
+			escaped_text.clear();
+			escaped = false;
+		}
+	};
+
+	bool try_add_text_token(std::vector<InkLexer::Token>& result, TextRun& text, bool& currently_escaped, std::deque<std::string>& escaped_texts) {
+		bool added = false;
+		if (!text.empty()) {
+			std::string_view contents = text.is_escaped() ? std::string_view(escaped_texts.emplace_back(text.take_escaped_text())) : text.view();
+			InkLexer::Token text_token{InkToken::Text, contents};
+			text_token.escaped = currently_escaped;
 			result.push_back(text_token);
 			currently_escaped = false;
+			added = true;
 		}
+
+		text.clear();
+		return added;
 	}
 }
 
-std::vector<InkLexer::Token> InkLexer::lex_script(const std::string& script_text) {
+std::vector<InkLexer::Token> InkLexer::lex_script(std::string_view script_text) {
 	std::vector<Token> result;
+	result.reserve(script_text.length() / 4);
+	escaped_texts.clear();
 
 	std::size_t index = 0;
-	std::string current_text;
-	current_text.reserve(50);
+	TextRun current_text{script_text};
 	bool current_text_escaped = false;
 	bool any_tokens_this_line = false;
 	bool at_line_start = true;
 
+	// NOTE: comments are dropped as they're found, but the token before them still counts as "the last token" for the rules below
+	InkToken last_token = InkToken::INVALID;
+
 	while (index < script_text.length()) {
 		Token this_token;
 		bool end_text = true;
 		char chr = script_text[index];
 
-		this_token.text_contents = chr;
+		this_token.text_contents = script_text.substr(index, 1);
 		switch (chr) {
 			case '\n': {
-				if (last_token(result).token != InkToken::NewLine || !current_text.empty()) {
+				if (last_token != InkToken::NewLine || !current_text.empty()) {
 					this_token.token = InkToken::NewLine;
 					at_line_start = true;
 				}
 			} break;
 
 			case '\\': {
-				current_text += next_char(script_text, index);
+				current_text.append_escaped(next_char(script_text, index));
 				current_text_escaped = true;
 				++index;
 			} break;
 
+			case '/': {
+				if (char next = next_char(script_text, index); next == '/' || next == '*') {
+					try_add_text_token(result, current_text, current_text_escaped, escaped_texts);
+					if (next == '/') {
+						index = std::min(script_text.find('\n', index + 2), script_text.length());
+					} else {
+						std::size_t comment_end = script_text.find("*/", index + 2);
+						index = comment_end != std::string_view::npos ? comment_end + 2 : script_text.length();
+						any_tokens_this_line = true;
+						at_line_start = false;
+					}
+
+					last_token = InkToken::Slash;
+					continue;
+				}
+
+				this_token.token = InkToken::Slash;
+			} break;
+
 			case '*':
 			case '+': {
 				if (at_line_start) {
@@ -157,7 +382,7 @@ std::vector<InkLexer::Token> InkLexer::lex_script(const std::string& script_text
 			case '-': {
 				if (next_char(script_text, index) == '>') {
 					this_token.token = InkToken::Arrow;
-					this_token.text_contents = "->";
+					this_token.text_contents = script_text.substr(index, 2);
 					++index;
 				} else if (at_line_start) {
 					this_token.token = InkToken::Dash;
@@ -195,45 +420,56 @@ std::vector<InkLexer::Token> InkLexer::lex_script(const std::string& script_text
 					this_token.token = InkToken::BackArrow;
 					++index;
 				} else {
-					current_text += '<';
+					current_text.append(index);
 					end_text = false;
 				}
 			} break;
 
 			case '!': {
-				if (last_token(result).token == InkToken::LeftBrace) {
+				if (last_token == InkToken::LeftBrace) {
 				this_token.token = InkToken::Bang;
 				} else {
-					current_text += '!';
+					current_text.append(index);
 					end_text = false;
 				}
 			} break;
 
 			default: {
-				if (auto token_char = TokenChars.find(chr); token_char != TokenChars.end()) {
-					this_token.token = token_char->second;
+				if (InkToken token_char = TokenCharTable[static_cast<std::uint8_t>(chr)]; token_char != InkToken::INVALID) {
+					this_token.token = token_char;
 				} else if (any_tokens_this_line || !current_text.empty() || chr > ' ') {
-					current_text += chr;
+					current_text.append(index);
 					end_text = false;
 					at_line_start = false;
+
+					// fast path for prose: once the text can't become a keyword, take everything up to the next byte that matters in one go
+					if (current_text.past_keywords()) {
+						std::size_t run_end = find_significant_byte(script_text, index + 1);
+						current_text.append_range(index + 1, run_end);
+						index = run_end - 1;
+					}
 				}
 			} break;
 		}
 
-		if (auto keyword_token = TokenKeywords.find(strip_string_edges(current_text, true, true, true)); keyword_token != TokenKeywords.end()) {
-			if (!any_tokens_this_line || !keyword_token->second.must_be_at_line_start) {
-				this_token.token = keyword_token->second.token;
-				current_text.clear();
+		if (!current_text.empty()) {
+			if (const KeywordEntry* keyword = find_keyword(current_text.view()); keyword) {
+				if (!any_tokens_this_line || !keyword->must_be_at_line_start) {
+					this_token.token = keyword->token;
+					current_text.clear();
+				}
 			}
 		}
 
 		if (end_text) {
-			try_add_text_token(result, current_text, current_text_escaped);
-			current_text.clear();
+			if (try_add_text_token(result, current_text, current_text_escaped, escaped_texts)) {
+				last_token = InkToken::Text;
+			}
 		}
 
 		if (this_token.token != InkToken::INVALID) {
 			result.push_back(this_token);
+			last_token = this_token.token;
 			any_tokens_this_line = this_token.token != InkToken::NewLine;
 			at_line_start = this_token.token == InkToken::NewLine;;
 		}
@@ -241,13 +477,195 @@ std::vector<InkLexer::Token> InkLexer::lex_script(const std::string& script_text
 		++index;
 	}
 
-	try_add_text_token(result, current_text, current_text_escaped);
+	try_add_text_token(result, current_text, current_text_escaped, escaped_texts);
 
 	return result;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+namespace {
+	constexpr std::uint8_t KnotCacheVersion = 2;
+
+	constexpr std::uint64_t HashOffsetBasis = 14695981039346656037ULL;
+	constexpr std::uint64_t HashPrime = 1099511628211ULL;
+
+	// FNV-1a, which is stable across platforms and runs, unlike std::hash
+	std::uint64_t hash_bytes(std::uint64_t hash, const void* data, std::size_t length) {
+		const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+		for (std::size_t i = 0; i < length; ++i) {
+			hash ^= bytes[i];
+			hash *= HashPrime;
+		}
+
+		return hash;
+	}
+
+	bool is_line_start(const std::vector<InkLexer::Token>& tokens, std::size_t index) {
+		if (index == 0 || tokens[index - 1].token == InkToken::NewLine) {
+			return true;
+		}
+
+		const InkLexer::Token& previous = tokens[index - 1];
+		return previous.token == InkToken::Text && !previous.escaped && strip_string_edges(previous.text_contents, true, true, true).empty()
+			&& (index == 1 || tokens[index - 2].token == InkToken::NewLine);
+	}
+
+	bool is_knot_header(const std::vector<InkLexer::Token>& tokens, std::size_t index) {
+		return tokens[index].token == InkToken::Equal && index + 1 < tokens.size() && tokens[index + 1].token == InkToken::Equal && is_line_start(tokens, index);
+	}
+
+	std::string get_knot_header_name(const std::vector<InkLexer::Token>& tokens, std::size_t index) {
+		while (index < tokens.size() && tokens[index].token == InkToken::Equal) {
+			++index;
+		}
+
+		if (index < tokens.size() && tokens[index].token == InkToken::KeywordFunction) {
+			++index;
+		}
+
+		return index < tokens.size() && tokens[index].token == InkToken::Text ? strip_string_edges(tokens[index].text_contents, true, true, true) : std::string();
+	}
+
+	// sorted, so they hash and are written out the same way whatever order they were declared in
+	std::vector<std::string> get_external_names(const ExpressionParserV2::StoryVariableInfo& variable_info) {
+		std::vector<std::string> result;
+		result.reserve(variable_info.external_functions.size());
+		for (const auto& function : variable_info.external_functions) {
+			result.push_back(function.first);
+		}
+
+		std::sort(result.begin(), result.end());
+		return result;
+	}
+}
+
+void InkKnotCache::load(const std::string& path) {
+	entries.clear();
+	used_entries.clear();
+	next_uuid = 1;
+	reused_count = 0;
+	compiled_count = 0;
+
+	std::ifstream infile{path, std::ios::binary | std::ios::ate};
+	if (!infile.is_open()) {
+		return;
+	}
+
+	ByteVec bytes(static_cast<std::size_t>(infile.tellg()));
+	infile.seekg(0);
+	infile.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	if (bytes.size() < 14 || bytes[0] != 'I' || bytes[1] != 'N' || bytes[2] != 'K' || bytes[3] != 'C' || bytes[4] != INKB_VERSION || bytes[5] != KnotCacheVersion) {
+		return;
+	}
+
+	Deserializer<std::uint8_t> ds8;
+	Deserializer<std::uint32_t> ds32;
+	Deserializer<std::uint64_t> ds64;
+	VectorDeserializer<std::string> dsstrings;
+
+	std::size_t index = 6;
+	auto read_block = [&bytes, &index, &ds32](ByteVec& block) {
+		if (index + 4 > bytes.size()) {
+			return false;
+		}
+
+		std::uint32_t size = ds32(bytes, index);
+		if (index + size > bytes.size()) {
+			return false;
+		}
+
+		block.assign(bytes.begin() + index, bytes.begin() + index + size);
+		index += size;
+		return true;
+	};
+
+	UuidValue cached_next_uuid = ds32(bytes, index);
+	std::uint32_t entry_count = ds32(bytes, index);
+	for (std::uint32_t i = 0; i < entry_count; ++i) {
+		// NOTE: 8 byte key, 2 uuid values, and the content flag
+		if (index + 17 > bytes.size()) {
+			entries.clear();
+			return;
+		}
+
+		std::uint64_t key = ds64(bytes, index);
+
+		Entry entry;
+		entry.uuid_base = ds32(bytes, index);
+		entry.uuid_count = ds32(bytes, index);
+		entry.has_content = static_cast<bool>(ds8(bytes, index));
+		ByteVec external_bytes;
+		if (!read_block(entry.knot_bytes) || !read_block(entry.list_bytes) || !read_block(external_bytes)) {
+			entries.clear();
+			return;
+		}
+
+		if (!external_bytes.empty()) {
+			std::size_t external_index = 0;
+			entry.external_names = dsstrings(external_bytes, external_index);
+		}
+
+		entries.insert({key, std::move(entry)});
+	}
+
+	next_uuid = cached_next_uuid;
+}
+
+void InkKnotCache::save(const std::string& path) const {
+	Serializer<std::uint8_t> s8;
+	Serializer<std::uint32_t> s32;
+	Serializer<std::uint64_t> s64;
+	VectorSerializer<std::string> sstrings;
+
+	ByteVec result = {'I', 'N', 'K', 'C', INKB_VERSION, KnotCacheVersion};
+	auto append = [&result](const ByteVec& bytes) { result.insert(result.end(), bytes.begin(), bytes.end()); };
+
+	append(s32(next_uuid));
+	append(s32(static_cast<std::uint32_t>(used_entries.size())));
+
+	// NOTE: only entries used by the last compile are kept, so the cache doesn't grow with every edit
+	for (const auto& [key, entry] : used_entries) {
+		append(s64(key));
+		append(s32(entry.uuid_base));
+		append(s32(entry.uuid_count));
+		append(s8(static_cast<std::uint8_t>(entry.has_content)));
+		append(s32(static_cast<std::uint32_t>(entry.knot_bytes.size())));
+		append(entry.knot_bytes);
+		append(s32(static_cast<std::uint32_t>(entry.list_bytes.size())));
+		append(entry.list_bytes);
+
+		ByteVec external_bytes = entry.external_names.empty() ? ByteVec() : sstrings(entry.external_names);
+		append(s32(static_cast<std::uint32_t>(external_bytes.size())));
+		append(external_bytes);
+	}
+
+	std::ofstream outfile{path, std::ios::binary};
+	outfile.write(reinterpret_cast<const char*>(result.data()), static_cast<std::streamsize>(result.size()));
+}
+
+const InkKnotCache::Entry* InkKnotCache::find(std::uint64_t key) const {
+	// NOTE: a key that was already used this compile has had its uuids given out, so a second identical section can't share them
+	if (used_entries.contains(key)) {
+		return nullptr;
+	}
+
+	auto entry = entries.find(key);
+	return entry != entries.end() ? &entry->second : nullptr;
+}
+
+void InkKnotCache::store(std::uint64_t key, const Entry& entry, bool reused) {
+	used_entries.insert_or_assign(key, entry);
+	next_uuid = std::max(next_uuid, entry.uuid_base + entry.uuid_count);
+	if (reused) {
+		++reused_count;
+	} else {
+		++compiled_count;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 InkStory InkCompiler::compile_script(const std::string& script) {
 	InkStoryData* story_data = compile(script);
 	return InkStory(story_data);
@@ -266,13 +684,14 @@ InkStory InkCompiler::compile_file(const std::string& file_path)
 }
 
 void InkCompiler::save_data_to_file(InkStoryData* story_data, const std::string& out_file_path) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
 	std::ofstream outfile{out_file_path, std::ios::binary};
 	std::vector<std::uint8_t> bytes = story_data->get_serialized_bytes();
-	for (std::uint8_t byte : bytes) {
-		outfile << byte;
-	}
-
+	outfile.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
 	outfile.close();
+
+	phase_timings.serialize = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
 void InkCompiler::compile_script_to_file(const std::string& script, const std::string& out_file_path) {
@@ -293,6 +712,85 @@ void InkCompiler::compile_file_to_file(const std::string& in_file_path, const st
 	delete story_data;
 }
 
+InkCompiler::~InkCompiler() {
+	discard_pending_includes();
+}
+
+InkCompiler::IncludeResult InkCompiler::compile_include(const std::string& path, std::shared_ptr<std::counting_semaphore<>> workers) {
+	std::ifstream infile{path};
+	std::stringstream buffer;
+	buffer << infile.rdbuf();
+	std::string file_text = buffer.str();
+	infile.close();
+
+	InkCompiler include_compiler;
+	include_compiler.include_workers = workers;
+	include_compiler.merge_adjacent = false;
+
+	IncludeResult result;
+	result.story_data = include_compiler.compile(file_text);
+	result.uuid_count = include_compiler.get_current_uuid();
+	return result;
+}
+
+void InkCompiler::start_includes(const std::vector<InkLexer::Token>& tokens) {
+	for (std::size_t i = 0; i < tokens.size(); ++i) {
+		if (tokens[i].token != InkToken::KeywordInclude) {
+			continue;
+		}
+
+		std::string path;
+		for (++i; i < tokens.size() && tokens[i].token != InkToken::NewLine; ++i) {
+			path += tokens[i].get_text_contents();
+		}
+
+		path = strip_string_edges(path, true, true, true);
+
+		// NOTE: without a free worker, the include is compiled on this thread once the parser reaches it, same as it always was
+		bool on_worker = include_workers && include_workers->try_acquire();
+		auto task = [path, workers = include_workers, on_worker]() {
+			try {
+				IncludeResult result = compile_include(path, workers);
+				if (on_worker) {
+					workers->release();
+				}
+
+				return result;
+			} catch (...) {
+				if (on_worker) {
+					workers->release();
+				}
+
+				throw;
+			}
+		};
+
+		pending_includes.push_back({path, std::async(on_worker ? std::launch::async : std::launch::deferred, std::move(task))});
+	}
+}
+
+InkCompiler::IncludeResult InkCompiler::take_include(const std::string& path) {
+	if (!pending_includes.empty() && pending_includes.front().path == path) {
+		std::future<IncludeResult> result = std::move(pending_includes.front().result);
+		pending_includes.pop_front();
+		return result.get();
+	}
+
+	return compile_include(path, include_workers);
+}
+
+void InkCompiler::discard_pending_includes() {
+	for (PendingInclude& include : pending_includes) {
+		if (include.result.valid() && include.result.wait_for(std::chrono::seconds(0)) != std::future_status::deferred) {
+			try {
+				delete include.result.get().story_data;
+			} catch (...) {}
+		}
+	}
+
+	pending_includes.clear();
+}
+
 void InkCompiler::init_compiler() {
 	token_index = 0;
 	last_token_object = nullptr;
@@ -307,15 +805,149 @@ void InkCompiler::init_compiler() {
 	choice_stack.clear();
 
 	current_sequence_index = 0;
+	cache_section = CacheSection();
+	cache_context_hash = 0;
+
+	discard_pending_includes();
+	if (max_threads > 1 && !include_workers) {
+		include_workers = std::make_shared<std::counting_semaphore<>>(static_cast<std::ptrdiff_t>(max_threads - 1));
+	}
+}
+
+namespace {
+	std::size_t count_objects(const Knot& knot) {
+		std::size_t result = knot.objects.size();
+		for (InkObject* object : knot.objects) {
+			for (Knot* nested_knot : object->get_nested_knots()) {
+				result += count_objects(*nested_knot);
+			}
+		}
+
+		return result;
+	}
+
+	bool can_merge_objects(const InkObject* previous, const InkObject* object, bool in_function) {
+		switch (object->get_id()) {
+			case ObjectId::LineBreak: {
+				// NOTE: a line break can never be stopped before, so one straight after text runs as part of it, and a second one in a row does nothing
+				return previous->get_id() == ObjectId::Text || previous->ends_line();
+			}
+
+			case ObjectId::Glue: {
+				return previous->get_id() == ObjectId::Glue;
+			}
+
+			case ObjectId::Text: {
+				// NOTE: text with visible contents is always the first place a line can stop, so whatever text follows it can be joined onto it.
+				// inside functions, where a line stops also depends on whether the function has output anything yet, so they're left alone
+				return !in_function && previous->get_id() == ObjectId::Text && !previous->ends_line() && previous->has_any_contents(true);
+			}
+
+			default: {
+				return false;
+			}
+		}
+	}
+
+	void merge_adjacent_objects(Knot& knot, bool in_function) {
+		// objects that stitches, gather points or choice labels start at have to stay where they are
+		std::vector<std::uint16_t*> indices;
+		for (Stitch& stitch : knot.stitches) {
+			indices.push_back(&stitch.index);
+			for (GatherPoint& gather_point : stitch.gather_points) {
+				indices.push_back(&gather_point.index);
+			}
+		}
+
+		for (GatherPoint& gather_point : knot.gather_points) {
+			indices.push_back(&gather_point.index);
+		}
+
+		for (InkObject* object : knot.objects) {
+			if (object->get_id() == ObjectId::Choice) {
+				for (GatherPoint* label : static_cast<InkObjectChoice*>(object)->get_choice_labels()) {
+					indices.push_back(&label->index);
+				}
+			}
+		}
+
+		std::unordered_set<std::uint16_t> targets;
+		for (std::uint16_t* index : indices) {
+			targets.insert(*index);
+		}
+
+		std::vector<std::uint16_t> new_indices(knot.objects.size() + 1);
+		std::vector<InkObject*> merged_objects;
+		merged_objects.reserve(knot.objects.size());
+		for (std::size_t i = 0; i < knot.objects.size(); ++i) {
+			InkObject* object = knot.objects[i];
+			if (!merged_objects.empty() && !targets.contains(static_cast<std::uint16_t>(i)) && can_merge_objects(merged_objects.back(), object, in_function)) {
+				if (object->get_id() == ObjectId::Text) {
+					static_cast<InkObjectText*>(merged_objects.back())->append_text(static_cast<InkObjectText*>(object)->get_text_contents());
+				} else if (object->get_id() == ObjectId::LineBreak && merged_objects.back()->get_id() == ObjectId::Text) {
+					static_cast<InkObjectText*>(merged_objects.back())->set_ends_line(true);
+				}
+
+				delete object;
+				new_indices[i] = static_cast<std::uint16_t>(merged_objects.size() - 1);
+				continue;
+			}
+
+			new_indices[i] = static_cast<std::uint16_t>(merged_objects.size());
+			merged_objects.push_back(object);
+		}
+
+		new_indices.back() = static_cast<std::uint16_t>(merged_objects.size());
+		for (std::uint16_t* index : indices) {
+			if (*index < new_indices.size()) {
+				*index = new_indices[*index];
+			}
+		}
+
+		knot.objects = std::move(merged_objects);
+		for (InkObject* object : knot.objects) {
+			for (Knot* nested_knot : object->get_nested_knots()) {
+				merge_adjacent_objects(*nested_knot, in_function);
+			}
+		}
+	}
+}
+
+void InkCompiler::merge_objects(InkStoryData* story_data) {
+	merged_object_counts = ObjectCounts();
+	for (auto& knot : story_data->knots) {
+		merged_object_counts.before += count_objects(knot.second);
+		merge_adjacent_objects(knot.second, knot.second.is_function);
+		merged_object_counts.after += count_objects(knot.second);
+	}
 }
 
 InkStoryData* InkCompiler::compile(const std::string& script)
 {
 	init_compiler();
+	phase_timings = PhaseTimings();
+	std::chrono::steady_clock::time_point phase_start = std::chrono::steady_clock::now();
+
+	compile_arenas.clear();
+	compile_arenas.push_back(std::make_unique<InkObjectArena>(std::max<std::size_t>(script.size() * 2, 1024)));
+	InkObject::ArenaScope arena_scope{compile_arenas.front().get()};
 
 	InkLexer lexer;
 	std::vector<InkLexer::Token> token_stream = lexer.lex_script(script);
-	token_stream = remove_comments(token_stream);
+
+	std::chrono::steady_clock::time_point lex_end = std::chrono::steady_clock::now();
+	phase_timings.lex = std::chrono::duration<double, std::milli>(lex_end - phase_start).count();
+	phase_start = lex_end;
+
+	start_includes(token_stream);
+
+	std::vector<std::size_t> cache_sections;
+	std::size_t next_cache_section = 0;
+	if (!knot_cache_path.empty()) {
+		knot_cache.load(knot_cache_path);
+		cache_sections = find_knot_sections(token_stream);
+		current_uuid = 0;
+	}
 
 	std::vector<Knot> result_knots;// = {{"_S", {}, {}}};
 	Knot start_knot;
@@ -345,6 +977,21 @@ InkStoryData* InkCompiler::compile(const std::string& script)
 
 	token_index = 0;
 	while (token_index < token_stream.size()) {
+		if (next_cache_section < cache_sections.size() && token_index >= cache_sections[next_cache_section]) {
+			finish_cache_section(result_knots);
+
+			// NOTE: if compiling the last section ran past where this one should have started, the two have been compiled as one and this one can't be cached
+			bool aligned = token_index == cache_sections[next_cache_section];
+			while (next_cache_section < cache_sections.size() && cache_sections[next_cache_section] <= token_index) {
+				++next_cache_section;
+			}
+
+			std::size_t section_end = next_cache_section < cache_sections.size() ? cache_sections[next_cache_section] : token_stream.size();
+			if (begin_cache_section(token_stream, section_end, aligned, result_knots)) {
+				continue;
+			}
+		}
+
 		const InkLexer::Token& this_token = token_stream[token_index];
 		if (InkObject* this_token_object = compile_token(token_stream, this_token, result_knots)) {
 			Knot& current_knot = result_knots[current_knot_index];
@@ -388,10 +1035,201 @@ InkStoryData* InkCompiler::compile(const std::string& script)
 		++token_index;
 	}
 
+	discard_pending_includes();
+
+	if (!knot_cache_path.empty()) {
+		finish_cache_section(result_knots);
+		knot_cache.save(knot_cache_path);
+	}
+
 	InkStoryData* result = new InkStoryData(result_knots, std::move(story_variable_info));
+	result->object_arenas = std::move(compile_arenas);
+	compile_arenas.clear();
+
+	stripped_knots.clear();
+	if (strip_unreachable) {
+		try {
+			stripped_knots = result->remove_unreachable_knots(entry_points);
+		} catch (...) {
+			delete result;
+			throw;
+		}
+	}
+
+	if (merge_adjacent) {
+		merge_objects(result);
+	}
+
+	phase_timings.compile = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - phase_start).count();
+
 	return result;
 }
 
+std::vector<std::size_t> InkCompiler::find_knot_sections(const std::vector<InkLexer::Token>& tokens) {
+	// NOTE: the first section is everything before the first knot header, which is compiled into the start knot
+	std::vector<std::size_t> result = {0};
+	for (std::size_t i = 1; i < tokens.size(); ++i) {
+		if (is_knot_header(tokens, i)) {
+			std::size_t start = tokens[i - 1].token == InkToken::Text ? i - 1 : i;
+			if (start > result.back()) {
+				result.push_back(start);
+			}
+		}
+	}
+
+	return result;
+}
+
+bool InkCompiler::begin_cache_section(const std::vector<InkLexer::Token>& tokens, std::size_t section_end, bool aligned, std::vector<Knot>& story_knots) {
+	std::size_t header_index = token_index;
+	if (header_index < section_end && tokens[header_index].token == InkToken::Text) {
+		++header_index;
+	}
+
+	cache_section = CacheSection();
+	cache_section.active = true;
+	cache_section.is_knot = header_index < section_end && is_knot_header(tokens, header_index);
+	cache_section.knot_count = story_knots.size();
+
+	bool has_include = false;
+	bool cacheable = aligned && (cache_section.is_knot || story_knots.size() == 1);
+	std::uint64_t key = HashOffsetBasis;
+	for (std::size_t i = token_index; i < section_end; ++i) {
+		const InkLexer::Token& token = tokens[i];
+		if (token.token == InkToken::KeywordInclude) {
+			has_include = true;
+			cacheable = false;
+		} else if (token.token == InkToken::KeywordList) {
+			cache_section.has_lists = true;
+		} else if (token.token == InkToken::KeywordExternal) {
+			cache_section.has_externals = true;
+		}
+
+		std::uint8_t header[3] = {static_cast<std::uint8_t>(token.token), token.count, static_cast<std::uint8_t>(token.escaped)};
+		std::uint32_t length = static_cast<std::uint32_t>(token.text_contents.length());
+		key = hash_bytes(key, header, sizeof(header));
+		key = hash_bytes(key, &length, sizeof(length));
+		key = hash_bytes(key, token.text_contents.data(), token.text_contents.length());
+	}
+
+	// how a knot compiles also depends on the lists, functions and EXTERNAL functions declared before it
+	key = hash_bytes(key, &cache_context_hash, sizeof(cache_context_hash));
+	if (cache_section.has_lists) {
+		cache_context_hash = key;
+	}
+
+	// NOTE: a call to an EXTERNAL function is tokenized differently from one to a knot, so the key is made from the names that
+	// are actually declared, which also covers ones that came from an INCLUDE'd file
+	std::vector<std::string> external_names = get_external_names(story_variable_info);
+	for (const std::string& name : external_names) {
+		key = hash_bytes(key, name.data(), name.length() + 1);
+	}
+
+	for (const Knot& knot : story_knots) {
+		if (knot.is_function && knot.has_content) {
+			key = hash_bytes(key, knot.name.data(), knot.name.length() + 1);
+		}
+	}
+
+	if (cache_section.is_knot) {
+		std::string knot_name = get_knot_header_name(tokens, header_index);
+		for (const Knot& knot : story_knots) {
+			if (knot.name == knot_name) {
+				cacheable = false;
+				break;
+			}
+		}
+	}
+
+	const InkKnotCache::Entry* entry = has_include ? nullptr : knot_cache.find(key);
+	if (entry && cacheable && !entry->knot_bytes.empty()) {
+		std::size_t index = 0;
+		Deserializer<Knot> dsknot;
+		Knot cached_knot = dsknot(entry->knot_bytes, index);
+		cached_knot.has_content = entry->has_content;
+
+		if (cache_section.is_knot) {
+			story_knots.push_back(std::move(cached_knot));
+			current_knot_index = story_knots.size() - 1;
+		} else {
+			cached_knot.name = story_knots[0].name;
+			cached_knot.uuid = story_knots[0].uuid;
+			story_knots[0] = std::move(cached_knot);
+		}
+
+		if (!entry->list_bytes.empty()) {
+			std::size_t list_index = 0;
+			Deserializer<InkListDefinitionMap> dslists;
+			InkListDefinitionMap cached_lists = dslists(entry->list_bytes, list_index);
+
+			// NOTE: rebuilt in the order they were declared in, so that iterating over them goes in the same order as after compiling the section
+			std::vector<InkListDefinition*> definitions;
+			for (auto& definition : cached_lists.defined_lists) {
+				definitions.push_back(&definition.second);
+			}
+
+			std::sort(definitions.begin(), definitions.end(), [](const InkListDefinition* a, const InkListDefinition* b) { return a->get_uuid().get() < b->get_uuid().get(); });
+
+			InkListDefinitionMap& lists = story_variable_info.defined_lists;
+			lists = InkListDefinitionMap();
+			lists.current_list_definition_uuid = cached_lists.current_list_definition_uuid;
+			for (InkListDefinition* definition : definitions) {
+				lists.defined_lists.emplace(definition->get_uuid(), std::move(*definition));
+			}
+		}
+
+		for (const std::string& name : entry->external_names) {
+			story_variable_info.external_functions.emplace(name, ExpressionParserV2::ExternalFunction());
+		}
+
+		knot_cache.store(key, *entry, true);
+		cache_section.active = false;
+
+		token_index = section_end;
+		last_token_object = nullptr;
+		last_object = nullptr;
+		at_line_start = true;
+		return true;
+	}
+
+	cache_section.cacheable = cacheable;
+	cache_section.key = key;
+	cache_section.uuid_base = entry ? entry->uuid_base : knot_cache.get_next_uuid();
+	current_uuid = cache_section.uuid_base;
+	return false;
+}
+
+void InkCompiler::finish_cache_section(std::vector<Knot>& story_knots) {
+	if (!cache_section.active) {
+		return;
+	}
+
+	InkKnotCache::Entry entry;
+	entry.uuid_base = cache_section.uuid_base;
+	entry.uuid_count = current_uuid - cache_section.uuid_base;
+
+	// NOTE: a section that didn't produce exactly the one knot it started with can't be replayed from the cache
+	std::size_t expected_knots = cache_section.knot_count + (cache_section.is_knot ? 1 : 0);
+	if (cache_section.cacheable && story_knots.size() == expected_knots) {
+		Knot& knot = story_knots[cache_section.is_knot ? story_knots.size() - 1 : 0];
+		Serializer<Knot> sknot;
+		entry.knot_bytes = sknot(knot);
+		entry.has_content = knot.has_content;
+
+		if (cache_section.has_lists) {
+			Serializer<InkListDefinitionMap> slists;
+			entry.list_bytes = slists(story_variable_info.defined_lists);
+		}
+
+		if (cache_section.has_externals) {
+			entry.external_names = get_external_names(story_variable_info);
+		}
+	}
+
+	knot_cache.store(cache_section.key, entry, false);
+	cache_section.active = false;
+}
+
 InkObject* InkCompiler::compile_token(std::vector<InkLexer::Token>& all_tokens, const InkLexer::Token& token, std::vector<Knot>& story_knots)
 {
 	bool end_line = false;
@@ -1425,6 +2263,29 @@ InkObject* InkCompiler::compile_token(std::vector<InkLexer::Token>& all_tokens,
 			}
 		} break;
 
+		case InkToken::KeywordExternal: {
+			if (at_line_start) {
+				++token_index;
+				std::string declaration;
+				declaration.reserve(50);
+				while (token_index < all_tokens.size() && all_tokens[token_index].token != InkToken::NewLine) {
+					declaration += all_tokens[token_index].get_text_contents();
+					++token_index;
+				}
+
+				// only the name matters, since calls to it say how many arguments they pass
+				std::string name = strip_string_edges(declaration.substr(0, declaration.find('(')), true, true, true);
+				if (name.empty() || !declaration.contains('(')) {
+					throw std::runtime_error("Malformed EXTERNAL statement");
+				}
+
+				story_variable_info.external_functions.emplace(name, ExpressionParserV2::ExternalFunction());
+				end_line = true;
+			} else {
+				result_object = new InkObjectText("EXTERNAL");
+			}
+		} break;
+
 		case InkToken::KeywordInclude: {
 			++token_index;
 			std::string path;
@@ -1434,11 +2295,16 @@ InkObject* InkCompiler::compile_token(std::vector<InkLexer::Token>& all_tokens,
 				++token_index;
 			}
 
-			InkCompiler include_compiler;
-			include_compiler.set_current_uuid(current_uuid);
-			InkStory include_story = include_compiler.compile_file(strip_string_edges(path, true, true, true));
-			current_uuid = include_compiler.get_current_uuid();
-			for (const auto& included_knot : include_story.story_data->knots) {
+			IncludeResult include = take_include(strip_string_edges(path, true, true, true));
+			std::unique_ptr<InkStoryData> include_data{include.story_data};
+			for (auto& included_knot : include_data->knots) {
+				included_knot.second.offset_uuids(current_uuid);
+			}
+
+			current_uuid += include.uuid_count;
+			std::move(include_data->object_arenas.begin(), include_data->object_arenas.end(), std::back_inserter(compile_arenas));
+			include_data->object_arenas.clear();
+			for (const auto& included_knot : include_data->knots) {
 				bool already_exists = false;
 				for (Knot& existing_knot : story_knots) {
 					if (existing_knot.name == included_knot.second.name) {
@@ -1453,14 +2319,14 @@ InkObject* InkCompiler::compile_token(std::vector<InkLexer::Token>& all_tokens,
 				}
 			}
 
-			include_story.story_data->knots.clear();
+			include_data->knots.clear();
 			end_line = true;
 		} break;
 
 		case InkToken::Text: {
 			std::string text_stripped = strip_string_edges(token.text_contents, true, true, true);
 			std::string text_notabs = strip_string_edges(token.text_contents);
-			result_object = new InkObjectText(token.text_contents);
+			result_object = new InkObjectText(std::string(token.text_contents));
 		} break;
 
 		default: break;
@@ -1472,34 +2338,6 @@ InkObject* InkCompiler::compile_token(std::vector<InkLexer::Token>& all_tokens,
 	return result_object;
 }
 
-std::vector<InkLexer::Token> InkCompiler::remove_comments(const std::vector<InkLexer::Token>& tokens) {
-	std::vector<InkLexer::Token> result;
-
-	std::size_t index = 0;
-	while (index < tokens.size()) {
-		if (tokens[index].token == InkToken::Slash) {
-			if (next_token_is(tokens, index, InkToken::Slash)) {
-				++index;
-				do {
-					++index;
-				} while (tokens[index].token != InkToken::NewLine);
-			} else if (next_token_is(tokens, index, InkToken::Asterisk)) {
-				++index;
-				do {
-					++index;
-				} while (tokens[index].token != InkToken::Asterisk || !next_token_is(tokens, index, InkToken::Slash));
-
-				index += 2;
-			}
-		}
-
-		result.push_back(tokens[index]);
-		++index;
-	}
-
-	return result;
-}
-
 InkLexer::Token InkCompiler::next_token(const std::vector<InkLexer::Token>& tokens, std::size_t index) {
 	if (index + 1 < tokens.size()) {
 		return tokens[index + 1];
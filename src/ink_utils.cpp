@@ -2,10 +2,9 @@
 
 #include <numeric>
 #include <algorithm>
-#include <regex>
 #include <unordered_map>
 
-std::string strip_string_edges(const std::string& string, bool left, bool right, bool include_spaces) noexcept {
+std::string strip_string_edges(std::string_view string, bool left, bool right, bool include_spaces) noexcept {
 	std::string result;
 	result.reserve(string.length());
 
@@ -35,9 +34,32 @@ std::string strip_string_edges(const std::string& string, bool left, bool right,
 	return result;
 }
 
+bool has_visible_characters(std::string_view string) noexcept {
+	// NOTE: the same test strip_string_edges uses when it strips spaces
+	return std::any_of(string.begin(), string.end(), [](char chr) { return chr >= ' ' + 1; });
+}
+
 std::string remove_duplicate_spaces(const std::string& string) noexcept {
-	static std::regex spaces_regex{R"(\s{2,})"};
-	return std::regex_replace(string, spaces_regex, " ");
+	// runs of two or more whitespace characters collapse into a single space; a lone one is left alone
+	auto is_space = [](char chr) { return chr == ' ' || (chr >= '\t' && chr <= '\r'); };
+
+	std::string result;
+	result.reserve(string.length());
+	for (std::size_t i = 0; i < string.length();) {
+		std::size_t run_end = i;
+		while (run_end < string.length() && is_space(string[run_end])) {
+			++run_end;
+		}
+
+		if (run_end - i >= 2) {
+			result += ' ';
+			i = run_end;
+		} else {
+			result += string[i++];
+		}
+	}
+
+	return result;
 }
 
 std::string join_string_vector(const std::vector<std::string>& vector, std::string&& delimiter) noexcept {
@@ -92,7 +114,58 @@ std::vector<std::string> split_string(const std::string& string, char delimiter,
 	}
 }
 
-std::int64_t randi_range(std::int64_t from, std::int64_t to, std::mt19937& generator) noexcept {
+void Pcg32::seed(std::uint64_t seed_value, std::uint64_t stream) noexcept {
+	state = 0;
+	increment = (stream << 1) | 1;
+	(*this)();
+	state += seed_value;
+	(*this)();
+}
+
+void Pcg32::discard(std::uint64_t count) noexcept {
+	// the state moves on by an affine step each draw, so steps for powers of two can be squared up and applied for each set bit of the count
+	std::uint64_t step_multiplier = Multiplier;
+	std::uint64_t step_increment = increment;
+	std::uint64_t total_multiplier = 1;
+	std::uint64_t total_increment = 0;
+	while (count > 0) {
+		if (count & 1) {
+			total_multiplier *= step_multiplier;
+			total_increment = total_increment * step_multiplier + step_increment;
+		}
+
+		step_increment = (step_multiplier + 1) * step_increment;
+		step_multiplier *= step_multiplier;
+		count >>= 1;
+	}
+
+	state = total_multiplier * state + total_increment;
+}
+
+Pcg32 Pcg32::split(std::uint64_t stream) const noexcept {
+	return Pcg32{mix_hash(state ^ mix_hash(increment)), stream};
+}
+
+std::int64_t randi_range(std::int64_t from, std::int64_t to, Pcg32& generator) noexcept {
 	std::uniform_int_distribution<std::int64_t> distribution{from, to};
 	return distribution(generator);
 }
+
+std::uint64_t stable_hash(std::string_view string) noexcept {
+	// FNV-1a
+	std::uint64_t result = 0xcbf29ce484222325ull;
+	for (char chr : string) {
+		result ^= static_cast<std::uint8_t>(chr);
+		result *= 0x100000001b3ull;
+	}
+
+	return mix_hash(result);
+}
+
+std::uint64_t mix_hash(std::uint64_t value) noexcept {
+	// the splitmix64 finalizer
+	value += 0x9e3779b97f4a7c15ull;
+	value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+	value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+	return value ^ (value >> 31);
+}
@@ -1,5 +1,7 @@
 #include "objects/ink_object.h"
 
+#include <cstddef>
+
 ByteVec Serializer<InkObject*>::operator()(const InkObject* value) {
 	return value->get_serialized_bytes();
 }
@@ -24,6 +26,55 @@ InkObject::~InkObject() {
 	
 }
 
+namespace {
+	// NOTE: every object is preceded by a header recording whether it lives in an arena, since that has to be known after it's been destroyed
+	constexpr std::size_t ObjectHeaderSize = alignof(std::max_align_t);
+
+	enum class ObjectStorage : std::uint8_t {
+		Heap,
+		Arena,
+	};
+}
+
+thread_local InkObjectArena* InkObject::current_arena = nullptr;
+
+InkObject::ArenaScope::ArenaScope(InkObjectArena* arena) : previous_arena{current_arena} {
+	current_arena = arena;
+}
+
+InkObject::ArenaScope::~ArenaScope() {
+	current_arena = previous_arena;
+}
+
+void* InkObject::operator new(std::size_t size) {
+	std::uint8_t* block;
+	if (current_arena) {
+		block = static_cast<std::uint8_t*>(current_arena->allocate(size + ObjectHeaderSize, alignof(std::max_align_t)));
+		block[0] = static_cast<std::uint8_t>(ObjectStorage::Arena);
+	} else {
+		block = static_cast<std::uint8_t*>(::operator new(size + ObjectHeaderSize));
+		block[0] = static_cast<std::uint8_t>(ObjectStorage::Heap);
+	}
+
+	return block + ObjectHeaderSize;
+}
+
+void InkObject::operator delete(InkObject* object, std::destroying_delete_t) {
+	std::uint8_t* block = reinterpret_cast<std::uint8_t*>(object) - ObjectHeaderSize;
+	object->~InkObject();
+	if (static_cast<ObjectStorage>(block[0]) == ObjectStorage::Heap) {
+		::operator delete(block);
+	}
+}
+
+void InkObject::operator delete(void* memory) {
+	// NOTE: only reached when a constructor throws, so there's no object to destroy
+	std::uint8_t* block = static_cast<std::uint8_t*>(memory) - ObjectHeaderSize;
+	if (static_cast<ObjectStorage>(block[0]) == ObjectStorage::Heap) {
+		::operator delete(block);
+	}
+}
+
 InkObject* InkObject::populate_from_bytes(const std::vector<std::uint8_t>& bytes, std::size_t& index) {
 	return this;
 }
@@ -43,6 +94,7 @@ ByteVec InkObject::get_serialized_bytes() const {
 #include "objects/ink_object_glue.h"
 #include "objects/ink_object_interpolation.h"
 #include "objects/ink_object_linebreak.h"
+#include "objects/ink_object_list.h"
 #include "objects/ink_object_logic.h"
 #include "objects/ink_object_sequence.h"
 #include "objects/ink_object_tag.h"
@@ -98,21 +150,32 @@ InkObject* InkObject::create_from_id(ObjectId id) {
 			return new InkObjectLogic({});
 		} break;
 
+		case ObjectId::List: {
+			return new InkObjectList("", Uuid(0), {});
+		} break;
+
 		default: {
 			throw std::runtime_error(std::format("Tried to create an inkb object with an unknown object ID ({})", static_cast<std::uint8_t>(id)));
 		} break;
 	}
 }
 
-ExpressionParserV2::ExecuteResult InkObject::prepare_next_function_call(ExpressionParserV2::ShuntedExpression& expression, InkStoryState& story_state, InkStoryEvalResult& eval_result, ExpressionParserV2::StoryVariableInfo& story_variable_info) {
-	bool continuing_preparation = story_state.current_knot().returning_from_function && story_state.current_knot().current_function_prep_expression == expression.uuid;
-	if (!continuing_preparation) {
-		expression.push_entry();
-	}
+ExpressionParserV2::ExecuteResult InkObject::prepare_next_function_call(const ExpressionParserV2::ShuntedExpression& expression, InkStoryState& story_state, InkStoryEvalResult& eval_result, ExpressionParserV2::StoryVariableInfo& story_variable_info) const {
+	using StackEntry = ExpressionParserV2::ShuntedExpression::StackEntry;
 
-	ExpressionParserV2::ShuntedExpression::StackEntry& expression_entry = expression.stack_back();
+	bool continuing_preparation = story_state.current_knot().returning_from_function && story_state.current_knot().current_function_prep_expression == expression.uuid;
 
+	// NOTE: an expression is only copied once it has to stop partway; until then it's run straight from the story data
+	std::vector<StackEntry>* preparations = nullptr;
 	if (continuing_preparation) {
+		auto found = story_state.expression_preparations.find(&expression);
+		if (found == story_state.expression_preparations.end() || found->second.empty()) {
+			throw std::runtime_error("Carried on with an expression that wasn't stopped partway");
+		}
+
+		preparations = &found->second;
+		StackEntry& expression_entry = preparations->back();
+
 		std::size_t size_lower_cap = 0;
 		if (eval_result.return_value.has_value()) {
 			ExpressionParserV2::Variant value = *eval_result.return_value;
@@ -143,19 +206,35 @@ ExpressionParserV2::ExecuteResult InkObject::prepare_next_function_call(Expressi
 		story_state.current_knot().current_function_prep_expression = UINT32_MAX;
 	}
 
-	ExpressionParserV2::ExecuteResult result = ExpressionParserV2::execute_expression_tokens(expression.stack_back().function_prepared_tokens, story_variable_info);
-	if (result.has_value()) {
-		expression.pop_entry();
-		return *result;
-	} else if (result.error().reason == ExpressionParserV2::NulloptResult::Reason::NoReturnValue) {
-		expression.pop_entry();
-		return std::unexpected(result.error());
+	ExpressionParserV2::ExecuteResult result = ExpressionParserV2::execute_expression_tokens(preparations ? preparations->back().function_prepared_tokens : expression.tokens, story_variable_info);
+	if (result.has_value() || result.error().reason == ExpressionParserV2::NulloptResult::Reason::NoReturnValue) {
+		if (preparations) {
+			preparations->pop_back();
+			if (preparations->empty()) {
+				story_state.expression_preparations.erase(&expression);
+			}
+		}
+
+		return result;
 	}
 
 	const ExpressionParserV2::NulloptResult& nullopt_result = result.error();
+	if (nullopt_result.reason != ExpressionParserV2::NulloptResult::Reason::FoundKnotFunction && nullopt_result.reason != ExpressionParserV2::NulloptResult::Reason::WaitingOnExternal) {
+		throw std::runtime_error("Error while executing expression tokens");
+	}
+
+	if (!preparations) {
+		preparations = &story_state.expression_preparations[&expression];
+		preparations->push_back({expression.tokens});
+	}
+
+	StackEntry& expression_entry = preparations->back();
+	expression_entry.argument_count = nullopt_result.function.function_argument_count;
+	expression_entry.function_eval_index = nullopt_result.function_index;
+	story_state.current_knot().current_function_prep_expression = expression.uuid;
+
 	if (nullopt_result.reason == ExpressionParserV2::NulloptResult::Reason::FoundKnotFunction) {
 		eval_result.divert_args.clear();
-		expression_entry.argument_count = nullopt_result.function.function_argument_count;
 		if (nullopt_result.function.function_argument_count > 0) {
 
 			for (const ExpressionParserV2::Token& token : nullopt_result.arguments) {
@@ -172,17 +251,15 @@ ExpressionParserV2::ExecuteResult InkObject::prepare_next_function_call(Expressi
 		eval_result.target_knot = static_cast<std::string>(nullopt_result.function.value);
 		eval_result.divert_type = DivertType::Function;
 
-		if (story_state.current_knot().knot->function_prep_type == FunctionPrepType::ChoiceTextInterpolate && get_id() == ObjectId::Interpolation) {
+		if (story_state.current_knot().function_prep_type == FunctionPrepType::ChoiceTextInterpolate && get_id() == ObjectId::Interpolation) {
 			eval_result.imminent_function_prep = FunctionPrepType::ChoiceTextInterpolate;
 		} else {
 			eval_result.imminent_function_prep = FunctionPrepType::Generic;
 		}
-		
-		story_state.current_knot().current_function_prep_expression = expression.uuid;
-		expression_entry.function_eval_index = nullopt_result.function_index;
-
-		return std::unexpected(nullopt_result);
 	} else {
-		throw std::runtime_error("Error while executing expression tokens");
+		// NOTE: picked up again the same way as returning from a knot function, with the external function's value standing in for its call
+		eval_result.awaited_value = nullopt_result.pending_value;
 	}
+
+	return result;
 }
@@ -6,13 +6,15 @@
 
 #include "expression_parser/expression_parser.h"
 
+#include <format>
+
 ByteVec Serializer<InkChoiceEntry>::operator()(const InkChoiceEntry& entry) {
 	Serializer<std::uint8_t> s8;
 	Serializer<std::uint16_t> s16;
 	Serializer<Knot> sknot;
 	Serializer<GatherPoint> sgatherpoint;
 	VectorSerializer<InkObject*> sobjects;
-	VectorSerializer<ExpressionParserV2::Token> stokens;
+	Serializer<ExpressionParserV2::ShuntedExpression> stokens;
 
 	ByteVec result = sobjects(entry.text);
 	ByteVec result2 = s8(static_cast<std::uint8_t>(entry.index));
@@ -33,7 +35,7 @@ ByteVec Serializer<InkChoiceEntry>::operator()(const InkChoiceEntry& entry) {
 	result.insert(result.end(), result8.begin(), result8.end());
 
 	for (const auto& vec : entry.conditions) {
-		ByteVec result_tokens = stokens(vec.tokens);
+		ByteVec result_tokens = stokens(vec);
 		result.insert(result.end(), result_tokens.begin(), result_tokens.end());
 	}
 
@@ -46,7 +48,7 @@ InkChoiceEntry Deserializer<InkChoiceEntry>::operator()(const ByteVec& bytes, st
 	Deserializer<Knot> dsknot;
 	Deserializer<GatherPoint> dsgatherpoint;
 	VectorDeserializer<InkObject*> dsobjects;
-	VectorDeserializer<ExpressionParserV2::Token> dstokens;
+	Deserializer<ExpressionParserV2::ShuntedExpression> dstokens;
 
 	InkChoiceEntry result;
 	result.text = dsobjects(bytes, index);
@@ -59,7 +61,7 @@ InkChoiceEntry Deserializer<InkChoiceEntry>::operator()(const ByteVec& bytes, st
 
 	std::uint16_t conditions_size = ds16(bytes, index);
 	for (std::uint16_t i = 0; i < conditions_size; ++i) {
-		result.conditions.push_back(ExpressionParserV2::ShuntedExpression(dstokens(bytes, index)));
+		result.conditions.push_back(dstokens(bytes, index));
 	}
 
 	return result;
@@ -129,6 +131,77 @@ InkObject::ExpressionsVec InkObjectChoice::get_all_expressions() {
 	return result;
 }
 
+std::vector<InkObject*> InkObjectChoice::get_text_objects() const {
+	std::vector<InkObject*> result;
+	for (const InkChoiceEntry& entry : choices) {
+		result.insert(result.end(), entry.text.begin(), entry.text.end());
+	}
+
+	return result;
+}
+
+void InkObjectChoice::offset_uuids(UuidValue amount) {
+	for (InkChoiceEntry& entry : choices) {
+		for (ExpressionParserV2::ShuntedExpression& condition : entry.conditions) {
+			condition.uuid.offset(amount);
+		}
+
+		for (InkObject* object : entry.text) {
+			object->offset_uuids(amount);
+		}
+
+		entry.label.uuid.offset(amount);
+		entry.result.offset_uuids(amount);
+	}
+}
+
+void InkObjectChoice::collect_referenced_names(std::unordered_set<std::string>& names) const {
+	for (const InkChoiceEntry& entry : choices) {
+		for (const ExpressionParserV2::ShuntedExpression& condition : entry.conditions) {
+			condition.collect_referenced_names(names);
+		}
+
+		for (const InkObject* object : entry.text) {
+			object->collect_referenced_names(names);
+		}
+
+		entry.result.collect_referenced_names(names);
+	}
+}
+
+std::vector<Knot*> InkObjectChoice::get_nested_knots() {
+	std::vector<Knot*> result;
+	result.reserve(choices.size());
+	for (InkChoiceEntry& choice : choices) {
+		result.push_back(&choice.result);
+	}
+
+	return result;
+}
+
+void InkObjectChoice::assign_ordinals(std::uint32_t& next_ordinal) {
+	for (InkChoiceEntry& choice : choices) {
+		choice.ordinal = next_ordinal++;
+	}
+}
+
+void InkObjectChoice::describe_options(const std::string& location, std::vector<std::string>& descriptions) const {
+	for (const InkChoiceEntry& choice : choices) {
+		std::string text;
+		for (const InkObject* object : choice.text) {
+			if (object->get_id() == ObjectId::Text) {
+				text += object->to_string();
+			}
+		}
+
+		if (choice.ordinal >= descriptions.size()) {
+			descriptions.resize(choice.ordinal + 1);
+		}
+
+		descriptions[choice.ordinal] = std::format("{}: {}", location, strip_string_edges(text, true, true, true));
+	}
+}
+
 std::vector<GatherPoint*> InkObjectChoice::get_choice_labels() {
 	std::vector<GatherPoint*> result;
 	for (InkChoiceEntry& choice : choices) {
@@ -151,20 +224,25 @@ std::vector<Knot*> InkObjectChoice::get_choice_result_knots() {
 	return result;
 }
 
-bool InkObjectChoice::try_cache_prepared_text(InkObject* object, InkStoryState& story_state, InkStoryEvalResult& story_eval_result, InkStoryEvalResult& choice_eval_result, GetChoicesResult* choices_result, bool result_mode) {
+bool InkObjectChoice::try_cache_prepared_text(const InkObject* object, InkStoryState& story_state, InkStoryEvalResult& story_eval_result, InkStoryEvalResult& choice_eval_result, GetChoicesResult* choices_result, bool result_mode) const {
 	std::string result_before = choice_eval_result.result;
 	Uuid previous_preparation_uuid = story_state.current_knot().current_function_prep_expression;
 	object->execute(story_state, choice_eval_result);
-	if (text_objects_being_prepared.contains(object)) {
-		text_objects_being_prepared.erase(object);
+	if (choice_eval_result.awaited_value) {
+		throw std::runtime_error("Choice text can't wait on an external function's value");
+	}
+
+	InkStoryState::ObjectPreparation& preparation = story_state.object_preparations[this];
+	if (preparation.text_being_prepared.contains(object)) {
+		preparation.text_being_prepared.erase(object);
 		
 		std::string object_added_text = choice_eval_result.result;
 		object_added_text.erase(object_added_text.begin(), object_added_text.begin() + result_before.size());
-		text_objects_fully_prepared.emplace(object, object_added_text);
+		preparation.prepared_text.emplace(object, object_added_text);
 
 		story_eval_result.return_value = std::nullopt;
 	} else if (choice_eval_result.imminent_function_prep) {
-		if (auto prepared_value = text_objects_fully_prepared.find(object); prepared_value != text_objects_fully_prepared.end()) {
+		if (auto prepared_value = preparation.prepared_text.find(object); prepared_value != preparation.prepared_text.end()) {
 			choice_eval_result.result += prepared_value->second;
 			choice_eval_result.imminent_function_prep = FunctionPrepType::None;
 			story_state.current_knot().current_function_prep_expression = previous_preparation_uuid;
@@ -185,7 +263,7 @@ bool InkObjectChoice::try_cache_prepared_text(InkObject* object, InkStoryState&
 				}
 			}
 
-			text_objects_being_prepared.insert(object);
+			preparation.text_being_prepared.insert(object);
 			return true;
 		}
 	}
@@ -193,25 +271,26 @@ bool InkObjectChoice::try_cache_prepared_text(InkObject* object, InkStoryState&
 	return false;
 }
 
-InkObjectChoice::GetChoicesResult InkObjectChoice::get_choices(InkStoryState& story_state, InkStoryEvalResult& eval_result) {
+InkObjectChoice::GetChoicesResult InkObjectChoice::get_choices(InkStoryState& story_state, InkStoryEvalResult& eval_result) const {
 	GetChoicesResult choices_result;
 
+	// NOTE: what's been worked out so far is only kept while something in the options is waiting on a knot function
 	if (!story_state.current_knot().returning_from_function) {
-		conditions_fully_prepared.clear();
-		text_objects_being_prepared.clear();
-		text_objects_fully_prepared.clear();
+		story_state.object_preparations.erase(this);
 	}
 
+	InkStoryState::ObjectPreparation& preparation = story_state.object_preparations[this];
+
 	choices_result.fallback_index = std::nullopt;
 	for (std::size_t i = 0; i < choices.size(); ++i) {
-		InkChoiceEntry& this_choice = choices[i];
-		if (this_choice.sticky || !story_state.has_choice_been_taken(this, i)) {
+		const InkChoiceEntry& this_choice = choices[i];
+		if (this_choice.sticky || !story_state.has_choice_been_taken(this_choice.ordinal)) {
 			if (!this_choice.fallback) {
 				bool include_choice = true;
-				std::vector<ExpressionParserV2::ShuntedExpression>& conditions = this_choice.conditions;
+				const std::vector<ExpressionParserV2::ShuntedExpression>& conditions = this_choice.conditions;
 				if (!conditions.empty() && story_state.choice_divert_index != i) {
-					for (ExpressionParserV2::ShuntedExpression& condition : conditions) {
-						if (!conditions_fully_prepared.contains(condition.uuid)) {
+					for (const ExpressionParserV2::ShuntedExpression& condition : conditions) {
+						if (!preparation.conditions.contains(condition.uuid)) {
 							ExpressionParserV2::ExecuteResult condition_result = prepare_next_function_call(condition, story_state, eval_result, story_state.variable_info);
 							if (!condition_result.has_value() && condition_result.error().reason == ExpressionParserV2::NulloptResult::Reason::FoundKnotFunction) {
 								choices_result.function_prep_type = FunctionPrepType::Generic;
@@ -221,8 +300,10 @@ InkObjectChoice::GetChoicesResult InkObjectChoice::get_choices(InkStoryState& st
 								}
 
 								return choices_result;
+							} else if (!condition_result.has_value() && condition_result.error().reason == ExpressionParserV2::NulloptResult::Reason::WaitingOnExternal) {
+								throw std::runtime_error("A choice's condition can't wait on an external function's value");
 							} else {
-								conditions_fully_prepared.insert({condition.uuid, static_cast<bool>(*condition_result)});
+								preparation.conditions.insert({condition.uuid, static_cast<bool>(*condition_result)});
 							}
 
 							if (!*condition_result) {
@@ -230,7 +311,7 @@ InkObjectChoice::GetChoicesResult InkObjectChoice::get_choices(InkStoryState& st
 								break;
 							}
 						} else {
-							include_choice &= conditions_fully_prepared[condition.uuid];
+							include_choice &= preparation.conditions[condition.uuid];
 							if (!include_choice) {
 								break;
 							}
@@ -244,8 +325,8 @@ InkObjectChoice::GetChoicesResult InkObjectChoice::get_choices(InkStoryState& st
 					InkStoryEvalResult choice_eval_result;
 					choice_eval_result.result.reserve(50);
 					choice_eval_result.return_value = eval_result.return_value;
-					for (InkObject* object : this_choice.text) {
-						if (object->get_id() == ObjectId::ChoiceTextMix && static_cast<InkObjectChoiceTextMix*>(object)->is_end()) {
+					for (const InkObject* object : this_choice.text) {
+						if (object->get_id() == ObjectId::ChoiceTextMix && static_cast<const InkObjectChoiceTextMix*>(object)->is_end()) {
 							break;
 						}
 						
@@ -272,10 +353,14 @@ InkObjectChoice::GetChoicesResult InkObjectChoice::get_choices(InkStoryState& st
 		story_state.current_choices.pop_back();
 	}
 
+	if (!story_state.current_knot().returning_from_function) {
+		story_state.object_preparations.erase(this);
+	}
+
 	return choices_result;
 }
 
-void InkObjectChoice::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) {
+void InkObjectChoice::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const {
 	bool in_thread = story_state.current_thread_depth() > 0;
 
 	bool do_choice_setup = !story_state.selected_choice.has_value() || story_state.current_choices.empty();
@@ -319,7 +404,7 @@ void InkObjectChoice::execute(InkStoryState& story_state, InkStoryEvalResult& ev
 		if (!story_state.current_choices.empty()) {
 			story_state.at_choice = true;
 		} else if (final_choices.fallback_index.has_value()) {
-			InkChoiceEntry& fallback_choice = choices[*final_choices.fallback_index];
+			const InkChoiceEntry& fallback_choice = choices[*final_choices.fallback_index];
 			if (in_thread) {
 				story_state.current_thread_entries.emplace_back(
 					std::string(), &fallback_choice, fallback_choice.index,
@@ -344,11 +429,12 @@ void InkObjectChoice::execute(InkStoryState& story_state, InkStoryEvalResult& ev
 	}
 	
 	if ((!do_choice_setup || select_choice_immediately) && !in_thread) {
-		InkChoiceEntry* selected_choice_struct = nullptr;
+		const InkChoiceEntry* selected_choice_struct = nullptr;
 		if (story_state.choice_divert_index.has_value()) {
-			for (InkChoiceEntry* choice : story_state.current_choice_structs) {
-				if (choice->index == *story_state.choice_divert_index) {
-					selected_choice_struct = choice;
+			// NOTE: a divert to a choice's label runs it whether or not it's on offer (a once-only choice that's been taken isn't), so look in all of them
+			for (const InkChoiceEntry& choice : choices) {
+				if (choice.index == *story_state.choice_divert_index) {
+					selected_choice_struct = &choice;
 					break;
 				}
 			}
@@ -356,19 +442,25 @@ void InkObjectChoice::execute(InkStoryState& story_state, InkStoryEvalResult& ev
 			selected_choice_struct = story_state.current_choice_structs[*story_state.selected_choice];
 		}
 
-		story_state.add_choice_taken(this, selected_choice_struct->index);
+		if (!selected_choice_struct) {
+			throw std::runtime_error(std::format("Diverted to choice {} of a choice point that doesn't have it", story_state.choice_divert_index.value_or(SIZE_MAX)));
+		}
+
+		story_state.add_choice_taken(selected_choice_struct->ordinal);
 		++story_state.total_choices_taken;
 
 		if (!story_state.current_knot().returning_from_function) {
-			text_objects_being_prepared.clear();
-			text_objects_fully_prepared.clear();
+			if (auto preparation = story_state.object_preparations.find(this); preparation != story_state.object_preparations.end()) {
+				preparation->second.text_being_prepared.clear();
+				preparation->second.prepared_text.clear();
+			}
 		}
 
 		story_state.choice_mix_position = InkStoryState::ChoiceMixPosition::Before;
 		InkStoryEvalResult choice_eval_result;
 		choice_eval_result.result.reserve(50);
 		choice_eval_result.return_value = eval_result.return_value;
-		for (InkObject* object : selected_choice_struct->text) {
+		for (const InkObject* object : selected_choice_struct->text) {
 			if (try_cache_prepared_text(object, story_state, eval_result, choice_eval_result, nullptr, true)) {
 				if (object->get_id() == ObjectId::Interpolation) {
 					eval_result.imminent_function_prep = FunctionPrepType::ChoiceTextInterpolate;
@@ -380,7 +472,8 @@ void InkObjectChoice::execute(InkStoryState& story_state, InkStoryEvalResult& ev
 			}
 		}
 
-		story_state.current_knot().knot->function_prep_type = FunctionPrepType::None;
+		story_state.current_knot().function_prep_type = FunctionPrepType::None;
+		story_state.object_preparations.erase(this);
 
 		eval_result.result = choice_eval_result.result;
 		eval_result.reached_newline = !selected_choice_struct->immediately_continue_to_result && eval_result.has_any_contents(true);
@@ -11,7 +11,7 @@ InkObject* InkObjectChoiceTextMix::populate_from_bytes(const ByteVec& bytes, std
 	return this;
 }
 
-void InkObjectChoiceTextMix::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) {
+void InkObjectChoiceTextMix::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const {
 	story_state.choice_mix_position = !end ? InkStoryState::ChoiceMixPosition::In : InkStoryState::ChoiceMixPosition::After;
 }
 
@@ -3,10 +3,10 @@
 #include "ink_utils.h"
 
 ByteVec Serializer<InkObjectConditional::Entry>::operator()(const InkObjectConditional::Entry& entry) {
-	VectorSerializer<ExpressionParserV2::Token> stokens;
+	Serializer<ExpressionParserV2::ShuntedExpression> stokens;
 	Serializer<Knot> sknot;
 
-	ByteVec result = stokens(entry.first.tokens);
+	ByteVec result = stokens(entry.first);
 	ByteVec result2 = sknot(entry.second);
 	result.insert(result.end(), result2.begin(), result2.end());
 
@@ -14,11 +14,11 @@ ByteVec Serializer<InkObjectConditional::Entry>::operator()(const InkObjectCondi
 }
 
 InkObjectConditional::Entry Deserializer<InkObjectConditional::Entry>::operator()(const ByteVec& bytes, std::size_t& index) {
-	VectorDeserializer<ExpressionParserV2::Token> dstokens;
+	Deserializer<ExpressionParserV2::ShuntedExpression> dstokens;
 	Deserializer<Knot> dsknot;
 	
 	InkObjectConditional::Entry result;
-	result.first = ExpressionParserV2::ShuntedExpression(dstokens(bytes, index));
+	result.first = dstokens(bytes, index);
 	result.second = dsknot(bytes, index);
 
 	return result;
@@ -28,11 +28,11 @@ ByteVec InkObjectConditional::to_bytes() const {
 	Serializer<std::uint8_t> s8;
 	VectorSerializer<Entry> sentries;
 	Serializer<Knot> sknot;
-	VectorSerializer<ExpressionParserV2::Token> stokens;
+	Serializer<ExpressionParserV2::ShuntedExpression> stokens;
 
 	ByteVec result = s8(static_cast<std::uint8_t>(is_switch));
 	if (is_switch) {
-		ByteVec result2 = stokens(switch_expression.tokens);
+		ByteVec result2 = stokens(switch_expression);
 		result.insert(result.end(), result2.begin(), result2.end());
 	}
 
@@ -49,11 +49,11 @@ InkObject* InkObjectConditional::populate_from_bytes(const ByteVec& bytes, std::
 	Deserializer<std::uint8_t> ds8;
 	VectorDeserializer<Entry> dsentries;
 	Deserializer<Knot> dsknot;
-	VectorDeserializer<ExpressionParserV2::Token> dstokens;
+	Deserializer<ExpressionParserV2::ShuntedExpression> dstokens;
 
 	is_switch = static_cast<bool>(ds8(bytes, index));
 	if (is_switch) {
-		switch_expression = ExpressionParserV2::ShuntedExpression(dstokens(bytes, index));
+		switch_expression = dstokens(bytes, index);
 	}
 
 	branches = dsentries(bytes, index);
@@ -87,23 +87,78 @@ InkObject::ExpressionsVec InkObjectConditional::get_all_expressions() {
 	return result;
 }
 
-void InkObjectConditional::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) {
-	if (!story_state.current_knot().returning_from_function) {
-		conditions_fully_prepared.clear();
+void InkObjectConditional::offset_uuids(UuidValue amount) {
+	for (Entry& entry : branches) {
+		entry.first.uuid.offset(amount);
+		entry.second.offset_uuids(amount);
 	}
-	
+
+	branch_else.offset_uuids(amount);
+	switch_expression.uuid.offset(amount);
+}
+
+std::vector<Knot*> InkObjectConditional::get_nested_knots() {
+	std::vector<Knot*> result;
+	result.reserve(branches.size() + 1);
+	for (Entry& entry : branches) {
+		result.push_back(&entry.second);
+	}
+
+	result.push_back(&branch_else);
+	return result;
+}
+
+void InkObjectConditional::collect_referenced_names(std::unordered_set<std::string>& names) const {
+	for (const Entry& entry : branches) {
+		entry.first.collect_referenced_names(names);
+		entry.second.collect_referenced_names(names);
+	}
+
+	branch_else.collect_referenced_names(names);
+	switch_expression.collect_referenced_names(names);
+}
+
+void InkObjectConditional::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const {
+	// NOTE: the conditions already worked out are only kept while one of them is waiting on a knot function
+	InkStoryState::ObjectPreparation* preparation = nullptr;
+	if (!story_state.object_preparations.empty()) {
+		if (auto found = story_state.object_preparations.find(this); found != story_state.object_preparations.end()) {
+			if (story_state.current_knot().returning_from_function) {
+				preparation = &found->second;
+			} else {
+				story_state.object_preparations.erase(found);
+			}
+		}
+	}
+
+	FunctionPrepType function_prep_type = story_state.current_knot().function_prep_type;
 	if (!is_switch) {
-		for (Entry& entry : branches) {
-			if (!conditions_fully_prepared.contains(entry.first.uuid)) {
+		for (const Entry& entry : branches) {
+			if (!preparation || !preparation->conditions.contains(entry.first.uuid)) {
 				ExpressionParserV2::ExecuteResult condition_result = prepare_next_function_call(entry.first, story_state, eval_result, story_state.variable_info);
-				if (!condition_result.has_value() && condition_result.error().reason == ExpressionParserV2::NulloptResult::Reason::FoundKnotFunction) {
+				if (!condition_result.has_value() && condition_result.error().interrupted()) {
+					if (!preparation) {
+						preparation = &story_state.object_preparations[this];
+						for (const Entry& earlier : branches) {
+							if (&earlier == &entry) {
+								break;
+							}
+
+							preparation->conditions.emplace(earlier.first.uuid, false);
+						}
+					}
+
 					return;
 				}
 
-				conditions_fully_prepared.insert(entry.first.uuid);
+				if (preparation) {
+					preparation->conditions.emplace(entry.first.uuid, condition_result.has_value() && *condition_result);
+				}
 
 				if (condition_result.has_value() && *condition_result) {
-					entry.second.function_prep_type = story_state.current_knot().knot->function_prep_type;
+					if (preparation) {
+						story_state.object_preparations.erase(this);
+					}
 
 					if (story_state.at_choice) {
 						for (InkObject* object : entry.second.objects) {
@@ -111,37 +166,42 @@ void InkObjectConditional::execute(InkStoryState& story_state, InkStoryEvalResul
 						}
 					} else {
 						story_state.current_knots_stack.push_back({&(entry.second), 0});
+						story_state.current_knot().function_prep_type = function_prep_type;
 					}
 
 					return;
 				}
 			}	
 		}
+
+		if (preparation) {
+			story_state.object_preparations.erase(this);
+		}
 	} else {
 		// TODO: this might be redundant and strictly worse performance than the above version
 		ExpressionParserV2::ExecuteResult result = prepare_next_function_call(switch_expression, story_state, eval_result, story_state.variable_info);
-		if (!result.has_value() && result.error().reason == ExpressionParserV2::NulloptResult::Reason::FoundKnotFunction) {
+		if (!result.has_value() && result.error().interrupted()) {
 			return;
 		}
 
-		for (auto& entry : branches) {
+		for (const Entry& entry : branches) {
 			ExpressionParserV2::ExecuteResult condition_result = prepare_next_function_call(entry.first, story_state, eval_result, story_state.variable_info);
-			if (!condition_result.has_value() && condition_result.error().reason == ExpressionParserV2::NulloptResult::Reason::FoundKnotFunction) {
+			if (!condition_result.has_value() && condition_result.error().interrupted()) {
 				return;
 			}
 
 			if (condition_result.has_value()) {
 				if (*condition_result == result) {
-					entry.second.function_prep_type = story_state.current_knot().knot->function_prep_type;
 					story_state.current_knots_stack.push_back({&(entry.second), 0});
+					story_state.current_knot().function_prep_type = function_prep_type;
 					return;
 				}
 			}
 		}
 	}
 
-	branch_else.function_prep_type = story_state.current_knot().knot->function_prep_type;
 	story_state.current_knots_stack.push_back({&branch_else, 0});
+	story_state.current_knot().function_prep_type = function_prep_type;
 }
 
 bool InkObjectConditional::contributes_content_to_knot() const {
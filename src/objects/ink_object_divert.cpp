@@ -11,18 +11,18 @@ InkObjectDivert::~InkObjectDivert() {
 }
 
 std::vector<std::uint8_t> InkObjectDivert::to_bytes() const {
-	VectorSerializer<ExpressionParserV2::Token> starget;
+	Serializer<ExpressionParserV2::ShuntedExpression> starget;
 	Serializer<std::uint8_t> s8;
 	Serializer<std::uint16_t> s16;
 	
-	ByteVec result = starget(target_knot.tokens);
+	ByteVec result = starget(target_knot);
 	ByteVec result2 = s8(static_cast<std::uint8_t>(type));
 
 	ByteVec result3 = s16(static_cast<std::uint16_t>(arguments.size()));
 	result.insert(result.end(), result2.begin(), result2.end());
 	result.insert(result.end(), result3.begin(), result3.end());
 	for (const auto& arg : arguments) {
-		ByteVec result_arg = starget(arg.tokens);
+		ByteVec result_arg = starget(arg);
 		result.insert(result.end(), result_arg.begin(), result_arg.end());
 	}
 
@@ -32,20 +32,20 @@ std::vector<std::uint8_t> InkObjectDivert::to_bytes() const {
 InkObject* InkObjectDivert::populate_from_bytes(const ByteVec& bytes, std::size_t& index) {
 	Deserializer<std::uint8_t> ds8;
 	Deserializer<std::uint16_t> ds16;
-	VectorDeserializer<ExpressionParserV2::Token> dstarget;
+	Deserializer<ExpressionParserV2::ShuntedExpression> dstarget;
 
-	target_knot = ExpressionParserV2::ShuntedExpression(dstarget(bytes, index));
+	target_knot = dstarget(bytes, index);
 	type = static_cast<DivertType>(ds8(bytes, index));
 
 	std::size_t arg_count = static_cast<std::size_t>(ds16(bytes, index));
 	for (std::size_t i = 0; i < arg_count; ++i) {
-		arguments.push_back(ExpressionParserV2::ShuntedExpression(dstarget(bytes, index)));
+		arguments.push_back(dstarget(bytes, index));
 	}
 
 	return this;
 }
 
-std::string InkObjectDivert::get_target(InkStoryState& story_state, const ExpressionParserV2::StoryVariableInfo& story_var_info) {
+std::string InkObjectDivert::get_target(InkStoryState& story_state, const ExpressionParserV2::StoryVariableInfo& story_var_info) const {
 	std::string target;
 
 	ExpressionParserV2::ExecuteResult target_var = ExpressionParserV2::execute_expression_tokens(target_knot.tokens, story_state.variable_info);
@@ -58,6 +58,20 @@ std::string InkObjectDivert::get_target(InkStoryState& story_state, const Expres
 	return target;
 }
 
+void InkObjectDivert::offset_uuids(UuidValue amount) {
+	target_knot.uuid.offset(amount);
+	for (ExpressionParserV2::ShuntedExpression& argument : arguments) {
+		argument.uuid.offset(amount);
+	}
+}
+
+void InkObjectDivert::collect_referenced_names(std::unordered_set<std::string>& names) const {
+	target_knot.collect_referenced_names(names);
+	for (const ExpressionParserV2::ShuntedExpression& argument : arguments) {
+		argument.collect_referenced_names(names);
+	}
+}
+
 std::string InkObjectDivert::to_string() const {
 	std::string result = "-> ";
 	for (const ExpressionParserV2::Token& token : target_knot.tokens) {
@@ -75,7 +89,7 @@ std::string InkObjectDivert::to_string() const {
 	return result;
 }
 
-void InkObjectDivert::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) {
+void InkObjectDivert::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const {
 	std::string target = get_target(story_state, story_state.variable_info);
 
 	bool is_done = target == "DONE";
@@ -87,7 +101,7 @@ void InkObjectDivert::execute(InkStoryState& story_state, InkStoryEvalResult& ev
 	} else {
 		eval_result.target_knot = target;
 		eval_result.divert_type = type;
-		for (ExpressionParserV2::ShuntedExpression& argument : arguments) {
+		for (const ExpressionParserV2::ShuntedExpression& argument : arguments) {
 			ExpressionParserV2::Variant result = ExpressionParserV2::execute_expression_tokens(argument.tokens, story_state.variable_info).value();
 			eval_result.divert_args.push_back({
 				argument.tokens.size() == 1 && argument.tokens[0].type == ExpressionParserV2::TokenType::Variable
@@ -7,11 +7,11 @@
 ByteVec InkObjectGlobalVariable::to_bytes() const {
 	Serializer<std::uint8_t> s8;
 	Serializer<std::string> sstring;
-	VectorSerializer<ExpressionParserV2::Token> vstoken;
+	Serializer<ExpressionParserV2::ShuntedExpression> vstoken;
 	
 	ByteVec result = sstring(name);
 	ByteVec result2 = s8(static_cast<std::uint8_t>(is_constant));
-	ByteVec result3 = vstoken(value_shunted_tokens.tokens);
+	ByteVec result3 = vstoken(value_shunted_tokens);
 
 	result.insert(result.end(), result2.begin(), result2.end());
 	result.insert(result.end(), result3.begin(), result3.end());
@@ -22,11 +22,11 @@ ByteVec InkObjectGlobalVariable::to_bytes() const {
 InkObject* InkObjectGlobalVariable::populate_from_bytes(const ByteVec& bytes, std::size_t& index) {
 	Deserializer<std::uint8_t> ds8;
 	Deserializer<std::string> dsstring;
-	VectorDeserializer<ExpressionParserV2::Token> vdstoken;
+	Deserializer<ExpressionParserV2::ShuntedExpression> vdstoken;
 
 	name = dsstring(bytes, index);
 	is_constant = static_cast<bool>(ds8(bytes, index));
-	value_shunted_tokens = ExpressionParserV2::ShuntedExpression(vdstoken(bytes, index));
+	value_shunted_tokens = vdstoken(bytes, index);
 
 	return this;
 }
@@ -35,15 +35,17 @@ InkObjectGlobalVariable::~InkObjectGlobalVariable() {
 	
 }
 
-void InkObjectGlobalVariable::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) {
-	auto& map = is_constant ? story_state.variable_info.constants : story_state.variable_info.variables;
-	
+void InkObjectGlobalVariable::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const {
 	ExpressionParserV2::ExecuteResult result = prepare_next_function_call(value_shunted_tokens, story_state, eval_result, story_state.variable_info);
-	if (!result.has_value() && result.error().reason == ExpressionParserV2::NulloptResult::Reason::FoundKnotFunction) {
+	if (!result.has_value() && result.error().interrupted()) {
 		return;
 	}
 
 	if (result.has_value()) {
-		map[name] = *result;
+		if (is_constant) {
+			story_state.variable_info.constants[name] = *result;
+		} else {
+			story_state.variable_info.store_global_variable(name, *result);
+		}
 	}
 }
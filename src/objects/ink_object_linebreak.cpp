@@ -1,5 +1,5 @@
 #include "objects/ink_object_linebreak.h"
 
-void InkObjectLineBreak::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) {
+void InkObjectLineBreak::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const {
 	eval_result.reached_newline = story_state.current_knot().reached_newline = eval_result.has_any_contents(true);
 }
@@ -30,7 +30,7 @@ InkObject* InkObjectList::populate_from_bytes(const ByteVec& bytes, std::size_t&
 	return this;
 }
 
-void InkObjectList::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) {
+void InkObjectList::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const {
 	InkList new_list_var{story_state.variable_info.defined_lists};
 	new_list_var.add_origin(list_uuid);
 	for (const InkListDefinition::Entry& entry : entries) {
@@ -39,5 +39,5 @@ void InkObjectList::execute(InkStoryState& story_state, InkStoryEvalResult& eval
 		}
 	}
 	
-	story_state.variable_info.variables[name] = new_list_var;
+	story_state.variable_info.store_global_variable(name, new_list_var);
 }
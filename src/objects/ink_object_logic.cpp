@@ -6,13 +6,13 @@
 #include "expression_parser/expression_parser.h"
 
 ByteVec InkObjectLogic::to_bytes() const {
-	VectorSerializer<ExpressionParserV2::Token> s;
-	return s(contents_shunted_tokens.tokens);
+	Serializer<ExpressionParserV2::ShuntedExpression> s;
+	return s(contents_shunted_tokens);
 }
 
 InkObject* InkObjectLogic::populate_from_bytes(const ByteVec& bytes, std::size_t& index) {
-	VectorDeserializer<ExpressionParserV2::Token> ds;
-	contents_shunted_tokens = ExpressionParserV2::ShuntedExpression(ds(bytes, index));
+	Deserializer<ExpressionParserV2::ShuntedExpression> ds;
+	contents_shunted_tokens = ds(bytes, index);
 	return this;
 }
 
@@ -20,9 +20,9 @@ InkObjectLogic::~InkObjectLogic() {
 	
 }
 
-void InkObjectLogic::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) {
+void InkObjectLogic::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const {
 	ExpressionParserV2::ExecuteResult logic_result = prepare_next_function_call(contents_shunted_tokens, story_state, eval_result, story_state.variable_info);
-	if (!logic_result.has_value() && logic_result.error().reason == ExpressionParserV2::NulloptResult::Reason::FoundKnotFunction) {
+	if (!logic_result.has_value() && logic_result.error().interrupted()) {
 		return;
 	}
 
@@ -27,18 +27,16 @@ ByteVec InkObjectSequence::to_bytes() const {
 InkObject* InkObjectSequence::populate_from_bytes(const ByteVec& bytes, std::size_t& index) {
 	Deserializer<std::uint8_t> ds8;
 	Deserializer<std::uint16_t> ds16;
-	VectorDeserializer<InkObject*> dsobjects;
+	Deserializer<Knot> dsknot;
 
 	sequence_type = static_cast<InkSequenceType>(ds8(bytes, index));
 	multiline = static_cast<bool>(ds8(bytes, index));
 
 	std::uint16_t objects_size = ds16(bytes, index);
 	for (std::uint16_t i = 0; i < objects_size; ++i) {
-		items.push_back(dsobjects(bytes, index));
+		items.push_back(dsknot(bytes, index));
 	}
 
-	fill_shuffle_indices();
-
 	return this;
 }
 
@@ -50,19 +48,57 @@ InkObjectSequence::~InkObjectSequence() {
 	}
 }
 
-void InkObjectSequence::fill_shuffle_indices() {
+void InkObjectSequence::offset_uuids(UuidValue amount) {
+	for (Knot& item : items) {
+		item.offset_uuids(amount);
+	}
+}
+
+std::uint64_t InkObjectSequence::runtime_state_hash(const InkStoryState& story_state) const {
+	const InkStoryState::ObjectState& state = story_state.object_states[state_ordinal];
+	std::uint64_t result = mix_hash((static_cast<std::uint64_t>(state_ordinal) << 32) ^ state.current_index);
+	for (std::size_t shuffle_index : state.available_indices) {
+		result = mix_hash(result ^ shuffle_index);
+	}
+
+	return result;
+}
+
+void InkObjectSequence::reset_runtime_state(InkStoryState& story_state) const {
+	InkStoryState::ObjectState& state = story_state.object_states[state_ordinal];
+	state.current_index = 0;
+	state.available_indices.clear();
+
 	std::size_t maximum = sequence_type == InkSequenceType::ShuffleStop ? items.size() - 1 : items.size();
 	for (std::size_t i = 0; i < maximum; ++i) {
-		available_shuffle_indices.push_back(i);
+		state.available_indices.push_back(i);
 	}
 }
 
-void InkObjectSequence::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) {
+std::vector<Knot*> InkObjectSequence::get_nested_knots() {
+	std::vector<Knot*> result;
+	result.reserve(items.size());
+	for (Knot& item : items) {
+		result.push_back(&item);
+	}
+
+	return result;
+}
+
+void InkObjectSequence::collect_referenced_names(std::unordered_set<std::string>& names) const {
+	for (const Knot& item : items) {
+		item.collect_referenced_names(names);
+	}
+}
+
+void InkObjectSequence::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const {
+	std::uint64_t hash_before = runtime_state_hash(story_state);
 	std::size_t index = 0;
 	switch (sequence_type) {
 		case InkSequenceType::Shuffle:
 		case InkSequenceType::ShuffleOnce:
 		case InkSequenceType::ShuffleStop: {
+			std::vector<std::size_t>& available_shuffle_indices = story_state.object_states[state_ordinal].available_indices;
 			if (available_shuffle_indices.empty()) {
 				if (sequence_type == InkSequenceType::ShuffleOnce) {
 					return;
@@ -70,7 +106,7 @@ void InkObjectSequence::execute(InkStoryState& story_state, InkStoryEvalResult&
 					index = items.size() - 1;
 				}
 			} else {
-				std::size_t rand_index = static_cast<std::size_t>(randi_range(0, available_shuffle_indices.size() - 1, story_state.rng));
+				std::size_t rand_index = static_cast<std::size_t>(story_state.random_range(0, available_shuffle_indices.size() - 1));
 				index = available_shuffle_indices[rand_index];
 				
 				if (sequence_type != InkSequenceType::Shuffle) {
@@ -80,7 +116,7 @@ void InkObjectSequence::execute(InkStoryState& story_state, InkStoryEvalResult&
 		} break;
 
 		default: {
-			index = current_index;
+			index = story_state.object_states[state_ordinal].current_index;
 		} break;
 	}
 
@@ -93,6 +129,7 @@ void InkObjectSequence::execute(InkStoryState& story_state, InkStoryEvalResult&
 			}
 		}
 
+		std::size_t& current_index = story_state.object_states[state_ordinal].current_index;
 		switch (sequence_type) {
 			case InkSequenceType::Sequence: {
 				if (current_index < items.size() - 1) {
@@ -111,6 +148,8 @@ void InkObjectSequence::execute(InkStoryState& story_state, InkStoryEvalResult&
 			default: break;
 		}
 	}
+
+	story_state.objects_hash ^= hash_before ^ runtime_state_hash(story_state);
 }
 
 bool InkObjectSequence::contributes_content_to_knot() const {
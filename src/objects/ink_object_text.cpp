@@ -6,21 +6,24 @@
 
 std::vector<std::uint8_t> InkObjectText::to_bytes() const {
 	Serializer<std::string> s;
-	return s(text_contents);
+	ByteVec result = s(text_contents);
+	result.push_back(static_cast<std::uint8_t>(ends_with_line_break));
+	return result;
 }
 
 InkObject* InkObjectText::populate_from_bytes(const std::vector<std::uint8_t>& bytes, std::size_t& index) {
 	Deserializer<std::string> ds;
 	text_contents = ds(bytes, index);
+	ends_with_line_break = bytes[index++] != 0;
 	return this;
 }
 
-void InkObjectText::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) {
+void InkObjectText::execute(InkStoryState& story_state, InkStoryEvalResult& eval_result) const {
 	if ((!story_state.selected_choice.has_value() && story_state.choice_mix_position != InkStoryState::ChoiceMixPosition::After)
 	|| (story_state.selected_choice.has_value() && story_state.choice_mix_position != InkStoryState::ChoiceMixPosition::In)) {
 		// if we're preparing an interpolate in the text of a choice, content is treated as a return value
 		// in EVERY OTHER CASE, it is simply run as a side effect
-		if (story_state.current_knot().knot->function_prep_type != FunctionPrepType::ChoiceTextInterpolate) {
+		if (story_state.current_knot().function_prep_type != FunctionPrepType::ChoiceTextInterpolate) {
 			eval_result.result += text_contents;
 			story_state.current_knot().any_new_content = !text_contents.empty();
 		} else {
@@ -31,14 +34,18 @@ void InkObjectText::execute(InkStoryState& story_state, InkStoryEvalResult& eval
 			}
 		}
 
-		if (!strip_string_edges(text_contents, true, true, true).empty()) {
+		if (has_visible_characters(text_contents)) {
 			story_state.in_glue = false;
 		}
 	}
+
+	if (ends_with_line_break) {
+		eval_result.reached_newline = story_state.current_knot().reached_newline = eval_result.has_any_contents(true);
+	}
 }
 
 bool InkObjectText::has_any_contents(bool strip) const {
-	return strip ? !strip_string_edges(text_contents, true, true, true).empty() : !text_contents.empty();
+	return strip ? has_visible_characters(text_contents) : !text_contents.empty();
 }
 
 void InkObjectText::append_text(const std::string& text) {
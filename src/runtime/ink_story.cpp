@@ -12,24 +12,181 @@
 #include <format>
 #include <ranges>
 #include <cmath>
+#include <thread>
+#include <atomic>
+#include <exception>
 
 #include <stdexcept>
 #include <iostream>
 
 #ifndef INKB_VERSION
-#define INKB_VERSION 0
+#define INKB_VERSION 3
 #endif
 
-InkStory::InkStory(const std::string& inkb_file) {
-	std::ifstream infile{inkb_file, std::ios::binary};
+namespace {
+	std::vector<Knot> deserialize_knots(const ByteVec& bytes, std::size_t& index, std::size_t load_threads, std::vector<std::unique_ptr<InkObjectArena>>& arenas) {
+		Deserializer<std::uint16_t> dssize;
+		Deserializer<std::uint32_t> dsoffset;
 
-	std::size_t infile_size = static_cast<std::size_t>(std::filesystem::file_size(inkb_file));
-	ByteVec bytes(infile_size);
+		std::size_t knot_count = dssize(bytes, index);
+		std::vector<std::size_t> knot_offsets;
+		knot_offsets.reserve(knot_count + 1);
 
-	infile.read(reinterpret_cast<char*>(bytes.data()), infile_size);
-	infile.close();
+		std::size_t offset = index + knot_count * sizeof(std::uint32_t);
+		for (std::size_t i = 0; i < knot_count; ++i) {
+			knot_offsets.push_back(offset);
+			offset += dsoffset(bytes, index);
+		}
+
+		knot_offsets.push_back(offset);
+		if (offset > bytes.size()) {
+			throw std::runtime_error("Not a valid inkb file (knot table is out of range)");
+		}
+
+		if (load_threads == 0) {
+			load_threads = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+
+		load_threads = std::max<std::size_t>(std::min(load_threads, knot_count), 1);
+
+		// NOTE: each thread gets its own arena, so every knot's objects end up next to each other
+		std::size_t arena_size_hint = (offset - knot_offsets[0]) / load_threads;
+		arenas.reserve(arenas.size() + load_threads);
+		std::size_t first_arena = arenas.size();
+		for (std::size_t i = 0; i < load_threads; ++i) {
+			arenas.push_back(std::make_unique<InkObjectArena>(std::max<std::size_t>(arena_size_hint, 1024)));
+		}
+
+		std::vector<Knot> result(knot_count);
+		std::vector<std::exception_ptr> errors(knot_count);
+		std::atomic<std::size_t> next_knot = 0;
+
+		auto worker = [&](std::size_t worker_index) {
+			InkObject::ArenaScope arena_scope{arenas[first_arena + worker_index].get()};
+			Deserializer<Knot> dsknot;
+			for (std::size_t i = next_knot++; i < knot_count; i = next_knot++) {
+				try {
+					std::size_t knot_index = knot_offsets[i];
+					result[i] = dsknot(bytes, knot_index);
+					if (knot_index != knot_offsets[i + 1]) {
+						throw std::runtime_error(std::format("Not a valid inkb file (knot {} has the wrong size)", i));
+					}
+				} catch (...) {
+					errors[i] = std::current_exception();
+				}
+			}
+		};
+
+		if (load_threads <= 1) {
+			worker(0);
+		} else {
+			std::vector<std::jthread> workers;
+			workers.reserve(load_threads - 1);
+			for (std::size_t i = 1; i < load_threads; ++i) {
+				workers.emplace_back(worker, i);
+			}
+
+			worker(0);
+		}
+
+		for (const std::exception_ptr& error : errors) {
+			if (error) {
+				for (const Knot& knot : result) {
+					for (InkObject* object : knot.objects) {
+						delete object;
+					}
+				}
+
+				std::rethrow_exception(error);
+			}
+		}
+
+		index = offset;
+		return result;
+	}
+
+	ByteVec read_inkb_file(const std::string& inkb_file) {
+		std::ifstream infile{inkb_file, std::ios::binary};
+
+		std::size_t infile_size = static_cast<std::size_t>(std::filesystem::file_size(inkb_file));
+		ByteVec bytes(infile_size);
+
+		infile.read(reinterpret_cast<char*>(bytes.data()), infile_size);
+		return bytes;
+	}
+
+	// NOTE: lists made while a story runs point at the story state's own copy of the list definitions, so a copy of the state has to
+	// point its lists at the copy's
+	void move_list_definitions(InkStoryState& state, InkStoryEvalResult& line, const InkListDefinitionMap* from) {
+		using namespace ExpressionParserV2;
+
+		const InkListDefinitionMap* to = &state.variable_info.defined_lists;
+		auto move = [from, to](Variant& value) {
+			if (value.has_value() && value.index() == Variant_List) {
+				InkList list = value;
+				if (list.get_definition_map() == from) {
+					list.set_definition_map(to);
+					value = list;
+				}
+			}
+		};
+
+		for (auto* values : {&state.variable_info.variables, &state.variable_info.constants}) {
+			for (auto& [name, value] : *values) {
+				move(value);
+			}
+		}
+
+		for (auto& arguments : state.variable_info.function_arguments_stack) {
+			for (auto& [name, value] : arguments) {
+				move(value);
+			}
+		}
+
+		for (auto& [name, value] : state.variable_info.changed_variables) {
+			move(value);
+		}
+
+		for (auto& arguments : state.thread_arguments_stack) {
+			for (auto& [name, value] : arguments) {
+				move(value);
+			}
+		}
+
+		for (InkStoryState::ThreadChoiceEntry& entry : state.current_thread_entries) {
+			for (auto& [name, value] : entry.arguments) {
+				move(value);
+			}
+		}
+
+		for (auto& [expression, entries] : state.expression_preparations) {
+			for (ShuntedExpression::StackEntry& entry : entries) {
+				for (Token& token : entry.function_prepared_tokens) {
+					move(token.value);
+				}
+			}
+		}
 
+		for (auto& [name, value] : line.divert_args) {
+			move(value);
+		}
+
+		if (line.return_value.has_value()) {
+			move(*line.return_value);
+		}
+	}
+}
+
+InkStory::InkStory(const std::string& inkb_file, std::size_t load_threads) : InkStory(read_inkb_file(inkb_file), load_threads) {}
+
+InkStory::InkStory(const std::vector<std::uint8_t>& bytes, std::size_t load_threads) : InkStory(load_story_data(bytes, load_threads)) {}
+
+std::shared_ptr<InkStoryData> InkStory::load_story_data(const std::vector<std::uint8_t>& bytes, std::size_t load_threads) {
 	constexpr const char* expected_header = "INKB";
+	if (bytes.size() < 5) {
+		throw std::runtime_error("Not a valid inkb file (too short)");
+	}
+
 	for (std::size_t i = 0; i < 4; ++i) {
 		if (static_cast<signed char>(bytes[i]) != expected_header[i]) {
 			throw std::runtime_error("Not a valid inkb file (incorrect header)");
@@ -43,15 +200,17 @@ InkStory::InkStory(const std::string& inkb_file) {
 		throw std::runtime_error(std::format("The version of this .inkb file ({}) does not match the version of your ink-cpp runtime ({}); please recompile your ink file", version, INKB_VERSION));
 	}
 
-	VectorDeserializer<Knot> dsknots;
-	std::vector<Knot> knots = dsknots(bytes, index);
+	std::vector<std::unique_ptr<InkObjectArena>> object_arenas;
+	std::vector<Knot> knots = deserialize_knots(bytes, index, load_threads, object_arenas);
 
-	// TODO: read variable info from file
-	story_data = new InkStoryData(knots, {});
 	VectorDeserializer<std::string> dsorder;
-	story_data->knot_order = dsorder(bytes, index);
-	
-	init_story();
+	std::vector<std::string> knot_order = dsorder(bytes, index);
+
+	Deserializer<ExpressionParserV2::StoryVariableInfo> dsvariables;
+	std::shared_ptr<InkStoryData> story_data = std::make_shared<InkStoryData>(std::move(knots), dsvariables(bytes, index));
+	story_data->knot_order = std::move(knot_order);
+	story_data->object_arenas = std::move(object_arenas);
+	return story_data;
 }
 
 void InkStory::print_info() const {
@@ -59,25 +218,52 @@ void InkStory::print_info() const {
 }
 
 void InkStory::init_story() {
-	for (auto& knot : story_data->knots) {
+	story_data->prepare();
+
+	for (const auto& knot : story_data->knots) {
 		auto knot_stats = story_state.story_tracking.knot_stats.insert({knot.second.uuid, InkStoryTracking::KnotStats(knot.second.name)});
-		for (Stitch& stitch : knot.second.stitches) {
+		for (const Stitch& stitch : knot.second.stitches) {
 			auto stitch_stats = story_state.story_tracking.stitch_stats.insert({stitch.uuid, InkStoryTracking::StitchStats(stitch.name)});
 			knot_stats.first->second.stitches.push_back(stitch.uuid);
 
-			for (GatherPoint& gather_point : stitch.gather_points) {
+			for (const GatherPoint& gather_point : stitch.gather_points) {
 				story_state.story_tracking.gather_point_stats.insert({gather_point.uuid, InkStoryTracking::SubKnotStats(gather_point.name)});
 				stitch_stats.first->second.gather_points.push_back(gather_point.uuid);
 			}
 		}
 
-		for (GatherPoint& gather_point : knot.second.gather_points) {
+		for (const GatherPoint& gather_point : knot.second.gather_points) {
 			story_state.story_tracking.gather_point_stats.insert({gather_point.uuid, InkStoryTracking::SubKnotStats(gather_point.name)});
 			knot_stats.first->second.gather_points.push_back(gather_point.uuid);
 		}
 	}
 
-	story_state.variable_info = std::move(story_data->variable_info);
+	// NOTE: whether each choice option has been taken is a single bit, so the whole set stays small however long the story runs
+	story_state.choices_taken.assign((story_data->choice_count + 63) / 64, 0);
+
+	InkStoryTracking& tracking = story_state.story_tracking;
+	auto flag_read_counts = [this](auto& stats) {
+		for (auto& [uuid, entry] : stats) {
+			entry.count_is_read = story_data->reads.count_names.contains(entry.name);
+			entry.turns_are_read = story_data->reads.reads_turns_since(entry.name);
+		}
+	};
+
+	flag_read_counts(tracking.knot_stats);
+	flag_read_counts(tracking.stitch_stats);
+	flag_read_counts(tracking.gather_point_stats);
+	tracking.rehash_visits();
+
+	story_state.choices_taken_hash = 0;
+	story_state.objects_hash = 0;
+	story_state.object_states.assign(story_data->stateful_objects.size(), {});
+	for (const InkObject* object : story_data->stateful_objects) {
+		object->reset_runtime_state(story_state);
+		story_state.objects_hash ^= object->runtime_state_hash(story_state);
+	}
+
+	story_state.variable_info = story_data->variable_info;
+	story_state.variable_info.rehash_variables();
 	bind_ink_functions();
 
 	story_state.current_knots_stack = {{&(story_data->knots[story_data->knot_order[0]]), 0}};
@@ -85,6 +271,42 @@ void InkStory::init_story() {
 	story_state.setup_next_stitch();
 }
 
+void InkStory::reset() {
+	story_state.variable_info.discard_variable_changes();
+	std::unordered_map<std::string, ExpressionParserV2::ExternalFunction> external_functions = std::move(story_state.variable_info.external_functions);
+	std::unordered_map<std::string, std::vector<ExpressionParserV2::VariableObserverFunc>> observers = std::move(story_state.variable_info.observers);
+	std::unordered_map<std::string, ExpressionParserV2::StoryVariableInfo::ChangeWatch> change_watches = std::move(story_state.variable_info.change_watches);
+
+	story_state = InkStoryState{};
+	line_buffer.clear();
+	awaited_value.reset();
+	suspended_line = InkStoryEvalResult{};
+	init_story();
+
+	story_state.variable_info.external_functions = std::move(external_functions);
+	story_state.variable_info.observers = std::move(observers);
+	story_state.variable_info.change_watches = std::move(change_watches);
+}
+
+std::unique_ptr<InkStory> InkStory::fork() const {
+	if (is_waiting()) {
+		throw std::runtime_error("Can't fork a story while it's waiting on an external function's value");
+	}
+
+	std::unique_ptr<InkStory> result = std::make_unique<InkStory>();
+	result->story_data = story_data;
+	result->story_state = story_state;
+	result->line_buffer = line_buffer;
+	result->awaited_value = awaited_value;
+	result->suspended_line = suspended_line;
+	result->budget = budget;
+	move_list_definitions(result->story_state, result->suspended_line, &story_state.variable_info.defined_lists);
+
+	// NOTE: the built-in functions look at the story they were bound on, so the copies have to be bound again to look at the new one
+	result->bind_ink_functions();
+	return result;
+}
+
 void InkStory::bind_ink_functions() {
 	using namespace ExpressionParserV2;
 
@@ -122,7 +344,8 @@ void InkStory::bind_ink_functions() {
 	EXP_FUNC("SEED_RANDOM", 1, {
 		std::int64_t seed = arguments[0];
 
-		story_state.rng.seed(static_cast<unsigned int>(seed));
+		// NOTE: stays on the session's stream, so sessions split onto different streams still differ after seeding from ink
+		story_state.seed_random(static_cast<std::uint32_t>(seed), story_state.rng_stream);
 		return Variant();
 	});
 
@@ -130,7 +353,7 @@ void InkStory::bind_ink_functions() {
 		std::int64_t from = arguments[0];
 		std::int64_t to = arguments[1];
 
-		std::int64_t result = randi_range(from, to, story_state.rng);
+		std::int64_t result = story_state.random_range(from, to);
 		return result;
 	});
 
@@ -156,7 +379,7 @@ void InkStory::bind_ink_functions() {
 
 	EXP_FUNC("LIST_RANDOM", 1, {
 		const InkList& list = arguments[0];
-		std::int64_t index = randi_range(0, list.count() - 1, story_state.rng);
+		std::int64_t index = story_state.random_range(0, list.count() - 1);
 		return list.at(static_cast<std::size_t>(index));
 	});
 
@@ -220,7 +443,7 @@ void InkStory::apply_knot_args(const InkWeaveContent* target, InkStoryEvalResult
 	eval_result.divert_args.clear();
 }
 
-void InkStory::update_visit_count_variables(std::vector<ExpressionParserV2::ShuntedExpression*>&& expressions) {
+void InkStory::update_visit_count_variables(std::span<ExpressionParserV2::ShuntedExpression* const> expressions) {
 	for (ExpressionParserV2::ShuntedExpression* expression : expressions) {
 		for (ExpressionParserV2::Token& token : expression->tokens) {
 			if (token.type == ExpressionParserV2::TokenType::Variable) {
@@ -238,6 +461,10 @@ void InkStory::update_visit_count_variables(std::vector<ExpressionParserV2::Shun
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 bool InkStory::can_continue() {
+	if (awaited_value) {
+		return awaited_value->is_resolved();
+	}
+
 	return !story_state.should_end_story
 	&& (!story_state.at_choice || story_state.selected_choice.has_value())
 	&& !story_state.current_knots_stack.empty()
@@ -247,32 +474,43 @@ bool InkStory::can_continue() {
 }
 
 std::string InkStory::continue_story() {
-	story_state.current_tags.clear();
-	if (story_state.current_knots_stack.empty()) {
+	if (is_waiting() || story_state.current_knots_stack.empty()) {
 		return std::string();
 	}
 
-	story_state.current_knot().any_new_content = false;
-
 	InkStoryEvalResult eval_result;
-	eval_result.result.reserve(512);
-	eval_result.target_knot.reserve(32);
+	if (awaited_value) {
+		// the object that stopped runs again as though it were returning from a function, with the resolved value as what it returned
+		eval_result = std::move(suspended_line);
+		if (ExpressionParserV2::Variant value = awaited_value->get(); value.has_value()) {
+			eval_result.return_value = value;
+		}
+
+		story_state.current_knot().returning_from_function = true;
+		awaited_value.reset();
+	} else {
+		story_state.current_tags.clear();
+		story_state.current_knot().any_new_content = false;
+
+		// NOTE: the line is built up in a buffer kept between calls, so the only allocations left for text are the finished line's
+		eval_result.result = std::move(line_buffer);
+		eval_result.result.clear();
+	}
+
 	while (can_continue()) {
-		Knot* knot_before_object = story_state.current_knot().knot;
+		const Knot* knot_before_object = story_state.current_knot().knot;
 		bool changed_knot = false;
 		bool advance_knot_index = true;
-		InkObject* current_object = story_state.current_knot().knot->objects[story_state.index_in_knot()];
+		InkObject* current_object = knot_before_object->objects[story_state.index_in_knot()];
+		const KnotStep& step = knot_before_object->steps[story_state.index_in_knot()];
 
 		KnotStatus& last_knot = story_state.previous_nonfunction_knot();
-		bool last_knot_had_newline = last_knot.index > 0 && last_knot.knot->objects[last_knot.index - 1]->get_id() == ObjectId::LineBreak;
+		bool last_knot_had_newline = last_knot.index > 0 && last_knot.knot->steps[last_knot.index - 1].ends_line;
 
 		// any gather points hit need to have their visit counts incremented
 		if (!changed_knot && !story_state.current_knot().returning_from_function) {
-			for (GatherPoint& gather_point : story_state.current_knot().knot->gather_points) {
-				if (!gather_point.in_choice && !gather_point.name.empty() && gather_point.index == story_state.index_in_knot()) {
-					story_state.story_tracking.increment_visit_count(story_state.current_knot().knot, story_state.current_stitch(), &gather_point);
-					break;
-				}
+			if (GatherPoint* gather_point = knot_before_object->gather_at_index[story_state.index_in_knot()]) {
+				story_state.story_tracking.increment_visit_count(knot_before_object, story_state.current_stitch(), gather_point);
 			}
 		}
 		
@@ -280,7 +518,7 @@ std::string InkStory::continue_story() {
 		if (eval_result.reached_newline
 		&& eval_result.has_any_contents(true)
 		&& (!story_state.current_nonchoice_knot().knot->is_function || story_state.current_knot().any_new_content || last_knot_had_newline)
-		&& current_object->stop_before_this(story_state)) {
+		&& (step.is_text ? step.stops_line : current_object->stop_before_this(story_state))) {
 			if (story_state.in_glue) {
 				story_state.in_glue = false;
 				eval_result.reached_newline = false;
@@ -289,8 +527,17 @@ std::string InkStory::continue_story() {
 			}
 		}
 
-		update_visit_count_variables(current_object->get_all_expressions());
+		const auto& expressions = knot_before_object->step_expressions;
+		update_visit_count_variables(std::span{expressions.begin() + step.expressions_begin, expressions.begin() + step.expressions_end});
 		current_object->execute(story_state, eval_result);
+
+		if (eval_result.awaited_value) {
+			awaited_value = std::move(eval_result.awaited_value);
+			suspended_line = std::move(eval_result);
+			story_state.variable_info.deliver_variable_changes();
+			publish_variable_snapshot();
+			return std::string();
+		}
 		
 		// after collecting the options from a choice, a thread returns to its origin
 		if (story_state.should_wrap_up_thread && story_state.current_thread_depth() > 0) {
@@ -301,6 +548,11 @@ std::string InkStory::continue_story() {
 			story_state.current_knots_stack.pop_back();
 
 			story_state.thread_arguments_stack.pop_back();
+			auto [argument_depth, redirect_depth] = story_state.thread_scope_depths.back();
+			story_state.thread_scope_depths.pop_back();
+			story_state.variable_info.function_arguments_stack.resize(std::min(argument_depth, story_state.variable_info.function_arguments_stack.size()));
+			story_state.variable_info.redirects_stack.resize(std::min(redirect_depth, story_state.variable_info.redirects_stack.size()));
+
 			++story_state.current_knot().index;
 			//--story_state.current_thread_depth;
 			story_state.threads_stack.pop_back();
@@ -329,7 +581,7 @@ std::string InkStory::continue_story() {
 			if (target.found_any) {
 				if (target.is_choice_label) {
 					story_state.choice_divert_index = target.gather_point->choice_index;
-					story_state.current_knots_stack.back() = {target.knot, target.gather_point->index};
+					story_state.current_knots_stack.replace_back({target.knot, target.gather_point->index});
 					advance_knot_index = false;
 				} else {
 					switch (eval_result.divert_type) {
@@ -365,6 +617,7 @@ std::string InkStory::continue_story() {
 							}
 
 							story_state.thread_arguments_stack.push_back(thread_args);
+							story_state.thread_scope_depths.emplace_back(story_state.variable_info.function_arguments_stack.size(), story_state.variable_info.redirects_stack.size());
 							[[fallthrough]];
 						}
 
@@ -386,7 +639,7 @@ std::string InkStory::continue_story() {
 										}
 
 										try_remove_upper_knots(target);
-										story_state.current_knots_stack.back() = {target.knot, 0};
+										story_state.current_knots_stack.replace_back({target.knot, 0});
 									}
 									
 									story_state.story_tracking.increment_visit_count(target.knot);
@@ -420,7 +673,7 @@ std::string InkStory::continue_story() {
 										}
 
 										try_remove_upper_knots(target);
-										story_state.current_knots_stack.back() = {target.knot, target.stitch->index};
+										story_state.current_knots_stack.replace_back({target.knot, target.stitch->index});
 									}
 									
 									story_state.story_tracking.increment_visit_count(target.knot ? target.knot : story_state.current_nonchoice_knot().knot, target.stitch);
@@ -439,7 +692,7 @@ std::string InkStory::continue_story() {
 
 								case WeaveContentType::GatherPoint:
 								default: {
-									Knot* previous_knot = story_state.current_knots_stack.back().knot;
+									const Knot* previous_knot = story_state.current_knots_stack.back().knot;
 									if (eval_result.divert_type == DivertType::ToTunnel) {
 										story_state.thread_tunnels_stack.push_back(story_state.current_knot());
 										story_state.thread_tunnels_stack.push_back({target.knot, target.gather_point->index});
@@ -450,7 +703,7 @@ std::string InkStory::continue_story() {
 										}
 										
 										try_remove_upper_knots(target);
-										story_state.current_knots_stack.back() = {target.knot, target.gather_point->index};
+										story_state.current_knots_stack.replace_back({target.knot, target.gather_point->index});
 										if (target.gather_point->in_choice) {
 											story_state.choice_divert_index = target.gather_point->choice_index;
 										}
@@ -482,7 +735,7 @@ std::string InkStory::continue_story() {
 							advance_knot_index = false;
 							function = true;
 
-							story_state.current_knot().knot->function_prep_type = eval_result.imminent_function_prep;
+							story_state.current_knot().function_prep_type = eval_result.imminent_function_prep;
 							eval_result.imminent_function_prep = FunctionPrepType::None;
 						} break;
 
@@ -546,7 +799,7 @@ std::string InkStory::continue_story() {
 		}
 
 		// if we've run out of content in this knot, the story continues to the next gather point
- 		while (!story_state.current_knots_stack.empty() && (!story_state.at_choice || story_state.current_knot().knot->function_prep_type != FunctionPrepType::None) && story_state.index_in_knot() >= story_state.current_knot_size()) {
+ 		while (!story_state.current_knots_stack.empty() && (!story_state.at_choice || story_state.current_knot().function_prep_type != FunctionPrepType::None) && story_state.index_in_knot() >= story_state.current_knot_size()) {
 			if (story_state.should_wrap_up_thread) {
 				break;
 			} else if (story_state.current_knot().knot->is_choice_result) {
@@ -556,7 +809,7 @@ std::string InkStory::continue_story() {
 					GatherPoint* found_gather = nullptr;
 					while (true) {
 						KnotStatus& this_knot = story_state.current_knots_stack.back();
-						for (GatherPoint* gather_point : this_knot.knot->get_all_gather_points()) {
+						for (GatherPoint* gather_point : this_knot.knot->weave_gather_points) {
 							if (!gather_point->in_choice && gather_point->level <= story_state.current_knots_stack.size() && gather_point->index > this_knot.index) {
 								story_state.current_knot().index = gather_point->index;
 								story_state.story_tracking.increment_visit_count(story_state.current_nonchoice_knot().knot, story_state.current_stitch(), gather_point);
@@ -610,13 +863,21 @@ std::string InkStory::continue_story() {
 				break;
 			}
 		}
+
+		if (budget.max_stack_depth > 0 || budget.max_bytes > 0) {
+			check_budget(eval_result);
+		}
 	}
 
 	if (!story_state.thread_entries_applied) {
 		story_state.apply_thread_choices();
 	}
 
-	return remove_duplicate_spaces(strip_string_edges(eval_result.result, true, true, true));
+	std::string line = remove_duplicate_spaces(strip_string_edges(eval_result.result, true, true, true));
+	line_buffer = std::move(eval_result.result);
+	story_state.variable_info.deliver_variable_changes();
+	publish_variable_snapshot();
+	return line;
 }
 
 std::string InkStory::continue_story_maximally() {
@@ -677,16 +938,19 @@ void InkStory::choose_choice_index(std::size_t index) {
 			
 			story_state.setup_next_stitch();
 
-			InkWeaveContent* thread_target = thread_entry.containing_stitch
-											? static_cast<InkWeaveContent*>(thread_entry.containing_stitch)
-											: static_cast<InkWeaveContent*>(thread_entry.containing_knot);
+			const InkWeaveContent* thread_target = thread_entry.containing_stitch
+											? static_cast<const InkWeaveContent*>(thread_entry.containing_stitch)
+											: static_cast<const InkWeaveContent*>(thread_entry.containing_knot);
 
 			story_state.variable_info.current_weave_uuid = thread_target->uuid;
 
+			// NOTE: the thread's own scope was dropped when it wrapped up, so its arguments get a fresh one now that it's carrying on
+			story_state.variable_info.function_arguments_stack.push_back({});
 			story_state.variable_info.redirects_stack.push_back({});
+			std::unordered_map<std::string, ExpressionParserV2::Variant>& arguments = story_state.variable_info.function_arguments_stack.back();
 			std::unordered_map<std::string, std::string>& redirects = story_state.variable_info.redirects_stack.back();
 			for (std::size_t i = 0; i < thread_target->parameters.size(); ++i) {
-				story_state.variable_info.set_variable_value(thread_target->parameters[i].name, thread_entry.arguments[i].second, true);
+				arguments[thread_target->parameters[i].name] = thread_entry.arguments[i].second;
 				if (thread_target->parameters[i].by_ref) {
 					const std::string& lhs = thread_target->parameters[i].name;
 					const std::string& rhs = thread_entry.arguments[i].first;
@@ -704,6 +968,300 @@ void InkStory::choose_choice_index(std::size_t index) {
 	}
 }
 
+std::uint64_t InkStory::state_hash() const {
+	return combine_state_hash(story_state.variable_info.variables_hash, story_state.story_tracking.visits_hash, story_state.story_tracking.turns_hash, story_state.choices_taken_hash, story_state.objects_hash);
+}
+
+std::uint64_t InkStory::recompute_state_hash() const {
+	std::uint64_t variables_hash = 0;
+	for (const auto& [variable, value] : story_state.variable_info.variables) {
+		variables_hash ^= ExpressionParserV2::StoryVariableInfo::variable_hash(variable, value);
+	}
+
+	// NOTE: visit and turn counts nothing in the story reads are left out, so playthroughs that reach the same place by different routes hash the same
+	std::uint64_t visits_hash = 0;
+	std::uint64_t turns_hash = 0;
+	auto add_visits = [&visits_hash, &turns_hash](const auto& stats) {
+		for (const auto& [uuid, entry] : stats) {
+			if (entry.count_is_read) {
+				visits_hash ^= InkStoryTracking::visit_hash(uuid, entry.times_visited);
+			}
+
+			if (entry.turns_are_read) {
+				turns_hash ^= InkStoryTracking::turns_hash_entry(uuid, entry.turns_since_visited);
+			}
+		}
+	};
+
+	add_visits(story_state.story_tracking.knot_stats);
+	add_visits(story_state.story_tracking.stitch_stats);
+	add_visits(story_state.story_tracking.gather_point_stats);
+
+	std::uint64_t choices_taken_hash = 0;
+	for (std::uint32_t ordinal = 0; ordinal < story_state.choices_taken.size() * 64; ++ordinal) {
+		if (story_state.has_choice_been_taken(ordinal)) {
+			choices_taken_hash ^= mix_hash(ordinal);
+		}
+	}
+
+	std::uint64_t objects_hash = 0;
+	for (const InkObject* object : story_data->stateful_objects) {
+		objects_hash ^= object->runtime_state_hash(story_state);
+	}
+
+	return combine_state_hash(variables_hash, visits_hash, turns_hash, choices_taken_hash, objects_hash);
+}
+
+std::uint64_t InkStory::behaviour_hash() const {
+	const StoryLinks& links = story_data->links;
+	std::vector<bool> live(links.knots.size());
+	std::vector<std::uint32_t> to_visit;
+	auto reach = [&live, &to_visit](const Knot* knot) {
+		if (knot && !live[knot->ordinal]) {
+			live[knot->ordinal] = true;
+			to_visit.push_back(knot->ordinal);
+		}
+	};
+
+	// the story can go anywhere reachable from a knot it's running, will go back to, or is offering a choice from
+	for (const KnotStatus& frame : story_state.current_knots_stack) {
+		reach(frame.knot);
+	}
+
+	for (const std::vector<const Knot*>* knots : {&story_state.function_call_stack, &story_state.threads_stack}) {
+		for (const Knot* knot : *knots) {
+			reach(knot);
+		}
+	}
+
+	for (const KnotStatus& frame : story_state.thread_tunnels_stack) {
+		reach(frame.knot);
+	}
+
+	for (const InkStoryState::ThreadChoiceEntry& entry : story_state.current_thread_entries) {
+		reach(entry.containing_knot);
+		reach(entry.choice_entry ? &entry.choice_entry->result : nullptr);
+		for (const KnotStatus& frame : entry.tunnels_stack) {
+			reach(frame.knot);
+		}
+	}
+
+	for (const InkChoiceEntry* choice : story_state.current_choice_structs) {
+		reach(choice ? &choice->result : nullptr);
+	}
+
+	bool reached_divert_targets = false;
+	while (!to_visit.empty()) {
+		const KnotLinks& knot = links.knots[to_visit.back()];
+		to_visit.pop_back();
+		for (std::uint32_t next : knot.next) {
+			if (!live[next]) {
+				live[next] = true;
+				to_visit.push_back(next);
+			}
+		}
+
+		for (auto [choice, next] : knot.once_only_next) {
+			if (!live[next] && !story_state.has_choice_been_taken(choice)) {
+				live[next] = true;
+				to_visit.push_back(next);
+			}
+		}
+
+		if (knot.diverts_anywhere && !reached_divert_targets) {
+			reached_divert_targets = true;
+			for (std::uint32_t next : links.divert_targets) {
+				if (!live[next]) {
+					live[next] = true;
+					to_visit.push_back(next);
+				}
+			}
+		}
+	}
+
+	std::vector<bool> counts_read(links.count_limits.size());
+	std::vector<bool> turns_read(links.turns_limits.size());
+	std::uint64_t choices_taken_hash = 0;
+	std::uint64_t objects_hash = 0;
+	for (std::uint32_t ordinal = 0; ordinal < live.size(); ++ordinal) {
+		if (!live[ordinal]) {
+			continue;
+		}
+
+		const KnotLinks& knot = links.knots[ordinal];
+		for (std::uint32_t choice : knot.once_only_choices) {
+			if (story_state.has_choice_been_taken(choice)) {
+				choices_taken_hash ^= mix_hash(choice);
+			}
+		}
+
+		for (const InkObject* object : knot.stateful_objects) {
+			objects_hash ^= object->runtime_state_hash(story_state);
+		}
+
+		for (std::uint32_t name : knot.count_reads) {
+			counts_read[name] = true;
+		}
+
+		for (std::uint32_t name : knot.turns_reads) {
+			turns_read[name] = true;
+		}
+	}
+
+	std::uint64_t visits_hash = 0;
+	std::uint64_t turns_hash = 0;
+	auto add_counts = [&](const auto& stats) {
+		for (const auto& [uuid, entry] : stats) {
+			auto name = links.name_indices.find(entry.name);
+			if (name == links.name_indices.end()) {
+				continue;
+			}
+
+			if (counts_read[name->second]) {
+				std::int64_t times_visited = std::min(static_cast<std::int64_t>(entry.times_visited), links.count_limits[name->second]);
+				visits_hash ^= InkStoryTracking::visit_hash(uuid, static_cast<std::size_t>(times_visited));
+			}
+
+			if (turns_read[name->second]) {
+				turns_hash ^= InkStoryTracking::turns_hash_entry(uuid, std::min(entry.turns_since_visited, links.turns_limits[name->second]));
+			}
+		}
+	};
+
+	add_counts(story_state.story_tracking.knot_stats);
+	add_counts(story_state.story_tracking.stitch_stats);
+	add_counts(story_state.story_tracking.gather_point_stats);
+
+	// NOTE: what the choices offered from threads were handed decides where they go, and isn't part of state_hash()
+	std::uint64_t result = combine_state_hash(story_state.variable_info.variables_hash, visits_hash, turns_hash, choices_taken_hash, objects_hash);
+	for (const InkStoryState::ThreadChoiceEntry& entry : story_state.current_thread_entries) {
+		std::uint64_t entry_hash = mix_hash(entry.arguments.size());
+		for (const auto& [argument, value] : entry.arguments) {
+			entry_hash ^= ExpressionParserV2::StoryVariableInfo::variable_hash(argument, value);
+		}
+
+		result = mix_hash(result ^ entry_hash);
+	}
+
+	return result;
+}
+
+std::uint64_t InkStory::combine_state_hash(std::uint64_t variables_hash, std::uint64_t visits_hash, std::uint64_t turns_hash, std::uint64_t choices_taken_hash, std::uint64_t objects_hash) const {
+	std::uint64_t result = 0;
+	auto add = [&result](std::uint64_t value) { result = mix_hash(result ^ value); };
+
+	for (const KnotStatus& frame : story_state.current_knots_stack) {
+		add((static_cast<std::uint64_t>(frame.knot->ordinal) << 32) | frame.index);
+		add(frame.current_stitch ? frame.current_stitch->uuid.get() : 0);
+		add((frame.returning_from_function << 0) | (frame.any_new_content << 1) | (frame.reached_newline << 2));
+	}
+
+	add(story_state.function_call_stack.size());
+	add(story_state.threads_stack.size());
+	add(story_state.thread_tunnels_stack.size());
+	add((story_state.should_end_story << 0) | (story_state.at_choice << 1) | (story_state.in_glue << 2));
+	for (const InkChoiceEntry* choice : story_state.current_choice_structs) {
+		add(choice ? choice->ordinal : UINT32_MAX);
+	}
+
+	// NOTE: argument scopes come and go with every call, so they're cheaper to go over each time than to keep up to date
+	for (const auto& arguments : story_state.variable_info.function_arguments_stack) {
+		std::uint64_t arguments_hash = mix_hash(arguments.size());
+		for (const auto& [argument, value] : arguments) {
+			arguments_hash ^= ExpressionParserV2::StoryVariableInfo::variable_hash(argument, value);
+		}
+
+		add(arguments_hash);
+	}
+
+	add(variables_hash);
+	add(visits_hash);
+	add(turns_hash);
+	add(story_data->reads.turns ? story_state.total_choices_taken : 0);
+	add(choices_taken_hash);
+	add(objects_hash);
+	add(story_state.rng_seed);
+	add(story_state.rng_stream);
+	add(story_state.rng_draws);
+	return result;
+}
+
+void InkStory::bind_external_function(const std::string& name, ExpressionParserV2::InkFunction function) {
+	bind_async_external_function(name, [function = std::move(function)](const std::vector<ExpressionParserV2::Variant>& arguments) -> ExpressionParserV2::ExternalResult {
+		return function(arguments);
+	});
+}
+
+void InkStory::bind_async_external_function(const std::string& name, ExpressionParserV2::ExternalFunction function) {
+	auto external = story_state.variable_info.external_functions.find(name);
+	if (external == story_state.variable_info.external_functions.end()) {
+		throw std::runtime_error(std::format("Story has no EXTERNAL function named '{}'", name));
+	}
+
+	external->second = std::move(function);
+}
+
+void InkStory::check_budget(const InkStoryEvalResult& eval_result) {
+	auto where = [this]() -> std::string {
+		if (story_state.current_knots_stack.empty()) {
+			return std::string("the end of the story");
+		}
+
+		std::uint32_t named = story_state.current_knots_stack.named_at_or_below(story_state.current_knots_stack.size() - 1);
+		return named == KnotStatusStack::npos ? std::string("the top level") : std::format("'{}'", story_state.current_knots_stack[named].knot->name);
+	};
+
+	if (budget.max_stack_depth > 0 && story_state.current_knots_stack.size() > budget.max_stack_depth) {
+		throw std::runtime_error(std::format("Story went over its stack depth budget of {} frames in {}; a function or tunnel is probably calling itself without end", budget.max_stack_depth, where()));
+	}
+
+	// NOTE: adding up the state's memory goes over every variable, so it's only done every so many steps rather than after each one
+	constexpr std::size_t MemoryCheckInterval = 64;
+	if (budget.max_bytes > 0 && steps_until_memory_check-- == 0) {
+		steps_until_memory_check = MemoryCheckInterval - 1;
+
+		StoryMemoryUsage usage = story_state.memory_usage();
+		usage.strings += eval_result.result.capacity();
+		if (usage.total() > budget.max_bytes) {
+			throw std::runtime_error(std::format("Story went over its memory budget of {} bytes in {}, with {} bytes in stacks, {} in variables, {} in strings and {} in lists",
+				budget.max_bytes, where(), usage.stacks, usage.variables, usage.strings, usage.lists));
+		}
+	}
+}
+
+StoryMemoryUsage InkStory::get_memory_usage() const {
+	StoryMemoryUsage usage = story_state.memory_usage();
+	usage.strings += line_buffer.capacity() + suspended_line.result.capacity();
+	return usage;
+}
+
+void InkStory::set_variable_snapshots(bool enabled) {
+	publish_variable_snapshots = enabled;
+	if (enabled) {
+		publish_variable_snapshot();
+	} else {
+		variable_snapshot.store(nullptr, std::memory_order_release);
+	}
+}
+
+void InkStory::publish_variable_snapshot() {
+	if (!publish_variable_snapshots) {
+		return;
+	}
+
+	// NOTE: the variables' hash is kept up to date as they're stored, so a line that didn't change any costs nothing more than this
+	std::shared_ptr<const VariableSnapshot> previous = variable_snapshot.load(std::memory_order_relaxed);
+	if (previous && previous->variables_hash == story_state.variable_info.variables_hash) {
+		return;
+	}
+
+	std::shared_ptr<VariableSnapshot> snapshot = std::make_shared<VariableSnapshot>();
+	snapshot->epoch = ++snapshot_epoch;
+	snapshot->variables_hash = story_state.variable_info.variables_hash;
+	snapshot->variables = story_state.variable_info.variables;
+	variable_snapshot.store(std::move(snapshot), std::memory_order_release);
+}
+
 std::optional<ExpressionParserV2::Variant> InkStory::get_variable(const std::string& name) const {
 	return story_state.variable_info.get_variable_value(name);
 }
@@ -716,6 +1274,14 @@ void InkStory::observe_variable(const std::string& variable_name, ExpressionPars
 	story_state.variable_info.observe_variable(variable_name, callback);
 }
 
+void InkStory::watch_variable_changes(const std::string& variable_name, ExpressionParserV2::VariableChangeObserver observer) {
+	story_state.variable_info.watch_variable_changes(variable_name, std::move(observer));
+}
+
+void InkStory::unwatch_variable_changes(const std::string& variable_name) {
+	story_state.variable_info.unwatch_variable_changes(variable_name);
+}
+
 void InkStory::unobserve_variable(const std::string& variable_name) {
 	story_state.variable_info.unobserve_variable(variable_name);
 }
@@ -1,14 +1,19 @@
 #include "runtime/ink_story_data.h"
 
 #include "runtime/ink_story_state.h"
+#include "objects/ink_object_choice.h"
+#include "objects/ink_object_divert.h"
+#include "objects/ink_object_globalvariable.h"
 
 #include <format>
+#include <algorithm>
 
 #include <iostream>
 #include <stdexcept>
+#include <unordered_set>
 
 #ifndef INKB_VERSION
-#define INKB_VERSION 0
+#define INKB_VERSION 3
 #endif
 
 InkStoryData::InkStoryData(const std::vector<Knot>& story_knots, ExpressionParserV2::StoryVariableInfo&& variable_info) : variable_info(variable_info) {
@@ -20,6 +25,15 @@ InkStoryData::InkStoryData(const std::vector<Knot>& story_knots, ExpressionParse
 	}
 }
 
+InkStoryData::InkStoryData(std::vector<Knot>&& story_knots, ExpressionParserV2::StoryVariableInfo&& variable_info) : variable_info(std::move(variable_info)) {
+	knots.reserve(story_knots.size());
+	knot_order.reserve(story_knots.size());
+	for (Knot& knot : story_knots) {
+		knot_order.push_back(knot.name);
+		knots.insert({knot.name, std::move(knot)});
+	}
+}
+
 InkStoryData::~InkStoryData() {
 	for (const auto& entry : knots) {
 		for (InkObject* object : entry.second.objects) {
@@ -32,14 +46,25 @@ std::vector<std::uint8_t> InkStoryData::get_serialized_bytes() const {
 	ByteVec result = {'I', 'N', 'K', 'B', INKB_VERSION};
 	result.reserve(2048);
 
+	// NOTE: knots are preceded by a table of their sizes, so the loader can find each one without walking the stream
+	std::vector<ByteVec> knot_bytes;
+	knot_bytes.reserve(knot_order.size());
+	Serializer<Knot> sknot;
+	for (const std::string& knot_name : knot_order) {
+		knot_bytes.push_back(sknot(knots.at(knot_name)));
+	}
+
 	Serializer<std::uint16_t> ssize;
-	std::vector<std::uint8_t> size_bytes = ssize(static_cast<std::uint16_t>(knots.size()));
+	std::vector<std::uint8_t> size_bytes = ssize(static_cast<std::uint16_t>(knot_bytes.size()));
 	result.insert(result.end(), size_bytes.begin(), size_bytes.end());
 
-	for (const auto& entry : knots) {
-		const Knot& knot = entry.second;
-		Serializer<Knot> s;
-		ByteVec bytes = s(knot);
+	Serializer<std::uint32_t> soffset;
+	for (const ByteVec& bytes : knot_bytes) {
+		ByteVec offset_bytes = soffset(static_cast<std::uint32_t>(bytes.size()));
+		result.insert(result.end(), offset_bytes.begin(), offset_bytes.end());
+	}
+
+	for (const ByteVec& bytes : knot_bytes) {
 		result.insert(result.end(), bytes.begin(), bytes.end());
 	}
 
@@ -47,6 +72,535 @@ std::vector<std::uint8_t> InkStoryData::get_serialized_bytes() const {
 	ByteVec knot_order_bytes = sorder(knot_order);
 	result.insert(result.end(), knot_order_bytes.begin(), knot_order_bytes.end());
 
+	Serializer<ExpressionParserV2::StoryVariableInfo> svariables;
+	ByteVec variable_info_bytes = svariables(variable_info);
+	result.insert(result.end(), variable_info_bytes.begin(), variable_info_bytes.end());
+
+	return result;
+}
+
+std::vector<std::string> InkStoryData::remove_unreachable_knots(const std::vector<std::string>& entry_points) {
+	std::unordered_set<std::string> reachable;
+	std::vector<std::string> to_visit;
+
+	auto visit_name = [this, &reachable, &to_visit](const std::string& name) {
+		// NOTE: a path like knot.stitch.label keeps its whole knot alive
+		std::string knot_name = name.substr(0, name.find('.'));
+		if (knots.contains(knot_name) && reachable.insert(knot_name).second) {
+			to_visit.push_back(knot_name);
+		}
+	};
+
+	if (!knot_order.empty()) {
+		visit_name(knot_order[0]);
+	}
+
+	for (const std::string& entry_point : entry_points) {
+		if (!knots.contains(entry_point.substr(0, entry_point.find('.')))) {
+			throw std::runtime_error(std::format("Entry point '{}' does not exist", entry_point));
+		}
+
+		visit_name(entry_point);
+	}
+
+	// variables and constants can be initialized to divert targets without any code referring to them
+	for (const auto* values : {&variable_info.variables, &variable_info.constants}) {
+		for (const auto& value : *values) {
+			if (value.second.has_value() && value.second.index() == ExpressionParserV2::Variant_String) {
+				visit_name(static_cast<std::string>(value.second));
+			}
+		}
+	}
+
+	std::unordered_set<std::string> referenced_names;
+	while (!to_visit.empty()) {
+		std::string knot_name = std::move(to_visit.back());
+		to_visit.pop_back();
+
+		referenced_names.clear();
+		knots.at(knot_name).collect_referenced_names(referenced_names);
+		for (const std::string& name : referenced_names) {
+			visit_name(name);
+		}
+	}
+
+	std::vector<std::string> removed;
+	std::vector<std::string> new_knot_order;
+	new_knot_order.reserve(reachable.size());
+	for (std::string& knot_name : knot_order) {
+		if (reachable.contains(knot_name)) {
+			new_knot_order.push_back(std::move(knot_name));
+			continue;
+		}
+
+		auto knot = knots.find(knot_name);
+		for (InkObject* object : knot->second.objects) {
+			delete object;
+		}
+
+		knots.erase(knot);
+		removed.push_back(std::move(knot_name));
+	}
+
+	knot_order = std::move(new_knot_order);
+	return removed;
+}
+
+void InkStoryData::prepare() {
+	std::call_once(prepared, [this]() {
+		for (auto& knot : knots) {
+			knot.second.build_steps();
+		}
+
+		choice_count = assign_choice_ordinals();
+		link_knots(assign_knot_ordinals());
+	});
+}
+
+std::uint32_t InkStoryData::assign_choice_ordinals() {
+	std::uint32_t next_ordinal = 0;
+	for (const std::string& knot_name : knot_order) {
+		knots.at(knot_name).assign_choice_ordinals(next_ordinal);
+	}
+
+	return next_ordinal;
+}
+
+std::uint32_t InkStoryData::assign_knot_ordinals() {
+	std::uint32_t next_ordinal = 0;
+	stateful_objects.clear();
+	reads = {};
+	for (const std::string& knot_name : knot_order) {
+		knots.at(knot_name).assign_knot_ordinals(next_ordinal, stateful_objects, reads);
+	}
+
+	return next_ordinal;
+}
+
+namespace {
+	std::string last_path_part(const std::string& path) {
+		std::size_t dot_index = path.find_last_of('.');
+		return dot_index == std::string::npos ? path : path.substr(dot_index + 1);
+	}
+
+	// fills in StoryLinks from each knot's objects in turn
+	struct KnotLinker {
+		StoryLinks& links;
+		// knots, stitches, gathers and choice labels by name, as the knots going to them would be
+		std::unordered_map<std::string, std::vector<std::uint32_t>> targets;
+		// every name written as a divert target somewhere other than a divert, which a variable could end up holding
+		std::unordered_set<std::string> divert_values;
+		// the knots that hand READ_COUNT or TURNS_SINCE something other than a divert target written out, which could be any of them
+		std::vector<std::uint32_t> reads_anywhere;
+
+		std::uint32_t name_index(const std::string& name) {
+			auto [entry, added] = links.name_indices.try_emplace(last_path_part(name), static_cast<std::uint32_t>(links.count_limits.size()));
+			if (added) {
+				links.count_limits.push_back(INT64_MIN);
+				links.turns_limits.push_back(INT64_MIN);
+			}
+
+			return entry->second;
+		}
+
+		void add_targets(const std::string& name, std::vector<std::uint32_t>& into) {
+			if (auto target = targets.find(last_path_part(name)); target != targets.end()) {
+				into.insert(into.end(), target->second.begin(), target->second.end());
+			}
+		}
+
+		// works out which counts the expression reads by following what's done with each one: a count only ever compared with a number
+		// can't be told apart from any higher than it, and nor can one only ever taken as true or false (as a condition's value is)
+		// from any other above zero
+		void read_expression(const ExpressionParserV2::ShuntedExpression& expression, std::uint32_t ordinal, bool is_condition) {
+			using namespace ExpressionParserV2;
+
+			struct Value {
+				enum class Kind {
+					Other,
+					Number,
+					Target,
+					Count,
+					Turns,
+				} kind = Kind::Other;
+
+				std::int64_t number = 0;
+				std::uint32_t name = 0;
+				std::string target;
+			};
+
+			KnotLinks& knot = links.knots[ordinal];
+			auto limit = [this, &knot](const Value& value, std::int64_t at) {
+				if (value.kind == Value::Kind::Count) {
+					knot.count_reads.push_back(value.name);
+					links.count_limits[value.name] = std::max(links.count_limits[value.name], at);
+				} else if (value.kind == Value::Kind::Turns) {
+					knot.turns_reads.push_back(value.name);
+					links.turns_limits[value.name] = std::max(links.turns_limits[value.name], at);
+				}
+			};
+
+			auto compared_with = [](std::int64_t number) { return number == INT64_MAX ? INT64_MAX : number + 1; };
+
+			std::vector<Value> stack;
+			bool lost_track = false;
+			auto pop = [&stack, &lost_track]() {
+				if (stack.empty()) {
+					lost_track = true;
+					return Value{};
+				}
+
+				Value value = std::move(stack.back());
+				stack.pop_back();
+				return value;
+			};
+
+			for (const Token& token : expression.tokens) {
+				switch (token.type) {
+					case TokenType::Variable: {
+						stack.push_back({.kind = Value::Kind::Count, .name = name_index(token.variable_name)});
+					} break;
+
+					case TokenType::LiteralNumberInt: {
+						stack.push_back({.kind = Value::Kind::Number, .number = static_cast<std::int64_t>(token.value)});
+					} break;
+
+					case TokenType::LiteralString:
+					case TokenType::LiteralKnotName: {
+						if (token.value.has_value() && token.value.index() == Variant_String) {
+							std::string target = token.value;
+							divert_values.insert(target);
+							stack.push_back({.kind = Value::Kind::Target, .target = std::move(target)});
+						} else {
+							stack.push_back({});
+						}
+					} break;
+
+					case TokenType::LiteralBool:
+					case TokenType::LiteralNumberFloat:
+					case TokenType::LiteralList: {
+						stack.push_back({});
+					} break;
+
+					case TokenType::Operator: {
+						switch (token.operator_type) {
+							case OperatorType::Increment:
+							case OperatorType::Decrement: {
+								limit(pop(), INT64_MAX);
+							} break;
+
+							case OperatorType::Assign:
+							case OperatorType::PlusAssign:
+							case OperatorType::MinusAssign:
+							case OperatorType::MultiplyAssign:
+							case OperatorType::DivideAssign:
+							case OperatorType::ModulusAssign: {
+								limit(pop(), INT64_MAX);
+								limit(pop(), INT64_MAX);
+							} break;
+
+							case OperatorType::Not: {
+								limit(pop(), 1);
+								stack.push_back({});
+							} break;
+
+							case OperatorType::Negative: {
+								limit(pop(), INT64_MAX);
+								stack.push_back({});
+							} break;
+
+							case OperatorType::Equal:
+							case OperatorType::NotEqual:
+							case OperatorType::Less:
+							case OperatorType::Greater:
+							case OperatorType::LessEqual:
+							case OperatorType::GreaterEqual: {
+								Value right = pop();
+								Value left = pop();
+								limit(left, right.kind == Value::Kind::Number ? compared_with(right.number) : INT64_MAX);
+								limit(right, left.kind == Value::Kind::Number ? compared_with(left.number) : INT64_MAX);
+								stack.push_back({});
+							} break;
+
+							case OperatorType::And:
+							case OperatorType::Or: {
+								limit(pop(), 1);
+								limit(pop(), 1);
+								stack.push_back({});
+							} break;
+
+							case OperatorType::Plus:
+							case OperatorType::Minus:
+							case OperatorType::Multiply:
+							case OperatorType::Divide:
+							case OperatorType::Modulus:
+							case OperatorType::Substring:
+							case OperatorType::NotSubstring:
+							case OperatorType::Intersect: {
+								limit(pop(), INT64_MAX);
+								limit(pop(), INT64_MAX);
+								stack.push_back({});
+							} break;
+
+							// NOTE: the rest are never run, and leave the stack as it is
+							default: break;
+						}
+					} break;
+
+					case TokenType::Function: {
+						std::vector<Value> arguments(token.function_argument_count);
+						for (std::size_t i = arguments.size(); i > 0; --i) {
+							arguments[i - 1] = pop();
+						}
+
+						std::string function = token.value.has_value() && token.value.index() == Variant_String ? static_cast<std::string>(token.value) : std::string();
+						add_targets(function, knot.next);
+						if ((function == "READ_COUNT" || function == "TURNS_SINCE") && arguments.size() == 1) {
+							if (arguments[0].kind == Value::Kind::Target) {
+								Value::Kind kind = function == "READ_COUNT" ? Value::Kind::Count : Value::Kind::Turns;
+								stack.push_back({.kind = kind, .name = name_index(arguments[0].target)});
+								break;
+							}
+
+							reads_anywhere.push_back(ordinal);
+						}
+
+						for (const Value& argument : arguments) {
+							limit(argument, INT64_MAX);
+						}
+
+						stack.push_back({});
+					} break;
+
+					default: break;
+				}
+			}
+
+			if (lost_track) {
+				// NOTE: something was used in a way that isn't understood, so every name in it is taken to be read in full
+				for (const Token& token : expression.tokens) {
+					if (token.type == TokenType::Variable || (token.type == TokenType::LiteralKnotName && token.value.index() == Variant_String)) {
+						std::uint32_t name = name_index(token.type == TokenType::Variable ? token.variable_name : static_cast<std::string>(token.value));
+						limit({.kind = Value::Kind::Count, .name = name}, INT64_MAX);
+						limit({.kind = Value::Kind::Turns, .name = name}, INT64_MAX);
+					} else if (token.type == TokenType::Function && token.value.has_value() && token.value.index() == Variant_String) {
+						std::string function = token.value;
+						if (function == "READ_COUNT" || function == "TURNS_SINCE") {
+							reads_anywhere.push_back(ordinal);
+						}
+					}
+				}
+
+				return;
+			}
+
+			for (const Value& value : stack) {
+				limit(value, is_condition && stack.size() == 1 ? 1 : INT64_MAX);
+			}
+		}
+
+		void read_object(InkObject* object, std::uint32_t ordinal) {
+			KnotLinks& knot = links.knots[ordinal];
+			if (object->has_runtime_state()) {
+				knot.stateful_objects.push_back(object);
+			}
+
+			for (const Knot* nested_knot : object->get_nested_knots()) {
+				knot.next.push_back(nested_knot->ordinal);
+			}
+
+			for (const ExpressionParserV2::ShuntedExpression* expression : object->get_all_expressions()) {
+				read_expression(*expression, ordinal, false);
+			}
+		}
+
+		void read_choice(const InkObjectChoice& choice, std::uint32_t ordinal) {
+			for (const InkChoiceEntry& entry : choice.get_entries()) {
+				KnotLinks& knot = links.knots[ordinal];
+				if (entry.sticky) {
+					knot.next.push_back(entry.result.ordinal);
+				} else {
+					knot.once_only_next.emplace_back(entry.ordinal, entry.result.ordinal);
+					knot.once_only_choices.push_back(entry.ordinal);
+				}
+
+				for (const ExpressionParserV2::ShuntedExpression& condition : entry.conditions) {
+					read_expression(condition, ordinal, true);
+				}
+
+				for (InkObject* text_object : entry.text) {
+					read_object(text_object, ordinal);
+				}
+			}
+		}
+
+		void read_divert(const InkObjectDivert& divert, std::uint32_t ordinal) {
+			for (const ExpressionParserV2::ShuntedExpression& argument : divert.get_arguments()) {
+				read_expression(argument, ordinal, false);
+			}
+
+			if (divert.get_type() == DivertType::FromTunnel) {
+				return;
+			}
+
+			KnotLinks& knot = links.knots[ordinal];
+			for (const ExpressionParserV2::Token& token : divert.get_target_expression().tokens) {
+				std::string target;
+				if (token.type == ExpressionParserV2::TokenType::Variable) {
+					target = token.variable_name;
+				} else if (token.value.has_value() && token.value.index() == ExpressionParserV2::Variant_String) {
+					target = static_cast<std::string>(token.value);
+				}
+
+				if (target.empty() || target == "DONE" || target == "END") {
+					continue;
+				}
+
+				// NOTE: a target that isn't the name of anything has to be a variable
+				if (targets.contains(last_path_part(target))) {
+					add_targets(target, knot.next);
+				} else {
+					knot.diverts_anywhere = true;
+				}
+			}
+		}
+	};
+}
+
+void InkStoryData::link_knots(std::uint32_t knot_count) {
+	links = {};
+	links.knots.resize(knot_count);
+	KnotLinker linker{links};
+
+	// every knot by its ordinal, along with the one it's nested in, which it goes back to once it's done
+	std::vector<Knot*> all_knots(knot_count);
+	std::vector<std::uint32_t> parents(knot_count, UINT32_MAX);
+	auto add_target = [&linker](const std::string& name, std::uint32_t ordinal) {
+		if (!name.empty()) {
+			linker.targets[name].push_back(ordinal);
+		}
+	};
+
+	std::vector<Knot*> to_walk;
+	for (const std::string& knot_name : knot_order) {
+		Knot& knot = knots.at(knot_name);
+		to_walk.push_back(&knot);
+		add_target(knot.name, knot.ordinal);
+		for (const Stitch& stitch : knot.stitches) {
+			add_target(stitch.name, knot.ordinal);
+			for (const GatherPoint& gather_point : stitch.gather_points) {
+				add_target(gather_point.name, knot.ordinal);
+			}
+		}
+	}
+
+	while (!to_walk.empty()) {
+		Knot* knot = to_walk.back();
+		to_walk.pop_back();
+		all_knots[knot->ordinal] = knot;
+		for (const GatherPoint& gather_point : knot->gather_points) {
+			add_target(gather_point.name, knot->ordinal);
+		}
+
+		for (InkObject* object : knot->objects) {
+			std::vector<Knot*> nested_knots = object->get_nested_knots();
+			if (object->get_id() == ObjectId::Choice) {
+				InkObjectChoice* choice = static_cast<InkObjectChoice*>(object);
+				for (const InkChoiceEntry& entry : choice->get_entries()) {
+					add_target(entry.label.name, entry.result.ordinal);
+				}
+
+				for (InkObject* text_object : choice->get_text_objects()) {
+					std::vector<Knot*> text_knots = text_object->get_nested_knots();
+					nested_knots.insert(nested_knots.end(), text_knots.begin(), text_knots.end());
+				}
+			}
+
+			for (Knot* nested_knot : nested_knots) {
+				parents[nested_knot->ordinal] = knot->ordinal;
+				to_walk.push_back(nested_knot);
+			}
+		}
+	}
+
+	for (std::uint32_t ordinal = 0; ordinal < knot_count; ++ordinal) {
+		if (parents[ordinal] != UINT32_MAX) {
+			links.knots[ordinal].next.push_back(parents[ordinal]);
+		}
+
+		for (InkObject* object : all_knots[ordinal]->objects) {
+			switch (object->get_id()) {
+				case ObjectId::Choice: {
+					const InkObjectChoice* choice = static_cast<InkObjectChoice*>(object);
+					linker.read_choice(*choice, ordinal);
+
+					// NOTE: sequences in an option's text are nested in the knot the choice is in
+					for (InkObject* text_object : choice->get_text_objects()) {
+						for (const Knot* text_knot : text_object->get_nested_knots()) {
+							links.knots[ordinal].next.push_back(text_knot->ordinal);
+						}
+					}
+				} break;
+
+				case ObjectId::Divert: {
+					linker.read_object(object, ordinal);
+					linker.read_divert(*static_cast<InkObjectDivert*>(object), ordinal);
+				} break;
+
+				case ObjectId::GlobalVariable: {
+					linker.read_object(object, ordinal);
+					linker.read_expression(static_cast<InkObjectGlobalVariable*>(object)->get_value_expression(), ordinal, false);
+				} break;
+
+				default: {
+					linker.read_object(object, ordinal);
+				} break;
+			}
+		}
+	}
+
+	// variables and constants can start out holding divert targets too
+	for (const auto* values : {&variable_info.variables, &variable_info.constants}) {
+		for (const auto& [name, value] : *values) {
+			if (value.has_value() && value.index() == ExpressionParserV2::Variant_String) {
+				linker.divert_values.insert(static_cast<std::string>(value));
+			}
+		}
+	}
+
+	for (const std::string& target : linker.divert_values) {
+		linker.add_targets(target, links.divert_targets);
+	}
+
+	for (std::uint32_t ordinal : linker.reads_anywhere) {
+		for (const std::string& target : linker.divert_values) {
+			std::uint32_t name = linker.name_index(target);
+			links.knots[ordinal].count_reads.push_back(name);
+			links.knots[ordinal].turns_reads.push_back(name);
+			links.count_limits[name] = INT64_MAX;
+			links.turns_limits[name] = INT64_MAX;
+		}
+	}
+
+	auto sort_unique = [](auto& values) {
+		std::sort(values.begin(), values.end());
+		values.erase(std::unique(values.begin(), values.end()), values.end());
+	};
+
+	sort_unique(links.divert_targets);
+	for (KnotLinks& knot : links.knots) {
+		sort_unique(knot.next);
+		sort_unique(knot.count_reads);
+		sort_unique(knot.turns_reads);
+	}
+}
+
+std::vector<std::string> InkStoryData::describe_choices() const {
+	std::vector<std::string> result;
+	for (const std::string& knot_name : knot_order) {
+		knots.at(knot_name).describe_choices(knot_name, result);
+	}
+
 	return result;
 }
 
@@ -67,16 +621,17 @@ void InkStoryData::print_info() const {
 
 #include "objects/ink_object_choice.h"
 
-GetContentResult find_gather_point_recursive(const std::string& path, std::size_t dots, Knot* topmost_knot, std::vector<KnotStatus>& knots_stack, Knot* new_knot, Stitch* enclosing_stitch, Stitch* current_story_stitch, bool use_stitch, bool update_stack, bool top) {
-	KnotStatus* this_knot_status = nullptr;
+GetContentResult find_gather_point_recursive(const std::string& path, std::size_t dots, const Knot* topmost_knot, KnotStatusStack& knots_stack, const Knot* new_knot, const Stitch* enclosing_stitch, const Stitch* current_story_stitch, bool use_stitch, bool update_stack, bool top) {
+	// NOTE: store an index rather than a pointer, since recursing can push onto knots_stack and reallocate it
+	std::size_t this_knot_status = 0;
 	if (update_stack && !top) {
 		knots_stack.push_back({new_knot, 0});
-		this_knot_status = &knots_stack.back();
+		this_knot_status = knots_stack.size() - 1;
 	} else {
 		bool found_knot = false;
-		for (KnotStatus& knot : knots_stack) {
-			if (knot.knot == topmost_knot) {
-				this_knot_status = &knot;
+		for (std::size_t k = 0; k < knots_stack.size(); ++k) {
+			if (knots_stack[k].knot == topmost_knot) {
+				this_knot_status = k;
 				found_knot = true;
 				break;
 			}
@@ -85,14 +640,26 @@ GetContentResult find_gather_point_recursive(const std::string& path, std::size_
 		if (!found_knot) {
 			knots_stack.clear();
 			knots_stack.push_back({topmost_knot, 0});
-			this_knot_status = &knots_stack.front();
+			this_knot_status = 0;
 		}
 	}
 
 	GetContentResult non_stitch_result;
 
-	std::vector<GatherPoint>& gather_points = use_stitch ? current_story_stitch->gather_points : new_knot->gather_points;
-	for (GatherPoint& gather_point : gather_points) {
+	// NOTE: a label that isn't anywhere in this knot can't be found by walking it, and one that is only needs the choices it's under visited
+	auto label = new_knot->label_index.find(path);
+	if (label == new_knot->label_index.end()) {
+		if (update_stack && !top) {
+			knots_stack.pop_back();
+		}
+
+		return non_stitch_result;
+	}
+
+	const std::vector<std::size_t>& label_choices = label->second;
+
+	const std::vector<GatherPoint>& gather_points = use_stitch ? current_story_stitch->gather_points : new_knot->gather_points;
+	for (const GatherPoint& gather_point : gather_points) {
 		if (!gather_point.in_choice && !gather_point.name.empty() && gather_point.name == path) {
 			GetContentResult result;
 			result.knot = new_knot;
@@ -111,14 +678,36 @@ GetContentResult find_gather_point_recursive(const std::string& path, std::size_
 			}
 		}
 	}
-	
-	std::size_t i = use_stitch ? current_story_stitch->index : 0;
-	while (i < new_knot->objects.size()) {
+
+	// the first object is seen from the stitch passed in, and every one after it from the last stitch starting at or before it
+	std::size_t first_index = use_stitch ? current_story_stitch->index : 0;
+	const Stitch* first_enclosing_stitch = enclosing_stitch;
+	auto enclosing_stitch_at = [new_knot, first_index, first_enclosing_stitch](std::size_t i) {
+		if (i != first_index) {
+			for (auto stitch = new_knot->stitches.rbegin(); stitch != new_knot->stitches.rend(); ++stitch) {
+				if (stitch->index <= i) {
+					return &*stitch;
+				}
+			}
+		}
+
+		return first_enclosing_stitch;
+	};
+
+	std::size_t next_label_choice = 0;
+	while (next_label_choice < label_choices.size() && label_choices[next_label_choice] < first_index) {
+		++next_label_choice;
+	}
+
+	for (; next_label_choice < label_choices.size(); ++next_label_choice) {
+		std::size_t i = label_choices[next_label_choice];
+		enclosing_stitch = enclosing_stitch_at(i);
+
 		InkObject* object = new_knot->objects[i];
 		if (object->get_id() == ObjectId::Choice) {
 			InkObjectChoice* choice_object = static_cast<InkObjectChoice*>(object);
 			std::vector<GatherPoint*> choice_labels = choice_object->get_choice_labels();
-			for (GatherPoint* gather_point : choice_labels) {
+			for (const GatherPoint* gather_point : choice_labels) {
 				if (gather_point->name == path) {
 					GetContentResult result;
 					result.knot = new_knot;
@@ -136,26 +725,17 @@ GetContentResult find_gather_point_recursive(const std::string& path, std::size_
 			}
 
 			std::vector<Knot*> choice_results = choice_object->get_choice_result_knots();
-			for (Knot* knot : choice_results) {
+			for (const Knot* knot : choice_results) {
 				GetContentResult result = find_gather_point_recursive(path, dots, topmost_knot, knots_stack, knot, enclosing_stitch, current_story_stitch, false, update_stack, false);
 				if (result.found_any) {
 					if (update_stack) {
-						this_knot_status->index = i;
+						knots_stack[this_knot_status].index = i;
 					}
 
 					return result;
 				}
 			}
 		}
-
-		++i;
-
-		for (auto stitch = new_knot->stitches.rbegin(); stitch != new_knot->stitches.rend(); ++stitch) {
-			if (stitch->index <= i) {
-				enclosing_stitch = &*stitch;
-				break;
-			}
-		}
 	}
 
 	if (update_stack && !top) {
@@ -165,13 +745,40 @@ GetContentResult find_gather_point_recursive(const std::string& path, std::size_
 	return non_stitch_result;
 }
 
-GetContentResult find_gather_point(const std::string& path, std::size_t dots, Knot* topmost_knot, std::vector<KnotStatus>& knots_stack, Stitch* current_story_stitch, bool use_stitch, bool update_stack) {
-	return find_gather_point_recursive(path, dots, topmost_knot, knots_stack,
+GetContentResult find_gather_point(const std::string& path, std::size_t dots, const Knot* topmost_knot, KnotStatusStack& knots_stack, const Stitch* current_story_stitch, bool use_stitch, bool update_stack) {
+	std::size_t original_size = knots_stack.size();
+	std::size_t topmost_index = 0;
+	while (topmost_index < original_size && knots_stack[topmost_index].knot != topmost_knot) {
+		++topmost_index;
+	}
+
+	GetContentResult result = find_gather_point_recursive(path, dots, topmost_knot, knots_stack,
 	topmost_knot, !topmost_knot->stitches.empty() && topmost_knot->stitches[0].index == 0 ? &topmost_knot->stitches[0] : nullptr,
 	current_story_stitch, use_stitch, update_stack, true);
+
+	// the choice results leading to the label are pushed on top of whatever was running, so drop the frames they replace,
+	// or every loop back to a gather inside a choice leaves another one behind
+	if (update_stack && result.found_any && knots_stack.size() > original_size) {
+		if (topmost_index + 1 < original_size) {
+			std::vector<KnotStatus> path_frames;
+			for (std::size_t i = original_size; i < knots_stack.size(); ++i) {
+				path_frames.push_back(knots_stack[i]);
+			}
+
+			while (knots_stack.size() > topmost_index + 1) {
+				knots_stack.pop_back();
+			}
+
+			for (const KnotStatus& frame : path_frames) {
+				knots_stack.push_back(frame);
+			}
+		}
+	}
+
+	return result;
 }
 
-GetContentResult InkStoryData::get_content(const std::string& path, Knot* topmost_knot, std::vector<KnotStatus>& knots_stack, Stitch* current_stitch, bool update_stack) {
+GetContentResult InkStoryData::get_content(const std::string& path, const Knot* topmost_knot, KnotStatusStack& knots_stack, const Stitch* current_stitch, bool update_stack) const {
 	std::string first;
 	first.reserve(10);
 	std::string second;
@@ -199,14 +806,12 @@ GetContentResult InkStoryData::get_content(const std::string& path, Knot* topmos
 				return result;
 			}
 			
-			for (Stitch& stitch : topmost_knot->stitches) {
-				if (stitch.name == first) {
-					result.knot = topmost_knot;
-					result.stitch = &stitch;
-					result.result_type = WeaveContentType::Stitch;
-					result.found_any = true;
-					return result;
-				}
+			if (const Stitch* stitch = topmost_knot->find_stitch(first)) {
+				result.knot = topmost_knot;
+				result.stitch = stitch;
+				result.result_type = WeaveContentType::Stitch;
+				result.found_any = true;
+				return result;
 			}
 
 			return find_gather_point(first, 0, topmost_knot, knots_stack, current_stitch, false, update_stack);
@@ -214,43 +819,35 @@ GetContentResult InkStoryData::get_content(const std::string& path, Knot* topmos
 
 		case 1: {
 			if (auto knot = knots.find(first); knot != knots.end()) {
-				for (Stitch& stitch : knot->second.stitches) {
-					if (stitch.name == second) {
-						result.knot = &knot->second;
-						result.stitch = &stitch;
-						result.result_type = WeaveContentType::Stitch;
-						result.found_any = true;
-						return result;
-					}
+				if (const Stitch* stitch = knot->second.find_stitch(second)) {
+					result.knot = &knot->second;
+					result.stitch = stitch;
+					result.result_type = WeaveContentType::Stitch;
+					result.found_any = true;
+					return result;
 				}
 
 				return find_gather_point(second, 1, &knot->second, knots_stack, current_stitch, false, update_stack);
-			} else {
-				for (Stitch& stitch : topmost_knot->stitches) {
-					if (stitch.name == first) {
-						return find_gather_point(second, 1, topmost_knot, knots_stack, &stitch, true, update_stack);
-					}
-				}
+			} else if (const Stitch* stitch = topmost_knot->find_stitch(first)) {
+				return find_gather_point(second, 1, topmost_knot, knots_stack, stitch, true, update_stack);
 			}
 		} break;
 
 		case 2: {
 			if (auto knot = knots.find(first); knot != knots.end()) {
-				for (Stitch& stitch : knot->second.stitches) {
-					if (stitch.name == second) {
-						for (GatherPoint& gather_point : stitch.gather_points) {
-							if (gather_point.name == third) {
-								result.knot = &knot->second;
-								result.stitch = &stitch;
-								result.gather_point = &gather_point;
-								result.result_type = WeaveContentType::GatherPoint;
-								result.found_any = true;
-								return result;
-							}
+				if (const Stitch* stitch = knot->second.find_stitch(second)) {
+					for (const GatherPoint& gather_point : stitch->gather_points) {
+						if (gather_point.name == third) {
+							result.knot = &knot->second;
+							result.stitch = stitch;
+							result.gather_point = &gather_point;
+							result.result_type = WeaveContentType::GatherPoint;
+							result.found_any = true;
+							return result;
 						}
-
-						return find_gather_point(third, 2, &knot->second, knots_stack, &stitch, true, update_stack);
 					}
+
+					return find_gather_point(third, 2, &knot->second, knots_stack, stitch, true, update_stack);
 				}
 			}
 		} break;
@@ -0,0 +1,337 @@
+#include "runtime/ink_story_host.h"
+
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+#include <exception>
+#include <utility>
+
+namespace {
+	// which host and queue the current thread works for, so sessions scheduled from inside a request stay on that worker
+	thread_local const StoryHost* current_host = nullptr;
+	thread_local std::size_t current_worker = 0;
+
+	// where a story will carry on from; stories of the same program share its knots, so stories stopped at the same instruction
+	// point at the same knot and can be stepped back to back while that knot's objects are still in cache
+	struct BatchPosition {
+		const InkStoryData* story_data = nullptr;
+		const Knot* knot = nullptr;
+		std::size_t index = 0;
+		std::size_t story = 0;
+
+		auto operator<=>(const BatchPosition& other) const = default;
+	};
+
+	BatchPosition get_batch_position(const InkStory& story, std::size_t story_index) {
+		const KnotStatusStack& knots = story.get_story_state().current_knots_stack;
+		if (knots.empty()) {
+			return {story.get_story_data(), nullptr, 0, story_index};
+		}
+
+		const KnotStatus& frame = knots.back();
+		return {story.get_story_data(), frame.knot, frame.index, story_index};
+	}
+
+	void advance_story(InkStory& story, std::size_t choice, std::string& line) {
+		if (!story.can_continue() && !story.get_current_choices().empty()) {
+			story.choose_choice_index(choice);
+		}
+
+		if (story.can_continue()) {
+			line = story.continue_story();
+		}
+	}
+}
+
+StoryHost::StoryHost(std::size_t threads) {
+	if (threads == 0) {
+		threads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	queues.reserve(threads);
+	for (std::size_t i = 0; i < threads; ++i) {
+		queues.push_back(std::make_unique<WorkerQueue>());
+	}
+
+	workers.reserve(threads);
+	for (std::size_t i = 0; i < threads; ++i) {
+		workers.emplace_back([this, i]() { worker_loop(i); });
+	}
+}
+
+StoryHost::~StoryHost() {
+	// NOTE: a session waiting on an external function's value still has a request to finish, so the values have to arrive first
+	for (std::size_t waiting = waiting_sessions.load(); waiting > 0; waiting = waiting_sessions.load()) {
+		waiting_sessions.wait(waiting);
+	}
+
+	stopping = true;
+	++queued_sessions;
+	queued_sessions.notify_all();
+
+	// NOTE: workers finish whatever has been queued before they stop
+	workers.clear();
+}
+
+StoryHost::ProgramId StoryHost::add_program(ByteVec&& inkb_bytes) {
+	std::shared_ptr<InkStoryData> story_data = InkStory::load_story_data(inkb_bytes);
+	story_data->prepare();
+
+	std::scoped_lock lock{programs_mutex};
+	programs.push_back(std::move(story_data));
+	return programs.size() - 1;
+}
+
+StoryHost::ProgramId StoryHost::add_program_file(const std::string& inkb_file) {
+	std::ifstream infile{inkb_file, std::ios::binary};
+	if (!infile.is_open()) {
+		throw std::runtime_error(std::format("Could not open inkb file '{}'", inkb_file));
+	}
+
+	ByteVec bytes(static_cast<std::size_t>(std::filesystem::file_size(inkb_file)));
+	infile.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+	return add_program(std::move(bytes));
+}
+
+StoryHost::Session& StoryHost::create_session(ProgramId program, std::optional<std::uint32_t> seed, const StoryBudget& budget) {
+	std::unique_lock programs_lock{programs_mutex};
+	if (program >= programs.size()) {
+		throw std::runtime_error(std::format("No program with id {}", program));
+	}
+
+	std::shared_ptr<InkStoryData> story_data = programs[program];
+	programs_lock.unlock();
+
+	std::unique_ptr<InkStory> story = std::make_unique<InkStory>(std::move(story_data));
+	if (seed.has_value()) {
+		story->seed_random(*seed);
+	}
+
+	story->set_budget(budget);
+
+	std::scoped_lock lock{sessions_mutex};
+	return sessions.emplace_back(std::move(story));
+}
+
+void StoryHost::destroy_session(Session& session) {
+	{
+		std::unique_lock lock{session.mutex};
+		session.idle.wait(lock, [&session]() { return !session.scheduled && session.pending.empty(); });
+	}
+
+	std::scoped_lock lock{sessions_mutex};
+	sessions.remove_if([&session](const Session& other) { return &other == &session; });
+}
+
+std::exception_ptr StoryHost::Session::take_error() {
+	std::scoped_lock lock{mutex};
+	return std::exchange(error, nullptr);
+}
+
+void StoryHost::post(Session& session, Request&& request) {
+	{
+		std::scoped_lock lock{session.mutex};
+		session.pending.push_back(std::move(request));
+		if (session.scheduled) {
+			return;
+		}
+
+		session.scheduled = true;
+	}
+
+	schedule(session);
+}
+
+std::future<std::string> StoryHost::continue_story(Session& session) {
+	return submit(session, [](InkStory& story) { return story.continue_story(); });
+}
+
+std::future<void> StoryHost::choose_choice_index(Session& session, std::size_t index) {
+	return submit(session, [index](InkStory& story) { story.choose_choice_index(index); });
+}
+
+void StoryHost::schedule(Session& session) {
+	std::size_t queue_index = current_host == this ? current_worker : next_queue++ % queues.size();
+	{
+		std::scoped_lock lock{queues[queue_index]->mutex};
+		queues[queue_index]->sessions.push_back(&session);
+	}
+
+	++queued_sessions;
+	queued_sessions.notify_one();
+}
+
+StoryHost::Session* StoryHost::take_session(std::size_t worker_index) {
+	// a worker takes its sessions oldest first, and steals the newest from anyone else
+	{
+		WorkerQueue& own = *queues[worker_index];
+		std::scoped_lock lock{own.mutex};
+		if (!own.sessions.empty()) {
+			Session* session = own.sessions.front();
+			own.sessions.pop_front();
+			--queued_sessions;
+			return session;
+		}
+	}
+
+	for (std::size_t offset = 1; offset < queues.size(); ++offset) {
+		WorkerQueue& victim = *queues[(worker_index + offset) % queues.size()];
+		std::unique_lock lock{victim.mutex, std::try_to_lock};
+		if (lock.owns_lock() && !victim.sessions.empty()) {
+			Session* session = victim.sessions.back();
+			victim.sessions.pop_back();
+			--queued_sessions;
+			return session;
+		}
+	}
+
+	return nullptr;
+}
+
+void StoryHost::run_session(Session& session) {
+	Request request;
+	{
+		std::scoped_lock lock{session.mutex};
+		request = std::move(session.pending.front());
+		session.pending.pop_front();
+	}
+
+	bool failed = false;
+	try {
+		request(*session.story);
+	} catch (...) {
+		failed = true;
+		std::scoped_lock lock{session.mutex};
+		if (!session.error) {
+			session.error = std::current_exception();
+		}
+	}
+
+	// NOTE: a request that threw is finished with, even if it left the story waiting on a value
+	if (!failed && session.story->is_waiting()) {
+		std::shared_ptr<ExpressionParserV2::PendingValue> awaited = session.story->get_awaited_value();
+		{
+			std::scoped_lock lock{session.mutex};
+			session.pending.push_front(std::move(request));
+		}
+
+		// the session stays scheduled while it waits, so nothing else queued for it runs in the meantime
+		++waiting_sessions;
+		awaited->on_resolved([this, &session]() {
+			schedule(session);
+			--waiting_sessions;
+			waiting_sessions.notify_all();
+		});
+
+		return;
+	}
+
+	// NOTE: one request per turn, so a busy session goes to the back of the queue instead of holding on to its worker
+	{
+		std::scoped_lock lock{session.mutex};
+		if (session.pending.empty()) {
+			session.scheduled = false;
+			session.idle.notify_all();
+			return;
+		}
+	}
+
+	schedule(session);
+}
+
+void StoryHost::worker_loop(std::size_t worker_index) {
+	current_host = this;
+	current_worker = worker_index;
+
+	while (true) {
+		if (Session* session = take_session(worker_index)) {
+			run_session(*session);
+			continue;
+		}
+
+		if (stopping) {
+			// NOTE: a steal can miss a queue that was busy, so make sure everything really is empty before leaving
+			bool any_queued = false;
+			for (const std::unique_ptr<WorkerQueue>& queue : queues) {
+				std::scoped_lock lock{queue->mutex};
+				any_queued = any_queued || !queue->sessions.empty();
+			}
+
+			if (!any_queued) {
+				return;
+			}
+
+			continue;
+		}
+
+		std::size_t queued = queued_sessions.load();
+		if (queued == 0) {
+			queued_sessions.wait(0);
+		} else {
+			// something is queued but a steal lost a race for it; let its owner get to it
+			std::this_thread::yield();
+		}
+	}
+}
+
+std::vector<std::string> advance_batch(std::span<InkStory* const> stories, std::span<const std::size_t> choices, std::size_t threads) {
+	if (choices.size() != stories.size()) {
+		throw std::runtime_error(std::format("advance_batch was given {} choices for {} stories", choices.size(), stories.size()));
+	}
+
+	std::vector<BatchPosition> order;
+	order.reserve(stories.size());
+	for (std::size_t i = 0; i < stories.size(); ++i) {
+		order.push_back(get_batch_position(*stories[i], i));
+	}
+
+	std::sort(order.begin(), order.end());
+
+	// NOTE: threads take whole runs of the sorted order, so each one keeps stepping stories that sit at the same place
+	constexpr std::size_t ChunkSize = 32;
+	std::vector<std::string> lines(stories.size());
+	std::atomic<std::size_t> next_chunk = 0;
+	std::size_t chunk_count = (order.size() + ChunkSize - 1) / ChunkSize;
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	auto worker = [&]() {
+		for (std::size_t chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++) {
+			std::size_t end = std::min(order.size(), (chunk + 1) * ChunkSize);
+			for (std::size_t i = chunk * ChunkSize; i < end; ++i) {
+				std::size_t story = order[i].story;
+				try {
+					advance_story(*stories[story], choices[story], lines[story]);
+				} catch (...) {
+					std::scoped_lock lock{error_mutex};
+					if (!error) {
+						error = std::current_exception();
+					}
+				}
+			}
+		}
+	};
+
+	if (threads == 0) {
+		threads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	std::size_t worker_count = std::max<std::size_t>(std::min(threads, chunk_count), 1);
+	{
+		std::vector<std::jthread> workers;
+		workers.reserve(worker_count - 1);
+		for (std::size_t i = 1; i < worker_count; ++i) {
+			workers.emplace_back(worker);
+		}
+
+		worker();
+	}
+
+	// NOTE: one story failing doesn't stop the rest of the batch from stepping, but the first failure is still passed on
+	if (error) {
+		std::rethrow_exception(error);
+	}
+
+	return lines;
+}
@@ -15,28 +15,135 @@ InkObject* InkStoryState::get_current_object(std::int64_t index_offset) {
 	return nullptr;
 }
 
-bool InkStoryState::has_choice_been_taken(InkObject* choice_object, std::size_t index) {
-	if (auto knot_choices_taken = choices_taken.find(current_knot().knot); knot_choices_taken != choices_taken.end()) {
-		if (auto choice_indices_taken = knot_choices_taken->second.find(choice_object); choice_indices_taken != knot_choices_taken->second.end()) {
-			return choice_indices_taken->second.contains(index);
+void InkStoryState::seed_random(std::uint32_t seed, std::uint64_t stream) {
+	rng_seed = seed;
+	rng_stream = stream;
+	rng_draws = 0;
+	rng.seed(seed, stream);
+}
+
+std::int64_t InkStoryState::random_range(std::int64_t from, std::int64_t to) {
+	++rng_draws;
+	return randi_range(from, to, rng);
+}
+
+StoryMemoryUsage InkStoryState::memory_usage() const {
+	// NOTE: hash map nodes carry a next pointer and a cached hash alongside what they store
+	constexpr std::size_t NodeBytes = 2 * sizeof(void*);
+
+	StoryMemoryUsage result;
+	auto add_value = [&result](const ExpressionParserV2::Variant& value) {
+		if (value.index() == ExpressionParserV2::Variant_List) {
+			result.lists += value.heap_bytes();
+		} else {
+			result.strings += value.heap_bytes();
+		}
+	};
+
+	auto add_variables = [&](const std::unordered_map<std::string, ExpressionParserV2::Variant>& variables) {
+		result.variables += variables.bucket_count() * sizeof(void*);
+		for (const auto& [name, value] : variables) {
+			result.variables += sizeof(std::pair<const std::string, ExpressionParserV2::Variant>) + NodeBytes + name.capacity();
+			add_value(value);
+		}
+	};
+
+	auto add_arguments = [&](const std::vector<std::pair<std::string, ExpressionParserV2::Variant>>& arguments) {
+		result.stacks += arguments.capacity() * sizeof(std::pair<std::string, ExpressionParserV2::Variant>);
+		for (const auto& [name, value] : arguments) {
+			result.stacks += name.capacity();
+			add_value(value);
+		}
+	};
+
+	result.stacks += current_knots_stack.size() * (sizeof(KnotStatus) + 2 * sizeof(std::uint32_t));
+	result.stacks += function_call_stack.capacity() * sizeof(Knot*) + threads_stack.capacity() * sizeof(Knot*);
+	for (const auto& [expression, entries] : expression_preparations) {
+		result.stacks += sizeof(std::vector<ExpressionParserV2::ShuntedExpression::StackEntry>) + NodeBytes + entries.capacity() * sizeof(ExpressionParserV2::ShuntedExpression::StackEntry);
+		for (const ExpressionParserV2::ShuntedExpression::StackEntry& entry : entries) {
+			result.stacks += entry.function_prepared_tokens.capacity() * sizeof(ExpressionParserV2::Token);
+		}
+	}
+
+	for (const auto& [object, preparation] : object_preparations) {
+		result.stacks += sizeof(ObjectPreparation) + NodeBytes + preparation.conditions.size() * (sizeof(std::pair<Uuid, bool>) + NodeBytes);
+		for (const auto& [text_object, text] : preparation.prepared_text) {
+			result.strings += sizeof(std::pair<const InkObject*, std::string>) + NodeBytes + text.capacity();
+		}
+	}
+
+
+	result.stacks += thread_tunnels_stack.capacity() * sizeof(KnotStatus) + thread_scope_depths.capacity() * sizeof(std::pair<std::size_t, std::size_t>);
+	for (const auto& arguments : thread_arguments_stack) {
+		add_arguments(arguments);
+	}
+
+	for (const ThreadChoiceEntry& entry : current_thread_entries) {
+		result.stacks += sizeof(ThreadChoiceEntry) + entry.tunnels_stack.capacity() * sizeof(KnotStatus);
+		result.strings += entry.choice_text.capacity();
+		add_arguments(entry.arguments);
+	}
+
+	for (const auto& arguments : variable_info.function_arguments_stack) {
+		result.stacks += sizeof(arguments);
+		for (const auto& [name, value] : arguments) {
+			result.stacks += sizeof(std::pair<const std::string, ExpressionParserV2::Variant>) + NodeBytes + name.capacity();
+			add_value(value);
+		}
+	}
+
+	for (const auto& redirects : variable_info.redirects_stack) {
+		result.stacks += sizeof(redirects);
+		for (const auto& [from, to] : redirects) {
+			result.stacks += sizeof(std::pair<const std::string, std::string>) + NodeBytes + from.capacity() + to.capacity();
 		}
 	}
 
-	return false;
+	add_variables(variable_info.variables);
+	add_variables(variable_info.constants);
+	result.variables += choices_taken.capacity() * sizeof(std::uint64_t);
+	result.variables += object_states.capacity() * sizeof(ObjectState);
+	for (const ObjectState& object_state : object_states) {
+		result.variables += object_state.available_indices.capacity() * sizeof(std::size_t);
+	}
+
+	result.variables += story_tracking.knot_stats.size() * (sizeof(InkStoryTracking::KnotStats) + NodeBytes);
+	result.variables += story_tracking.stitch_stats.size() * (sizeof(InkStoryTracking::StitchStats) + NodeBytes);
+	result.variables += story_tracking.gather_point_stats.size() * (sizeof(InkStoryTracking::SubKnotStats) + NodeBytes);
+
+	for (const StoryChoice& choice : current_choices) {
+		result.strings += sizeof(StoryChoice) + choice.text.capacity();
+	}
+
+	for (const std::string& tag : current_tags) {
+		result.strings += sizeof(std::string) + tag.capacity();
+	}
+
+	return result;
 }
 
-void InkStoryState::add_choice_taken(InkObject* choice_object, std::size_t index) {
-	auto& knot_choices_taken = choices_taken[current_knot().knot];
-	auto& choice_indices_taken = knot_choices_taken[choice_object];
-	choice_indices_taken.insert(index);
+bool InkStoryState::has_choice_been_taken(std::uint32_t ordinal) const {
+	std::size_t word = ordinal / 64;
+	return word < choices_taken.size() && (choices_taken[word] & (std::uint64_t{1} << (ordinal % 64))) != 0;
+}
+
+void InkStoryState::add_choice_taken(std::uint32_t ordinal) {
+	std::size_t word = ordinal / 64;
+	if (word >= choices_taken.size()) {
+		choices_taken.resize(word + 1);
+	}
+
+	std::uint64_t bit = std::uint64_t{1} << (ordinal % 64);
+	if ((choices_taken[word] & bit) == 0) {
+		choices_taken[word] |= bit;
+		choices_taken_hash ^= mix_hash(ordinal);
+	}
 }
 
 KnotStatus& InkStoryState::previous_nonfunction_knot(bool offset_by_one) {
 	if (current_knots_stack.size() >= 2) {
-		for (auto it = current_knots_stack.rbegin() + 1; it != current_knots_stack.rend(); ++it) {
-			if (!it->knot->is_function && !it->knot->name.empty()) {
-				return !offset_by_one ? *it : *(it - 1);
-			}
+		if (std::uint32_t index = current_knots_stack.named_nonfunction_at_or_below(current_knots_stack.size() - 2); index != KnotStatusStack::npos) {
+			return current_knots_stack[!offset_by_one ? index : index + 1];
 		}
 	}
 
@@ -44,24 +151,22 @@ KnotStatus& InkStoryState::previous_nonfunction_knot(bool offset_by_one) {
 }
 
 KnotStatus& InkStoryState::current_nonchoice_knot() {
-	for (auto it = current_knots_stack.rbegin(); it != current_knots_stack.rend(); ++it) {
-		if (!it->knot->name.empty()) {
-			return *it;
-		}
+	if (std::uint32_t index = current_knots_stack.named_at_or_below(current_knots_stack.size() - 1); index != KnotStatusStack::npos) {
+		return current_knots_stack[index];
 	}
 
 	return current_knots_stack.front();
 }
 
 void InkStoryState::update_weave_uuid() {
-	Stitch* stitch_current = current_stitch();
+	const Stitch* stitch_current = current_stitch();
 	variable_info.current_weave_uuid = stitch_current ? stitch_current->uuid : current_nonchoice_knot().knot->uuid;
 }
 
 void InkStoryState::setup_next_stitch() {
 	KnotStatus& current = current_nonchoice_knot();
-	Stitch* stitch_current = current_stitch();
-	std::vector<Stitch>& stitches = current.knot->stitches;
+	const Stitch* stitch_current = current_stitch();
+	const std::vector<Stitch>& stitches = current.knot->stitches;
 	if (stitch_current) {
 		for (auto stitch = stitches.begin(); stitch != stitches.end(); ++stitch) {
 			if (stitch_current == &*stitch) {
@@ -100,5 +205,5 @@ void InkStoryState::apply_thread_choices() {
 }
 
 bool InkStoryEvalResult::has_any_contents(bool strip) {
-	return strip ? !strip_string_edges(result, true, true, true).empty() : !result.empty();
+	return strip ? has_visible_characters(result) : !result.empty();
 }
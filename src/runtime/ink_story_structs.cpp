@@ -1,6 +1,8 @@
 #include "runtime/ink_story_structs.h"
 
 #include "objects/ink_object.h"
+#include "objects/ink_object_choice.h"
+#include "objects/ink_object_globalvariable.h"
 
 #include <format>
 
@@ -219,3 +221,241 @@ void Knot::append_knot(const Knot& other) {
 		gather_points.push_back(gather_point);
 	}
 }
+
+void Knot::offset_uuids(UuidValue amount) {
+	uuid.offset(amount);
+	for (Stitch& stitch : stitches) {
+		stitch.uuid.offset(amount);
+		for (GatherPoint& gather_point : stitch.gather_points) {
+			gather_point.uuid.offset(amount);
+		}
+	}
+
+	for (GatherPoint& gather_point : gather_points) {
+		gather_point.uuid.offset(amount);
+	}
+
+	for (InkObject* object : objects) {
+		object->offset_uuids(amount);
+	}
+}
+
+void Knot::build_steps() {
+	steps.clear();
+	steps.reserve(objects.size());
+	step_expressions.clear();
+	for (InkObject* object : objects) {
+		KnotStep step;
+		step.ends_line = object->ends_line();
+		step.is_text = object->get_id() == ObjectId::Text;
+		step.stops_line = step.is_text && object->has_any_contents(true);
+
+		InkObject::ExpressionsVec expressions = object->get_all_expressions();
+		step.expressions_begin = static_cast<std::uint32_t>(step_expressions.size());
+		step_expressions.insert(step_expressions.end(), expressions.begin(), expressions.end());
+		step.expressions_end = static_cast<std::uint32_t>(step_expressions.size());
+		steps.push_back(step);
+
+		for (Knot* nested_knot : object->get_nested_knots()) {
+			nested_knot->build_steps();
+		}
+	}
+
+	// the first named gather at each index is the one whose visit count goes up when the story reaches it
+	gather_at_index.assign(objects.size(), nullptr);
+	for (GatherPoint& gather_point : gather_points) {
+		if (!gather_point.in_choice && !gather_point.name.empty() && gather_point.index < gather_at_index.size() && !gather_at_index[gather_point.index]) {
+			gather_at_index[gather_point.index] = &gather_point;
+		}
+	}
+
+	// NOTE: kept in the same order as get_all_gather_points, since the first one past the end of a choice wins
+	weave_gather_points.clear();
+	for (GatherPoint* gather_point : get_all_gather_points()) {
+		if (!gather_point->in_choice) {
+			weave_gather_points.push_back(gather_point);
+		}
+	}
+
+	stitch_index.clear();
+	for (std::size_t i = 0; i < stitches.size(); ++i) {
+		stitch_index.try_emplace(stitches[i].name, i);
+	}
+
+	label_index.clear();
+	for (GatherPoint* gather_point : get_all_gather_points()) {
+		label_index.try_emplace(gather_point->name);
+	}
+
+	// the nested knots were indexed above, so a choice picks up every label under it from its results
+	for (std::size_t i = 0; i < objects.size(); ++i) {
+		if (objects[i]->get_id() != ObjectId::Choice) {
+			continue;
+		}
+
+		auto add_choice_label = [this, i](const std::string& label_name) {
+			std::vector<std::size_t>& choice_indices = label_index[label_name];
+			if (choice_indices.empty() || choice_indices.back() != i) {
+				choice_indices.push_back(i);
+			}
+		};
+
+		InkObjectChoice* choice_object = static_cast<InkObjectChoice*>(objects[i]);
+		for (GatherPoint* label : choice_object->get_choice_labels()) {
+			add_choice_label(label->name);
+		}
+
+		for (Knot* result : choice_object->get_choice_result_knots()) {
+			for (const auto& label : result->label_index) {
+				add_choice_label(label.first);
+			}
+		}
+	}
+}
+
+const Stitch* Knot::find_stitch(const std::string& stitch_name) const {
+	auto stitch = stitch_index.find(stitch_name);
+	return stitch != stitch_index.end() ? &stitches[stitch->second] : nullptr;
+}
+
+KnotStatusStack::KnotStatusStack(std::initializer_list<KnotStatus> initial_frames) {
+	for (const KnotStatus& frame : initial_frames) {
+		push_back(frame);
+	}
+}
+
+void KnotStatusStack::index_back() {
+	std::size_t top = frames.size() - 1;
+	std::uint32_t below_named = top > 0 ? nearest_named[top - 1] : npos;
+	std::uint32_t below_named_nonfunction = top > 0 ? nearest_named_nonfunction[top - 1] : npos;
+
+	const Knot* knot = frames[top].knot;
+	bool named = !knot->name.empty();
+	nearest_named[top] = named ? static_cast<std::uint32_t>(top) : below_named;
+	nearest_named_nonfunction[top] = named && !knot->is_function ? static_cast<std::uint32_t>(top) : below_named_nonfunction;
+}
+
+void KnotStatusStack::push_back(const KnotStatus& frame) {
+	frames.push_back(frame);
+	nearest_named.push_back(npos);
+	nearest_named_nonfunction.push_back(npos);
+	index_back();
+}
+
+void KnotStatusStack::pop_back() {
+	frames.pop_back();
+	nearest_named.pop_back();
+	nearest_named_nonfunction.pop_back();
+}
+
+void KnotStatusStack::replace_back(const KnotStatus& frame) {
+	frames.back() = frame;
+	index_back();
+}
+
+void KnotStatusStack::clear() {
+	frames.clear();
+	nearest_named.clear();
+	nearest_named_nonfunction.clear();
+}
+
+void Knot::assign_choice_ordinals(std::uint32_t& next_ordinal) {
+	for (InkObject* object : objects) {
+		if (object->get_id() == ObjectId::Choice) {
+			static_cast<InkObjectChoice*>(object)->assign_ordinals(next_ordinal);
+		}
+
+		for (Knot* nested_knot : object->get_nested_knots()) {
+			nested_knot->assign_choice_ordinals(next_ordinal);
+		}
+	}
+}
+
+void Knot::assign_knot_ordinals(std::uint32_t& next_ordinal, std::vector<InkObject*>& stateful_objects, StoryReads& reads) {
+	auto last_part = [](const std::string& path) {
+		std::size_t dot_index = path.find_last_of('.');
+		return dot_index == std::string::npos ? path : path.substr(dot_index + 1);
+	};
+
+	auto add_object = [&](InkObject* object) {
+		if (object->has_runtime_state()) {
+			object->set_state_ordinal(static_cast<std::uint32_t>(stateful_objects.size()));
+			stateful_objects.push_back(object);
+		}
+
+		for (Knot* nested_knot : object->get_nested_knots()) {
+			nested_knot->assign_knot_ordinals(next_ordinal, stateful_objects, reads);
+		}
+	};
+
+	ordinal = next_ordinal++;
+	for (InkObject* object : objects) {
+		add_object(object);
+
+		// NOTE: an option's text belongs to its choice rather than to any knot, but can still hold sequences
+		if (object->get_id() == ObjectId::Choice) {
+			for (InkObject* text_object : static_cast<InkObjectChoice*>(object)->get_text_objects()) {
+				add_object(text_object);
+			}
+		}
+
+		// NOTE: a VAR or CONST's starting value isn't run as part of any step, but can still be a divert target
+		InkObject::ExpressionsVec all_expressions = object->get_all_expressions();
+		std::vector<const ExpressionParserV2::ShuntedExpression*> expressions{all_expressions.begin(), all_expressions.end()};
+		if (object->get_id() == ObjectId::GlobalVariable) {
+			expressions.push_back(&static_cast<InkObjectGlobalVariable*>(object)->get_value_expression());
+		}
+
+		for (const ExpressionParserV2::ShuntedExpression* expression : expressions) {
+			bool asks_turns_since = false;
+			bool has_variables = false;
+			std::vector<std::string> names;
+			for (const ExpressionParserV2::Token& token : expression->tokens) {
+				if (token.type == ExpressionParserV2::TokenType::Variable) {
+					names.push_back(last_part(token.variable_name));
+					has_variables = true;
+				} else if (token.type == ExpressionParserV2::TokenType::LiteralKnotName && token.value.index() == ExpressionParserV2::Variant_String) {
+					names.push_back(last_part(static_cast<std::string>(token.value)));
+				} else if (token.type == ExpressionParserV2::TokenType::Function && token.value.index() == ExpressionParserV2::Variant_String) {
+					std::string function = static_cast<std::string>(token.value);
+					asks_turns_since = asks_turns_since || function == "TURNS_SINCE";
+					reads.turns = reads.turns || function == "TURNS";
+				}
+			}
+
+			reads.count_names.insert(names.begin(), names.end());
+			if (asks_turns_since) {
+				// NOTE: which of the expression's names TURNS_SINCE is handed isn't worked out, so they all count
+				reads.turns_since_names.insert(names.begin(), names.end());
+				reads.turns_since_any = reads.turns_since_any || has_variables;
+			}
+		}
+
+		// NOTE: a divert's arguments aren't among its expressions, but can hand a knot to a function that reads its count
+		if (object->get_id() == ObjectId::Divert) {
+			std::unordered_set<std::string> divert_names;
+			object->collect_referenced_names(divert_names);
+			for (const std::string& name : divert_names) {
+				reads.count_names.insert(last_part(name));
+			}
+		}
+	}
+}
+
+void Knot::describe_choices(const std::string& location, std::vector<std::string>& descriptions) const {
+	for (InkObject* object : objects) {
+		if (object->get_id() == ObjectId::Choice) {
+			static_cast<const InkObjectChoice*>(object)->describe_options(location, descriptions);
+		}
+
+		for (Knot* nested_knot : object->get_nested_knots()) {
+			nested_knot->describe_choices(location, descriptions);
+		}
+	}
+}
+
+void Knot::collect_referenced_names(std::unordered_set<std::string>& names) const {
+	for (const InkObject* object : objects) {
+		object->collect_referenced_names(names);
+	}
+}
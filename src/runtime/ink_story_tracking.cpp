@@ -1,38 +1,78 @@
 #include "runtime/ink_story_tracking.h"
 
+#include "ink_utils.h"
+
 #include <format>
 
-void InkStoryTracking::increment_visit_count(Knot* knot, Stitch* stitch, GatherPoint* gather_point) {
-	if (gather_point) {
-		auto& entry = gather_point_stats[gather_point->uuid];
+void InkStoryTracking::increment_visit_count(const Knot* knot, const Stitch* stitch, const GatherPoint* gather_point) {
+	auto visit = [this](Uuid uuid, SubKnotStats& entry) {
+		if (entry.count_is_read) {
+			visits_hash ^= visit_hash(uuid, entry.times_visited) ^ visit_hash(uuid, entry.times_visited + 1);
+		}
+
+		if (entry.turns_are_read) {
+			turns_hash ^= turns_hash_entry(uuid, entry.turns_since_visited) ^ turns_hash_entry(uuid, 0);
+		}
+
 		++entry.times_visited;
 		entry.turns_since_visited = 0;
+	};
+
+	if (gather_point) {
+		visit(gather_point->uuid, gather_point_stats[gather_point->uuid]);
 	} else if (stitch) {
-		auto& entry = stitch_stats[stitch->uuid];
-		++entry.times_visited;
-		entry.turns_since_visited = 0;
+		visit(stitch->uuid, stitch_stats[stitch->uuid]);
 	} else if (knot) {
-		auto& entry = knot_stats[knot->uuid];
-		++entry.times_visited;
-		entry.turns_since_visited = 0;
+		visit(knot->uuid, knot_stats[knot->uuid]);
 	}
 }
 
+void InkStoryTracking::rehash_visits() {
+	visits_hash = 0;
+	turns_hash = 0;
+	auto add_visits = [this](const auto& stats) {
+		for (const auto& [uuid, entry] : stats) {
+			if (entry.count_is_read) {
+				visits_hash ^= visit_hash(uuid, entry.times_visited);
+			}
+
+			if (entry.turns_are_read) {
+				turns_hash ^= turns_hash_entry(uuid, entry.turns_since_visited);
+			}
+		}
+	};
+
+	add_visits(knot_stats);
+	add_visits(stitch_stats);
+	add_visits(gather_point_stats);
+}
+
+std::uint64_t InkStoryTracking::visit_hash(Uuid uuid, std::size_t times_visited) {
+	// NOTE: nothing visited hashes to nothing, so content that hasn't been reached yet doesn't need an entry
+	return times_visited == 0 ? 0 : mix_hash((static_cast<std::uint64_t>(uuid.get()) << 32) ^ times_visited);
+}
+
+std::uint64_t InkStoryTracking::turns_hash_entry(Uuid uuid, std::int64_t turns_since_visited) {
+	return mix_hash(mix_hash(uuid.get()) ^ static_cast<std::uint64_t>(turns_since_visited));
+}
+
 void InkStoryTracking::increment_turns_since() {
-	for (auto& knot : knot_stats) {
-		++knot.second.turns_since_visited;
-	}
+	auto increment = [this](auto& stats) {
+		for (auto& [uuid, entry] : stats) {
+			if (entry.turns_are_read) {
+				turns_hash ^= turns_hash_entry(uuid, entry.turns_since_visited) ^ turns_hash_entry(uuid, entry.turns_since_visited + 1);
+			}
 
-	for (auto& stitch : stitch_stats) {
-		++stitch.second.turns_since_visited;
-	}
+			++entry.turns_since_visited;
+		}
+	};
 
-	for (auto& gather_point : gather_point_stats) {
-		++gather_point.second.turns_since_visited;
-	}
+	increment(knot_stats);
+	increment(stitch_stats);
+	increment(gather_point_stats);
 }
 
-bool InkStoryTracking::get_content_stats(InkWeaveContent* content, InkStoryTracking::SubKnotStats& result) {
+bool InkStoryTracking::get_content_stats(const InkWeaveContent* content, InkStoryTracking::SubKnotStats& result) {
 	if (auto knot = knot_stats.find(content->uuid); knot != knot_stats.end()) {
 		result = knot->second;
 		return true;
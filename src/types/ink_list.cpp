@@ -5,6 +5,7 @@
 #include "ink_utils.h"
 
 #include <optional>
+#include <algorithm>
 
 std::optional<std::int64_t> InkListDefinition::get_entry_value(const std::string& entry) const {
 	if (auto found_entry = list_entries.find(entry); found_entry != list_entries.end()) {
@@ -209,6 +210,16 @@ InkList InkList::inverted() const {
 	return result;
 }
 
+std::size_t InkList::heap_bytes() const {
+	// NOTE: each set and hash set node also carries a few pointers alongside what it stores
+	std::size_t result = all_origins.size() * (sizeof(Uuid) + 2 * sizeof(void*));
+	for (const InkListItem& item : current_values) {
+		result += sizeof(InkListItem) + 4 * sizeof(void*) + item.label.capacity() + item.origin_list_name.capacity();
+	}
+
+	return result;
+}
+
 std::int64_t InkList::value() const {
 	return max_item().value;
 }
@@ -403,9 +414,11 @@ ByteVec Serializer<InkListItem>::operator()(const InkListItem& item) {
 	ByteVec result = sstring(item.label);
 	ByteVec result2 = svalue(item.value);
 	ByteVec result3 = sorigin(item.origin_list_uuid);
+	ByteVec result4 = sstring(item.origin_list_name);
 
 	result.insert(result.end(), result2.begin(), result2.end());
 	result.insert(result.end(), result3.begin(), result3.end());
+	result.insert(result.end(), result4.begin(), result4.end());
 	return result;
 }
 
@@ -417,8 +430,9 @@ InkListItem Deserializer<InkListItem>::operator()(const ByteVec& bytes, std::siz
 	std::string label = dsstring(bytes, index);
 	std::int64_t value = dsvalue(bytes, index);
 	Uuid origin = dsorigin(bytes, index);
+	std::string origin_name = dsstring(bytes, index);
 
-	return InkListItem(label, value, origin, std::string());
+	return InkListItem(label, value, origin, origin_name);
 }
 
 ByteVec Serializer<InkList>::operator()(const InkList& list) {
@@ -452,3 +466,74 @@ InkListDefinition::Entry Deserializer<InkListDefinition::Entry>::operator()(cons
 
 	return result;
 }
+
+ByteVec Serializer<InkListDefinition>::operator()(const InkListDefinition& definition) {
+	Serializer<std::string> sstring;
+	Serializer<Uuid> suuid;
+	VectorSerializer<InkListDefinition::Entry> vsentry;
+
+	std::vector<InkListDefinition::Entry> entries;
+	entries.reserve(definition.list_entries.size());
+	for (const auto& entry : definition.list_entries) {
+		entries.push_back({entry.first, entry.second, false});
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const InkListDefinition::Entry& a, const InkListDefinition::Entry& b) { return a.value < b.value; });
+
+	ByteVec result = sstring(definition.name);
+	ByteVec result2 = suuid(definition.uuid);
+	ByteVec result3 = vsentry(entries);
+
+	result.insert(result.end(), result2.begin(), result2.end());
+	result.insert(result.end(), result3.begin(), result3.end());
+	return result;
+}
+
+InkListDefinition Deserializer<InkListDefinition>::operator()(const ByteVec& bytes, std::size_t& index) {
+	Deserializer<std::string> dsstring;
+	Deserializer<Uuid> dsuuid;
+	VectorDeserializer<InkListDefinition::Entry> vdsentry;
+
+	std::string name = dsstring(bytes, index);
+	Uuid uuid = dsuuid(bytes, index);
+	std::vector<InkListDefinition::Entry> entries = vdsentry(bytes, index);
+
+	return InkListDefinition(name, entries, uuid);
+}
+
+ByteVec Serializer<InkListDefinitionMap>::operator()(const InkListDefinitionMap& definition_map) {
+	Serializer<Uuid> suuid;
+	Serializer<std::uint16_t> ssize;
+	Serializer<InkListDefinition> sdefinition;
+
+	ByteVec result = suuid(Uuid(definition_map.current_list_definition_uuid));
+	ByteVec size_bytes = ssize(static_cast<std::uint16_t>(definition_map.defined_lists.size()));
+	result.insert(result.end(), size_bytes.begin(), size_bytes.end());
+
+	// NOTE: write definitions in uuid order so the output doesn't depend on hash table layout
+	for (UuidValue i = 0; i < definition_map.current_list_definition_uuid; ++i) {
+		if (auto definition = definition_map.defined_lists.find(Uuid(i)); definition != definition_map.defined_lists.end()) {
+			ByteVec definition_bytes = sdefinition(definition->second);
+			result.insert(result.end(), definition_bytes.begin(), definition_bytes.end());
+		}
+	}
+
+	return result;
+}
+
+InkListDefinitionMap Deserializer<InkListDefinitionMap>::operator()(const ByteVec& bytes, std::size_t& index) {
+	Deserializer<Uuid> dsuuid;
+	Deserializer<std::uint16_t> dssize;
+	Deserializer<InkListDefinition> dsdefinition;
+
+	InkListDefinitionMap result;
+	result.current_list_definition_uuid = dsuuid(bytes, index).get();
+	std::uint16_t size = dssize(bytes, index);
+	result.defined_lists.reserve(size);
+	for (std::uint16_t i = 0; i < size; ++i) {
+		InkListDefinition definition = dsdefinition(bytes, index);
+		result.defined_lists.emplace(definition.get_uuid(), std::move(definition));
+	}
+
+	return result;
+}
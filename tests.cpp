@@ -2,12 +2,65 @@
 
 #include "ink_compiler.h"
 #include "runtime/ink_story.h"
+#include "runtime/ink_story_host.h"
 #include "ink_utils.h"
 
 #include "expression_parser/expression_parser.h"
+#include "objects/ink_object_text.h"
 
 #include <utility>
 #include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <new>
+#include <random>
+#include <format>
+
+// while set, every heap allocation made on this thread is counted, for tests checking that a path doesn't allocate
+thread_local std::size_t* allocation_counter = nullptr;
+
+void* operator new(std::size_t size) {
+	if (allocation_counter) {
+		++*allocation_counter;
+	}
+
+	if (void* memory = std::malloc(size > 0 ? size : 1)) {
+		return memory;
+	}
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+	std::free(memory);
+}
+
+// a file in the temp directory that belongs to the running test alone, so tests run side by side (or by two builds at once) never write to the same one; removed once it goes out of scope
+struct TestTempFile {
+	std::string path;
+
+	explicit TestTempFile(const std::string& extension) {
+		static const std::uint32_t run_id = std::random_device()();
+		const testing::TestInfo* test = testing::UnitTest::GetInstance()->current_test_info();
+		std::string name = std::format("inkcpp_{:08x}_{}_{}{}", run_id, test->test_suite_name(), test->name(), extension);
+		std::replace(name.begin(), name.end(), '/', '_');
+		path = (std::filesystem::temp_directory_path() / name).string();
+	}
+
+	~TestTempFile() {
+		std::error_code error;
+		std::filesystem::remove(path, error);
+	}
+
+	TestTempFile(const TestTempFile&) = delete;
+	TestTempFile& operator=(const TestTempFile&) = delete;
+};
 
 #define FIXTURE(name) class name : public testing::Test {\
 protected:\
@@ -18,6 +71,10 @@ protected:\
 //#define STORY(path) compiler.compile_file_to_file(INKCPP_WORKING_DIR "/tests/" path, std::string(INKCPP_WORKING_DIR "/tests/" path) + "b");
 //	InkStory story{std::string(INKCPP_WORKING_DIR "/tests/" path) + "b"};
 
+#define INKB_STORY(story_path) TestTempFile inkb_file{".inkb"};\
+	compiler.compile_file_to_file(INKCPP_WORKING_DIR "/tests/" story_path, inkb_file.path);\
+	InkStory story{inkb_file.path}
+
 #define EXPECT_TEXT(...) {\
 		std::vector<std::string> seq = {__VA_ARGS__};\
 		for (const std::string& expected_text : seq) {\
@@ -76,6 +133,10 @@ FIXTURE(MiscBugTests);
 FIXTURE(LongExampleTests);
 
 FIXTURE(MiscellaneousTests);
+FIXTURE(InkbTests);
+FIXTURE(IncrementalTests);
+FIXTURE(OptimizationTests);
+FIXTURE(StoryHostTests);
 
 FIXTURE(InkProof);
 
@@ -123,6 +184,103 @@ TEST_F(NonStoryFunctionTests, InkListFunctions) {
 	EXPECT_FALSE(weekends < best_days);
 	EXPECT_TRUE(weekends <= best_days);
 }
+
+TEST_F(NonStoryFunctionTests, ObjectArenaAllocation) {
+	class CountingResource : public std::pmr::memory_resource {
+	public:
+		std::size_t allocations = 0;
+
+	private:
+		void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+			++allocations;
+			return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+		}
+
+		void do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment) override {
+			std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+		}
+
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+			return this == &other;
+		}
+	};
+
+	CountingResource upstream;
+	{
+		InkObjectArena arena{16384, &upstream};
+		std::vector<InkObject*> objects;
+		{
+			InkObject::ArenaScope scope{&arena};
+			for (int i = 0; i < 50; ++i) {
+				objects.push_back(new InkObjectText("text"));
+			}
+		}
+
+		EXPECT_EQ(upstream.allocations, 1);
+
+		InkObject* heap_object = new InkObjectText("text");
+		EXPECT_EQ(upstream.allocations, 1);
+		delete heap_object;
+
+		for (InkObject* object : objects) {
+			delete object;
+		}
+	}
+}
+
+TEST_F(NonStoryFunctionTests, KnotStatusStackTracksNamedFrames) {
+	Knot story_knot;
+	story_knot.name = "story";
+	Knot function_knot;
+	function_knot.name = "function";
+	function_knot.is_function = true;
+	Knot anonymous_knot;
+
+	KnotStatusStack stack{{&story_knot, 0}};
+	stack.push_back({&anonymous_knot, 0});
+	stack.push_back({&function_knot, 0});
+	stack.push_back({&anonymous_knot, 0});
+	EXPECT_EQ(stack.named_at_or_below(3), 2);
+	EXPECT_EQ(stack.named_nonfunction_at_or_below(3), 0);
+	EXPECT_EQ(stack.named_at_or_below(1), 0);
+
+	stack.replace_back({&story_knot, 0});
+	EXPECT_EQ(stack.named_at_or_below(3), 3);
+	EXPECT_EQ(stack.named_nonfunction_at_or_below(3), 3);
+
+	stack.pop_back();
+	stack.pop_back();
+	EXPECT_EQ(stack.named_nonfunction_at_or_below(1), 0);
+
+	KnotStatusStack anonymous_stack{{&anonymous_knot, 0}};
+	EXPECT_EQ(anonymous_stack.named_at_or_below(0), KnotStatusStack::npos);
+}
+
+TEST_F(NonStoryFunctionTests, Pcg32MatchesReference) {
+	static_assert(sizeof(Pcg32) == 16 && std::is_trivially_copyable_v<Pcg32>);
+
+	// the first numbers from the PCG reference implementation's demo, seeded with 42 on stream 54
+	Pcg32 generator{42, 54};
+	std::vector<std::uint32_t> drawn;
+	for (int i = 0; i < 6; ++i) {
+		drawn.push_back(generator());
+	}
+
+	EXPECT_EQ(drawn, (std::vector<std::uint32_t>{0xa15c02b7, 0x7b47f409, 0xba1d3330, 0x83d2f293, 0xbfa4784b, 0xcbed606e}));
+
+	Pcg32 skipped{42, 54};
+	skipped.discard(6);
+	EXPECT_EQ(skipped, generator);
+
+	Pcg32 split = generator.split(1);
+	EXPECT_NE(split(), Pcg32{generator}());
+	EXPECT_NE(Pcg32(7, 1)(), Pcg32(7, 2)());
+
+	for (int i = 0; i < 1000; ++i) {
+		std::int64_t value = randi_range(-3, 3, generator);
+		EXPECT_TRUE(value >= -3 && value <= 3);
+	}
+}
 #pragma endregion
 
 #pragma region ExpressionParserTests
@@ -958,6 +1116,102 @@ TEST_F(GlobalVariableTests, PrintingVariables) {
 	EXPECT_TEXT("My name is Jean Passepartout, but my friends call me Jackie. I'm 23 years old.");
 }
 
+TEST_F(GlobalVariableTests, WatchersHearOncePerLine) {
+	std::string script = R"(VAR counter = 0
+VAR mood = "calm"
+VAR unwatched = 0
+~ temp i = 0
+- (loop)
+~ counter++
+~ unwatched++
+~ i++
+{i < 100: -> loop}
+Counted to {counter}.
+Still {flip()}.
+Now {anger()}.
+
+=== function flip()
+~ mood = "tense"
+~ mood = "calm"
+~ return mood
+
+=== function anger()
+~ mood = "angry"
+~ return mood
+)";
+
+	InkStory story = compiler.compile_script(script);
+	std::vector<std::string> changes;
+	auto watcher = [&changes](const std::string& name, const ExpressionParserV2::Variant& old_value, const ExpressionParserV2::Variant& new_value) {
+		changes.push_back(std::format("{}: {} -> {}", name, old_value.to_printable_string(), new_value.to_printable_string()));
+	};
+
+	story.watch_variable_changes("counter", watcher);
+	story.watch_variable_changes("mood", watcher);
+
+	EXPECT_TEXT("Counted to 100.");
+	EXPECT_EQ(changes, std::vector<std::string>{"counter: 0 -> 100"});
+
+	// a variable that ends the line where it started isn't reported
+	changes.clear();
+	EXPECT_TEXT("Still calm.");
+	EXPECT_TRUE(changes.empty());
+
+	story.unwatch_variable_changes("counter");
+	story.set_variable("counter", 5);
+	EXPECT_TEXT("Now angry.");
+	EXPECT_EQ(changes, std::vector<std::string>{"mood: calm -> angry"});
+}
+
+TEST_F(GlobalVariableTests, SnapshotsAreConsistentAcrossThreads) {
+	std::string script = R"(VAR a = 0
+VAR b = 0
+- (top)
+~ a++
+~ b++
+Line {a}.
+{a < 300: -> top}
+Done.
+)";
+
+	InkStory story = compiler.compile_script(script);
+	EXPECT_EQ(story.get_variable_snapshot(), nullptr);
+	EXPECT_TEXT("Line 1.");
+	story.set_variable_snapshots(true);
+	ASSERT_NE(story.get_variable_snapshot(), nullptr);
+	EXPECT_EQ(story.get_variable_snapshot()->get_variable("a")->to_printable_string(), story.get_variable("a")->to_printable_string());
+
+	// a and b only ever change together within a line, so no snapshot may show them apart
+	std::atomic<bool> done = false;
+	std::atomic<std::size_t> mismatches = 0;
+	std::jthread reader{[&story, &done, &mismatches]() {
+		std::uint64_t last_epoch = 0;
+		while (!done) {
+			std::shared_ptr<const VariableSnapshot> snapshot = story.get_variable_snapshot();
+			if (snapshot->epoch < last_epoch || static_cast<std::int64_t>(*snapshot->get_variable("a")) != static_cast<std::int64_t>(*snapshot->get_variable("b"))) {
+				++mismatches;
+			}
+
+			last_epoch = snapshot->epoch;
+		}
+	}};
+
+	while (story.can_continue()) {
+		story.continue_story();
+	}
+
+	done = true;
+	reader.join();
+	EXPECT_EQ(mismatches, 0);
+
+	std::shared_ptr<const VariableSnapshot> last = story.get_variable_snapshot();
+	EXPECT_EQ(last->get_variable("a")->to_printable_string(), "300");
+	EXPECT_FALSE(last->get_variable("missing").has_value());
+
+	story.set_variable_snapshots(false);
+	EXPECT_EQ(story.get_variable_snapshot(), nullptr);
+}
+
 /*TEST_F(GlobalVariableTests, EvalLogicInString) {
 	// TODO: string logic
 	STORY("13_global_variables/13d_string_logic.ink");
@@ -1911,6 +2165,830 @@ TEST_F(MiscellaneousTests, VariableObservation) {
 }
 #pragma endregion
 
+#pragma region Inkb Tests
+TEST_F(InkbTests, ListDefinitions) {
+	INKB_STORY("21_lists/21s_multi_list_lists.ink");
+	InkStory compiled_story = compiler.compile_file(INKCPP_WORKING_DIR "/tests/21_lists/21s_multi_list_lists.ink");
+
+	const auto& definitions = story.get_list_definitions();
+	ASSERT_EQ(definitions.size(), compiled_story.get_list_definitions().size());
+	for (const auto& definition : compiled_story.get_list_definitions()) {
+		ASSERT_TRUE(definitions.contains(definition.first));
+		EXPECT_EQ(definitions.at(definition.first).get_name(), definition.second.get_name());
+	}
+
+	EXPECT_EQ(definitions.at(Uuid(0)).get_entry_value("Robin"), std::optional<std::int64_t>(3));
+}
+
+TEST_F(InkbTests, MultiListLists) {
+	INKB_STORY("21_lists/21s_multi_list_lists.ink");
+	EXPECT_TEXT(
+		"ballroom:",
+		"Alfred is here, standing quietly in a corner. Batman's presence dominates all. On one table, a headline blares out WHO IS THE BATMAN? AND *WHO* IS HIS BARELY-REMEMBERED ASSISTANT?",
+		"hallway:",
+		"Robin is all but forgotten. A champagne glass lies discarded on the floor.",
+		"To reiterate, Batman and Alfred are in the ballroom.",
+	);
+}
+
+TEST_F(InkbTests, ListNumbersToValues) {
+	INKB_STORY("21_lists/21h_list_numbers_to_values.ink");
+	EXPECT_TEXT("You have two points");
+}
+
+TEST_F(InkbTests, MultithreadedLoad) {
+	TestTempFile inkb_file{".inkb"};
+	compiler.compile_file_to_file(INKCPP_WORKING_DIR "/tests/23_long_examples/23b_crime_scene.ink", inkb_file.path);
+	InkStory story{inkb_file.path, 4};
+
+	EXPECT_TEXT("The bedroom. This is where it happened. Now to look for clues.");
+	EXPECT_CHOICES("The bed...", "The desk...", "The window...");
+	story.choose_choice_index(0);
+
+	EXPECT_TEXT("The bed was low to the ground, but not so low something might not roll underneath. It was still neatly made.");
+	EXPECT_CHOICES("Lift the bedcover", "Test the bed", "Look under the bed");
+}
+
+TEST_F(InkbTests, PhaseTimings) {
+	TestTempFile inkb_file{".inkb"};
+	compiler.compile_file_to_file(INKCPP_WORKING_DIR "/tests/23_long_examples/23b_crime_scene.ink", inkb_file.path);
+
+	const InkCompiler::PhaseTimings& timings = compiler.get_phase_timings();
+	EXPECT_GT(timings.lex, 0.0);
+	EXPECT_GT(timings.compile, 0.0);
+	EXPECT_GT(timings.serialize, 0.0);
+}
+
+TEST_F(InkbTests, MultithreadedIncludes) {
+	TestTempFile single_file{"_single.inkb"};
+	TestTempFile multi_file{"_multi.inkb"};
+	const std::string& single_path = single_file.path;
+	const std::string& multi_path = multi_file.path;
+
+	compiler.compile_file_to_file(INKCPP_WORKING_DIR "/tests/ink-proof/24_includes.ink", single_path);
+
+	InkCompiler multi_compiler;
+	multi_compiler.set_max_threads(4);
+	multi_compiler.compile_file_to_file(INKCPP_WORKING_DIR "/tests/ink-proof/24_includes.ink", multi_path);
+
+	auto read_bytes = [](const std::string& path) {
+		std::ifstream file{path, std::ios::binary};
+		return std::vector<char>{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+	};
+
+	EXPECT_EQ(read_bytes(single_path), read_bytes(multi_path));
+
+	InkStory story{multi_path};
+	EXPECT_TEXT("This is include 1.", "This is include 2.", "This is the main file.");
+}
+
+TEST_F(InkbTests, Sequences) {
+	INKB_STORY("8_variable_text/8a_sequence.ink");
+	EXPECT_TEXT("I bought a coffee with my five-pound note.");
+	EXPECT_CHOICES("Buy another one");
+	story.choose_choice_index(0);
+	EXPECT_TEXT("I bought a second coffee for my friend.");
+}
+#pragma endregion
+
+#pragma region IncrementalTests
+TEST_F(IncrementalTests, ReusesUnchangedKnots) {
+	TestTempFile cache_file{".inkc"};
+	compiler.set_knot_cache_file(cache_file.path);
+
+	std::string script = "-> start\n== start ==\nHello.\n-> middle\n== middle ==\nThe middle.\n-> finish\n== finish ==\nThe end.\n-> END\n";
+	{
+		InkStory story = compiler.compile_script(script);
+		EXPECT_TEXT("Hello.", "The middle.", "The end.");
+		EXPECT_EQ(compiler.get_knot_cache().get_reused_count(), 0);
+		EXPECT_EQ(compiler.get_knot_cache().get_compiled_count(), 4);
+	}
+
+	std::string edited_script = script;
+	edited_script.replace(edited_script.find("The middle."), 11, "The edited middle.");
+	{
+		InkStory story = compiler.compile_script(edited_script);
+		EXPECT_TEXT("Hello.", "The edited middle.", "The end.");
+		EXPECT_EQ(compiler.get_knot_cache().get_reused_count(), 3);
+		EXPECT_EQ(compiler.get_knot_cache().get_compiled_count(), 1);
+	}
+}
+
+TEST_F(IncrementalTests, CachedBuildMatchesFullBuild) {
+	TestTempFile cache_file{".inkc"};
+	TestTempFile full_file{"_full.inkb"};
+	TestTempFile cached_file{"_cached.inkb"};
+	const std::string& cache_path = cache_file.path;
+	const std::string& full_path = full_file.path;
+	const std::string& cached_path = cached_file.path;
+
+	compiler.compile_file_to_file(INKCPP_WORKING_DIR "/tests/23_long_examples/23b_crime_scene.ink", full_path);
+
+	InkCompiler cached_compiler;
+	cached_compiler.set_knot_cache_file(cache_path);
+	cached_compiler.compile_file_to_file(INKCPP_WORKING_DIR "/tests/23_long_examples/23b_crime_scene.ink", cached_path);
+	cached_compiler.compile_file_to_file(INKCPP_WORKING_DIR "/tests/23_long_examples/23b_crime_scene.ink", cached_path);
+	EXPECT_GT(cached_compiler.get_knot_cache().get_reused_count(), 0);
+
+	auto read_bytes = [](const std::string& path) {
+		std::ifstream file{path, std::ios::binary};
+		return std::vector<char>{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+	};
+
+	EXPECT_EQ(read_bytes(full_path), read_bytes(cached_path));
+}
+
+TEST_F(IncrementalTests, ExternalDeclarationsAreCached) {
+	TestTempFile cache_file{".inkc"};
+	compiler.set_knot_cache_file(cache_file.path);
+
+	auto shout = [](const std::vector<ExpressionParserV2::Variant>& arguments) -> ExpressionParserV2::Variant {
+		return static_cast<std::string>(arguments[0]) + "!";
+	};
+
+	std::string script = "EXTERNAL shout(x)\n-> start\n== start ==\n{shout(\"hello\")}\n-> END\n";
+	for (std::size_t build = 0; build < 2; ++build) {
+		InkStory story = compiler.compile_script(script);
+		EXPECT_EQ(compiler.get_knot_cache().get_reused_count(), build == 0 ? 0 : 2);
+		story.bind_external_function("shout", shout);
+		EXPECT_TEXT("hello!");
+	}
+
+	// without the declaration, the same knot calls a knot function instead, so it mustn't come from the cache
+	std::string without_external = "-> start\n== start ==\n{shout(\"hello\")}\n-> END\n== function shout(x)\n~ return x + \"?\"\n";
+	InkStory story = compiler.compile_script(without_external);
+	EXPECT_EQ(compiler.get_knot_cache().get_reused_count(), 0);
+	EXPECT_TEXT("hello?");
+}
+#pragma endregion
+
+#pragma region OptimizationTests
+TEST_F(OptimizationTests, StripsUnreachableKnots) {
+	std::string script =
+		"VAR target = -> stored\n"
+		"Start {double(2)}.\n"
+		"-> used\n"
+		"=== used\n"
+		"Used. {unused_read > 0}\n"
+		"-> target\n"
+		"=== stored\n"
+		"Stored.\n"
+		"-> END\n"
+		"=== unused_read\n"
+		"Read.\n"
+		"-> END\n"
+		"=== debug\n"
+		"Debug. {triple(1)}\n"
+		"-> END\n"
+		"=== function double(x)\n"
+		"~ return x * 2\n"
+		"=== function triple(x)\n"
+		"~ return x * 3\n";
+
+	compiler.set_strip_unreachable(true);
+	InkStory story = compiler.compile_script(script);
+	std::vector<std::string> stripped = compiler.get_stripped_knots();
+	std::sort(stripped.begin(), stripped.end());
+	EXPECT_EQ(stripped, std::vector<std::string>({"debug", "triple"}));
+
+	EXPECT_TEXT("Start 4.", "Used. false", "Stored.");
+
+	InkCompiler entry_compiler;
+	entry_compiler.set_strip_unreachable(true);
+	entry_compiler.add_entry_point("debug");
+	entry_compiler.compile_script(script);
+	EXPECT_TRUE(entry_compiler.get_stripped_knots().empty());
+
+	InkCompiler bad_entry_compiler;
+	bad_entry_compiler.set_strip_unreachable(true);
+	bad_entry_compiler.add_entry_point("missing");
+	EXPECT_THROW(bad_entry_compiler.compile_script(script), std::runtime_error);
+}
+
+TEST_F(OptimizationTests, MergesAdjacentObjects) {
+	STORY("23_long_examples/23b_crime_scene.ink");
+	const InkCompiler::ObjectCounts& counts = compiler.get_merged_object_counts();
+	EXPECT_LT(counts.after, counts.before);
+
+	EXPECT_TEXT("The bedroom. This is where it happened. Now to look for clues.");
+	EXPECT_CHOICES("The bed...", "The desk...", "The window...");
+	story.choose_choice_index(0);
+
+	EXPECT_TEXT("The bed was low to the ground, but not so low something might not roll underneath. It was still neatly made.");
+	EXPECT_CHOICES("Lift the bedcover", "Test the bed", "Look under the bed");
+}
+
+TEST_F(OptimizationTests, ContinueWithoutAllocating) {
+	InkStory story = compiler.compile_script(
+		"Line one.\n"
+		"Line two.\n"
+		"- (top) Gathered.\n"
+		"* [Pick] Picked.\n"
+		"  Inside.\n"
+		"  Still inside.\n"
+		"- (after) Rejoined.\n"
+		"Line three.\n"
+		"Done.\n"
+	);
+
+	// NOTE: every line is short enough to live inside std::string, so any allocation would have come from stepping through the story
+	auto expect_no_allocations = [&story](const std::string& expected_text) {
+		std::size_t allocations = 0;
+		allocation_counter = &allocations;
+		std::string text = story.continue_story();
+		allocation_counter = nullptr;
+
+		EXPECT_EQ(text, expected_text);
+		EXPECT_EQ(allocations, 0) << expected_text;
+	};
+
+	expect_no_allocations("Line one.");
+	expect_no_allocations("Line two.");
+	EXPECT_TEXT("Gathered.");
+	EXPECT_CHOICES("Pick");
+	story.choose_choice_index(0);
+
+	EXPECT_TEXT("Picked.");
+	expect_no_allocations("Inside.");
+	expect_no_allocations("Still inside.");
+	expect_no_allocations("Rejoined.");
+	expect_no_allocations("Line three.");
+	expect_no_allocations("Done.");
+}
+
+TEST_F(OptimizationTests, ChoicesTakenAreBits) {
+	InkStory story = compiler.compile_script(
+		"-> hub\n"
+		"=== hub\n"
+		"* [A] -> hub\n"
+		"* [B] -> hub\n"
+		"+ [C] -> other\n"
+		"=== other\n"
+		"* [D] -> END\n"
+	);
+
+	EXPECT_EQ(story.get_story_data()->assign_choice_ordinals(), 4);
+	story.continue_story();
+	EXPECT_CHOICES("A", "B", "C");
+	story.choose_choice_index(0);
+	story.continue_story();
+	EXPECT_CHOICES("B", "C");
+	story.choose_choice_index(0);
+	story.continue_story();
+	EXPECT_CHOICES("C");
+
+	const InkStoryState& state = story.get_story_state();
+	ASSERT_EQ(state.choices_taken.size(), 1);
+	EXPECT_EQ(state.choices_taken[0], 0b11);
+	EXPECT_TRUE(state.has_choice_been_taken(1));
+	EXPECT_FALSE(state.has_choice_been_taken(2));
+	EXPECT_FALSE(state.has_choice_been_taken(1000));
+}
+
+TEST_F(OptimizationTests, LabelIndexReachesNestedChoices) {
+	InkStory story = compiler.compile_script(
+		"-> scene\n"
+		"=== scene\n"
+		"Start.\n"
+		"* (outer) [Outer] Took outer.\n"
+		"  ** (inner) [Inner] Took inner.\n"
+		"  -- (rejoin) Rejoined.\n"
+		"- -> part\n"
+		"= part\n"
+		"Counts {outer} {inner} {scene.outer} {missing}.\n"
+		"-> END\n"
+	);
+
+	EXPECT_TEXT("Start.");
+	const Knot* scene = story.get_story_state().current_knots_stack.front().knot;
+	ASSERT_EQ(scene->name, "scene");
+	EXPECT_TRUE(scene->stitch_index.contains("part"));
+	ASSERT_TRUE(scene->label_index.contains("inner"));
+	ASSERT_TRUE(scene->label_index.contains("rejoin"));
+	EXPECT_EQ(scene->label_index.at("inner"), scene->label_index.at("outer"));
+	EXPECT_FALSE(scene->label_index.contains("missing"));
+
+	story.choose_choice_index(0);
+	EXPECT_TEXT("Took outer.");
+	story.choose_choice_index(0);
+	EXPECT_TEXT("Took inner.", "Rejoined.", "Counts 1 1 1 0.");
+}
+
+TEST_F(OptimizationTests, StateHashIgnoresRoute) {
+	InkStory compiled = compiler.compile_script(
+		"-> hub\n"
+		"=== hub\n"
+		"- (top) Where next?\n"
+		"* [Left] Went left. -> top\n"
+		"* [Right] Went right. -> top\n"
+		"+ [Leave] -> leave\n"
+		"=== leave\n"
+		"Left {top} times. -> END\n"
+	);
+
+	ByteVec bytes = compiled.get_story_data()->get_serialized_bytes();
+	auto play = [&bytes](const std::vector<std::size_t>& path) {
+		std::unique_ptr<InkStory> story = std::make_unique<InkStory>(bytes, 1);
+		story->seed_random(0);
+		for (std::size_t choice : path) {
+			while (story->can_continue()) {
+				story->continue_story();
+			}
+
+			story->choose_choice_index(choice);
+		}
+
+		while (story->can_continue()) {
+			story->continue_story();
+		}
+
+		return story;
+	};
+
+	std::unique_ptr<InkStory> left_right = play({0, 0});
+	std::unique_ptr<InkStory> right_left = play({1, 0});
+	EXPECT_EQ(left_right->state_hash(), right_left->state_hash());
+	EXPECT_NE(left_right->state_hash(), play({0})->state_hash());
+	EXPECT_NE(left_right->state_hash(), play({0, 0, 0})->state_hash());
+
+	// looping back to a gather mustn't leave frames behind
+	EXPECT_EQ(left_right->get_story_state().current_knots_stack.size(), play({})->get_story_state().current_knots_stack.size());
+
+	std::unique_ptr<InkStory> reseeded = play({0, 0});
+	reseeded->seed_random(1);
+	EXPECT_NE(left_right->state_hash(), reseeded->state_hash());
+}
+
+TEST_F(OptimizationTests, StateHashCoversEverythingRead) {
+	InkStory compiled = compiler.compile_script(
+		"VAR target = -> place\n"
+		"-> hub\n"
+		"=== hub\n"
+		"- (top) Where next?\n"
+		"* [Left] -> left\n"
+		"* [Right] -> right\n"
+		"+ [Leave] -> leave\n"
+		"=== left\n"
+		"-> hub.top\n"
+		"=== right\n"
+		"-> hub.top\n"
+		"=== place\n"
+		"-> END\n"
+		"=== unread\n"
+		"-> END\n"
+		"=== leave\n"
+		"{READ_COUNT(target)} {TURNS_SINCE(-> right)} -> END\n"
+	);
+
+	ByteVec bytes = compiled.get_story_data()->get_serialized_bytes();
+	auto play = [&bytes](const std::vector<std::size_t>& path) {
+		std::unique_ptr<InkStory> story = std::make_unique<InkStory>(bytes, 1);
+		story->seed_random(0);
+		for (std::size_t choice : path) {
+			while (story->can_continue()) {
+				story->continue_story();
+			}
+
+			story->choose_choice_index(choice);
+		}
+
+		while (story->can_continue()) {
+			story->continue_story();
+		}
+
+		return story;
+	};
+
+	// a count only read through a divert target that a VAR starts out holding is still read
+	std::unique_ptr<InkStory> story = play({});
+	for (const auto& [uuid, stats] : story->get_story_state().story_tracking.knot_stats) {
+		if (stats.name == "place" || stats.name == "unread") {
+			EXPECT_EQ(stats.count_is_read, stats.name == "place") << stats.name;
+		}
+
+		EXPECT_EQ(stats.turns_are_read, stats.name == "right") << stats.name;
+	}
+
+	// taking the same choices in another order leaves the turns since one of them, which the story asks about, different
+	EXPECT_NE(play({0, 0})->state_hash(), play({1, 0})->state_hash());
+	EXPECT_EQ(play({0, 0})->state_hash(), play({0, 0})->recompute_state_hash());
+}
+
+TEST_F(OptimizationTests, StateHashKeptUpToDate) {
+	InkStory story = compiler.compile_script(
+		"VAR gold = 0\n"
+		"-> shop\n"
+		"=== shop\n"
+		"- (top) {&Hello|Welcome back}. You have {gold} gold.\n"
+		"* [{~Rob|Mug} the till]\n"
+		"  ~ earn(gold, 5)\n"
+		"  -> top\n"
+		"+ [Wait {top} turns]\n"
+		"  ~ gold++\n"
+		"  -> top\n"
+		"+ [Leave] -> END\n"
+		"=== function earn(ref amount, by)\n"
+		"~ amount += by\n"
+	);
+
+	story.seed_random(3);
+	for (std::size_t choice : {0, 0, 0, 1}) {
+		while (story.can_continue()) {
+			story.continue_story();
+			EXPECT_EQ(story.state_hash(), story.recompute_state_hash());
+		}
+
+		story.choose_choice_index(choice);
+		EXPECT_EQ(story.state_hash(), story.recompute_state_hash());
+	}
+
+	EXPECT_EQ(story.get_variable("gold")->to_printable_string(), "7");
+}
+
+TEST_F(OptimizationTests, ResetPlaysLikeReloading) {
+	InkStory compiled = compiler.compile_file(INKCPP_WORKING_DIR "/tests/23_long_examples/23b_crime_scene.ink");
+	ByteVec bytes = compiled.get_story_data()->get_serialized_bytes();
+
+	auto play = [](InkStory& story, std::uint32_t seed) {
+		story.seed_random(seed);
+		std::vector<std::string> transcript;
+		for (std::size_t turn = 0; turn < 40; ++turn) {
+			while (story.can_continue()) {
+				transcript.push_back(story.continue_story());
+			}
+
+			std::size_t choice_count = story.get_current_choices().size();
+			if (choice_count == 0) {
+				break;
+			}
+
+			story.choose_choice_index((seed + turn * 7) % choice_count);
+		}
+
+		return transcript;
+	};
+
+	InkStory reused{bytes, 1};
+	std::uint64_t initial_hash = 0;
+	for (std::uint32_t seed = 0; seed < 4; ++seed) {
+		if (seed > 0) {
+			reused.reset();
+		}
+
+		reused.seed_random(0);
+		if (seed == 0) {
+			initial_hash = reused.state_hash();
+		} else {
+			EXPECT_EQ(reused.state_hash(), initial_hash);
+			EXPECT_EQ(reused.state_hash(), reused.recompute_state_hash());
+		}
+
+		InkStory fresh{bytes, 1};
+		EXPECT_EQ(play(reused, seed), play(fresh, seed)) << "seed " << seed;
+	}
+}
+
+TEST_F(OptimizationTests, ForkCarriesOnLikeTheOriginal) {
+	InkStory compiled = compiler.compile_file(INKCPP_WORKING_DIR "/tests/23_long_examples/23b_crime_scene.ink");
+	InkStory story{compiled.get_story_data()->get_serialized_bytes(), 1};
+	story.seed_random(5);
+
+	auto read_lines = [](InkStory& from) {
+		std::vector<std::string> lines;
+		while (from.can_continue()) {
+			lines.push_back(from.continue_story());
+		}
+
+		return lines;
+	};
+
+	read_lines(story);
+	for (std::size_t turn = 0; turn < 12 && !story.get_current_choices().empty(); ++turn) {
+		std::unique_ptr<InkStory> same = story.fork();
+		std::unique_ptr<InkStory> other = story.fork();
+		EXPECT_EQ(same->state_hash(), story.state_hash());
+		EXPECT_EQ(same->get_current_choices(), story.get_current_choices());
+
+		// a fork taking another choice leaves the story it came from alone
+		other->choose_choice_index(story.get_current_choices().size() - 1);
+		read_lines(*other);
+
+		std::size_t choice = turn % story.get_current_choices().size();
+		story.choose_choice_index(choice);
+		same->choose_choice_index(choice);
+		EXPECT_EQ(read_lines(*same), read_lines(story)) << "turn " << turn;
+		EXPECT_EQ(same->state_hash(), story.state_hash());
+		EXPECT_EQ(same->state_hash(), same->recompute_state_hash());
+	}
+}
+
+TEST_F(OptimizationTests, BehaviourHashLeavesOutWhatCantMatter) {
+	InkStory compiled = compiler.compile_script(
+		"-> room\n"
+		"=== room\n"
+		"- (top)\n"
+		"* [Look around]\n"
+		"    - - (around)\n"
+		"    * * [At the floor] Dust. -> around\n"
+		"    * * [At the ceiling] Cobwebs. -> around\n"
+		"    * * [Enough] -> top\n"
+		"+ [Wait] -> top\n"
+		"+ {top > 2} [Leave] -> outside\n"
+		"=== outside\n"
+		"Out. -> END\n"
+	);
+
+	ByteVec bytes = compiled.get_story_data()->get_serialized_bytes();
+	auto play = [&bytes](const std::vector<std::size_t>& path) {
+		std::unique_ptr<InkStory> story = std::make_unique<InkStory>(bytes, 1);
+		for (std::size_t choice : path) {
+			while (story->can_continue()) {
+				story->continue_story();
+			}
+
+			story->choose_choice_index(choice);
+		}
+
+		while (story->can_continue()) {
+			story->continue_story();
+		}
+
+		return story;
+	};
+
+	// which of the room's details were looked at stops mattering once there's no going back to look again
+	EXPECT_NE(play({0, 0})->behaviour_hash(), play({0, 1})->behaviour_hash());
+	EXPECT_NE(play({0, 0, 1})->state_hash(), play({0, 1, 1})->state_hash());
+	EXPECT_EQ(play({0, 0, 1})->behaviour_hash(), play({0, 1, 1})->behaviour_hash());
+
+	// waiting only matters until there's been enough of it to leave
+	EXPECT_NE(play({1})->behaviour_hash(), play({1, 1})->behaviour_hash());
+	EXPECT_NE(play({1, 1, 1})->state_hash(), play({1, 1, 1, 1})->state_hash());
+	EXPECT_EQ(play({1, 1, 1})->behaviour_hash(), play({1, 1, 1, 1})->behaviour_hash());
+}
+#pragma endregion
+
+#pragma region StoryHostTests
+TEST_F(StoryHostTests, SessionsMatchDirectPlaythrough) {
+	InkStory direct = compiler.compile_file(INKCPP_WORKING_DIR "/tests/23_long_examples/23b_crime_scene.ink");
+	StoryHost host{2};
+	StoryHost::ProgramId program = host.add_program(direct.get_story_data()->get_serialized_bytes());
+	EXPECT_THROW(host.create_session(program + 1), std::runtime_error);
+
+	std::vector<StoryHost::Session*> sessions;
+	for (std::uint32_t seed = 0; seed < 4; ++seed) {
+		sessions.push_back(&host.create_session(program, seed));
+	}
+
+	direct.seed_random(0);
+	std::vector<std::string> transcript;
+	for (int turn = 0; turn < 5; ++turn) {
+		while (direct.can_continue()) {
+			transcript.push_back(direct.continue_story());
+		}
+
+		if (direct.get_current_choices().empty()) {
+			break;
+		}
+
+		transcript.push_back("> " + direct.get_current_choices()[0]);
+		direct.choose_choice_index(0);
+	}
+
+	// each session queues its whole playthrough up front, so requests to different sessions interleave on the workers
+	std::vector<std::future<std::vector<std::string>>> results;
+	for (StoryHost::Session* session : sessions) {
+		results.push_back(host.submit(*session, [](InkStory& story) {
+			story.seed_random(0);
+			std::vector<std::string> lines;
+			for (int turn = 0; turn < 5; ++turn) {
+				while (story.can_continue()) {
+					lines.push_back(story.continue_story());
+				}
+
+				if (story.get_current_choices().empty()) {
+					break;
+				}
+
+				lines.push_back("> " + story.get_current_choices()[0]);
+				story.choose_choice_index(0);
+			}
+
+			return lines;
+		}));
+	}
+
+	for (std::future<std::vector<std::string>>& result : results) {
+		EXPECT_EQ(result.get(), transcript);
+	}
+
+	// requests to one session run in the order they were made
+	StoryHost::Session& session = *sessions[0];
+	host.destroy_session(*sessions[1]);
+	std::future<std::string> first = host.continue_story(session);
+	std::future<std::size_t> choice_count = host.submit(session, [](InkStory& story) { return story.get_current_choices().size(); });
+	EXPECT_EQ(first.get(), direct.continue_story());
+	EXPECT_EQ(choice_count.get(), direct.get_current_choices().size());
+	host.destroy_session(session);
+}
+
+TEST_F(StoryHostTests, AdvanceBatchMatchesSteppingEachStory) {
+	InkStory compiled = compiler.compile_file(INKCPP_WORKING_DIR "/tests/23_long_examples/23b_crime_scene.ink");
+	ByteVec bytes = compiled.get_story_data()->get_serialized_bytes();
+	std::shared_ptr<InkStoryData> story_data = InkStory::load_story_data(bytes);
+
+	// the batched stories share one program, so the ones stopped at the same place get grouped together
+	std::vector<std::unique_ptr<InkStory>> batched;
+	std::vector<std::unique_ptr<InkStory>> stepped;
+	std::vector<InkStory*> batch;
+	std::vector<std::size_t> choices;
+	for (std::size_t i = 0; i < 70; ++i) {
+		batched.push_back(std::make_unique<InkStory>(story_data));
+		stepped.push_back(std::make_unique<InkStory>(bytes, 1));
+		batch.push_back(batched.back().get());
+		choices.push_back(i % 3);
+	}
+
+	EXPECT_THROW(advance_batch(batch, std::span(choices).first(1), 1), std::runtime_error);
+
+	for (int step = 0; step < 8; ++step) {
+		std::vector<std::string> lines = advance_batch(batch, choices, 3);
+		ASSERT_EQ(lines.size(), stepped.size());
+		for (std::size_t i = 0; i < stepped.size(); ++i) {
+			InkStory& story = *stepped[i];
+			if (!story.can_continue() && !story.get_current_choices().empty()) {
+				story.choose_choice_index(choices[i]);
+			}
+
+			EXPECT_EQ(lines[i], story.can_continue() ? story.continue_story() : "") << "story " << i << ", step " << step;
+		}
+	}
+}
+
+TEST_F(StoryHostTests, AsyncExternalFunctionsSuspendTheStory) {
+	std::string script = R"(EXTERNAL fetch_price(item)
+EXTERNAL log_visit()
+VAR gold = 0
+Welcome to the shop.
+~ gold = fetch_price("sword") + 1
+The sword costs {gold} gold, and a shield {fetch_price("shield")}.
+~ log_visit()
+* [Buy] You buy the sword.
+- Done.
+)";
+
+	InkStory story = compiler.compile_script(script);
+	EXPECT_THROW(story.bind_external_function("not_declared", [](const auto&) { return ExpressionParserV2::Variant(); }), std::runtime_error);
+
+	int visits = 0;
+	std::vector<std::pair<std::string, std::shared_ptr<ExpressionParserV2::PendingValue>>> lookups;
+	story.bind_external_function("log_visit", [&visits](const auto&) { ++visits; return ExpressionParserV2::Variant(); });
+	story.bind_async_external_function("fetch_price", [&lookups](const std::vector<ExpressionParserV2::Variant>& arguments) -> ExpressionParserV2::ExternalResult {
+		lookups.emplace_back(static_cast<std::string>(arguments[0]), std::make_shared<ExpressionParserV2::PendingValue>());
+		return lookups.back().second;
+	});
+
+	// the story stops on the first lookup, and nothing changes until it's been answered
+	EXPECT_EQ(story.continue_story(), "");
+	EXPECT_TRUE(story.is_waiting());
+	EXPECT_FALSE(story.can_continue());
+	EXPECT_EQ(story.continue_story(), "");
+	ASSERT_EQ(lookups.size(), 1);
+	EXPECT_EQ(lookups[0].first, "sword");
+
+	lookups[0].second->resolve(10);
+	EXPECT_TRUE(story.can_continue());
+	EXPECT_EQ(story.continue_story(), "Welcome to the shop.");
+	EXPECT_EQ(story.get_variable("gold")->to_printable_string(), "11");
+
+	// a lookup partway through a line keeps the text before it
+	EXPECT_EQ(story.continue_story(), "");
+	ASSERT_EQ(lookups.size(), 2);
+	EXPECT_EQ(lookups[1].first, "shield");
+	lookups[1].second->resolve(7);
+	EXPECT_EQ(story.continue_story(), "The sword costs 11 gold, and a shield 7.");
+	EXPECT_EQ(visits, 1);
+	EXPECT_EQ(story.get_current_choices(), std::vector<std::string>{"Buy"});
+
+	// a host gives up the worker while a session waits, and carries on once the value arrives from some other thread
+	StoryHost host{1};
+	StoryHost::Session& session = host.create_session(host.add_program(story.get_story_data()->get_serialized_bytes()));
+	std::vector<std::jthread> services;
+	host.submit(session, [&services](InkStory& session_story) {
+		session_story.bind_external_function("log_visit", [](const auto&) { return ExpressionParserV2::Variant(); });
+		session_story.bind_async_external_function("fetch_price", [&services](const std::vector<ExpressionParserV2::Variant>& arguments) -> ExpressionParserV2::ExternalResult {
+			std::shared_ptr<ExpressionParserV2::PendingValue> price = std::make_shared<ExpressionParserV2::PendingValue>();
+			std::int64_t answer = static_cast<std::string>(arguments[0]) == "sword" ? 10 : 7;
+			services.emplace_back([price, answer]() {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				price->resolve(answer);
+			});
+
+			return price;
+		});
+	}).get();
+
+	std::future<std::string> first = host.continue_story(session);
+	std::future<std::string> second = host.continue_story(session);
+	EXPECT_EQ(first.get(), "Welcome to the shop.");
+	EXPECT_EQ(second.get(), "The sword costs 11 gold, and a shield 7.");
+	EXPECT_EQ(host.submit(session, [](InkStory& session_story) { return session_story.get_variable("gold")->to_printable_string(); }).get(), "11");
+	host.destroy_session(session);
+}
+
+TEST_F(StoryHostTests, StoriesShareLoadedProgram) {
+	InkStory compiled = compiler.compile_file(INKCPP_WORKING_DIR "/tests/23_long_examples/23b_crime_scene.ink");
+	std::shared_ptr<InkStoryData> story_data = InkStory::load_story_data(compiled.get_story_data()->get_serialized_bytes());
+
+	// two stories on the same program keep their sequences, preparations and visit counts to themselves while they take turns
+	InkStory first{story_data};
+	InkStory second{story_data};
+	InkStory alone{compiled.get_story_data()->get_serialized_bytes()};
+	for (int turn = 0; turn < 5; ++turn) {
+		while (first.can_continue()) {
+			EXPECT_EQ(first.continue_story(), alone.continue_story());
+			if (second.can_continue()) {
+				second.continue_story();
+			}
+		}
+
+		if (first.get_current_choices().empty()) {
+			break;
+		}
+
+		EXPECT_EQ(first.get_current_choices(), alone.get_current_choices());
+		first.choose_choice_index(0);
+		alone.choose_choice_index(0);
+		if (!second.get_current_choices().empty()) {
+			second.choose_choice_index(second.get_current_choices().size() - 1);
+		}
+	}
+
+	EXPECT_EQ(first.get_shared_story_data(), second.get_shared_story_data());
+}
+
+TEST_F(StoryHostTests, PostedRequestsThatThrowAreKept) {
+	InkStory story = compiler.compile_script("Hello.\nGoodbye.");
+	StoryHost host{1};
+	StoryHost::Session& session = host.create_session(host.add_program(story.get_story_data()->get_serialized_bytes()));
+
+	// a raw request that throws doesn't take the worker with it, and the session goes on to its next request
+	host.post(session, [](InkStory&) { throw std::runtime_error("first"); });
+	host.post(session, [](InkStory&) { throw std::runtime_error("second"); });
+	EXPECT_EQ(host.continue_story(session).get(), "Hello.");
+
+	std::exception_ptr error = session.take_error();
+	ASSERT_TRUE(error);
+	try {
+		std::rethrow_exception(error);
+	} catch (const std::runtime_error& e) {
+		EXPECT_EQ(std::string(e.what()), "first");
+	}
+
+	EXPECT_FALSE(session.take_error());
+	EXPECT_EQ(host.continue_story(session).get(), "Goodbye.");
+	host.destroy_session(session);
+}
+
+TEST_F(StoryHostTests, BudgetsStopRunawaySessions) {
+	InkStory recursing = compiler.compile_script(R"(Going down {down(0)}.
+
+=== function down(x)
+~ return down(x + 1)
+)");
+
+	InkStory growing = compiler.compile_script(R"(VAR text = ""
+- (grow)
+~ text = text + "xxxxxxxxxxxxxxxx"
+-> grow
+)");
+
+	StoryHost host{1};
+	StoryHost::Session& deep = host.create_session(host.add_program(recursing.get_story_data()->get_serialized_bytes()), std::nullopt, {.max_stack_depth = 200});
+	StoryHost::Session& big = host.create_session(host.add_program(growing.get_story_data()->get_serialized_bytes()), std::nullopt, {.max_bytes = 1 << 14});
+
+	std::future<std::string> deep_line = host.continue_story(deep);
+	std::future<std::string> big_line = host.continue_story(big);
+	EXPECT_THROW(deep_line.get(), std::runtime_error);
+	try {
+		big_line.get();
+		ADD_FAILURE() << "the growing story should have gone over its memory budget";
+	} catch (const std::runtime_error& e) {
+		EXPECT_TRUE(std::string(e.what()).contains("memory budget")) << e.what();
+	}
+
+	// the usage is there to look at after the fact, and is under the budget again once the session has been reset
+	StoryMemoryUsage usage = host.submit(big, [](InkStory& story) { return story.get_memory_usage(); }).get();
+	EXPECT_GT(usage.strings, std::size_t{1 << 14} / 2);
+	EXPECT_EQ(usage.total(), usage.stacks + usage.variables + usage.strings + usage.lists);
+
+	usage = host.submit(big, [](InkStory& story) { story.reset(); return story.get_memory_usage(); }).get();
+	EXPECT_LT(usage.total(), std::size_t{1 << 14});
+	host.destroy_session(deep);
+	host.destroy_session(big);
+}
+#pragma endregion
+
 #pragma region InkProof
 TEST_F(InkProof, MinimalStory) {
 	STORY("ink-proof/1_minimal_story.ink");